@@ -83,7 +83,7 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 
 	EtherAddress src = EtherAddress(w->i_addr2);
 
-	EmpowerStationState *ess = _el->get_ess(src);
+	const EmpowerStationState *ess = _el->get_ess(src);
 
 	//If we're not aware of this LVAP, ignore
 	if (!ess) {
@@ -412,7 +412,7 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 
 void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 
-    EmpowerStationState *ess = _el->get_ess(dst);
+    const EmpowerStationState *ess = _el->get_ess(dst);
 
     String ssid = ess->_ssid;
     uint16_t status = WIFI_STATUS_SUCCESS;
@@ -29,7 +29,9 @@
 CLICK_DECLS
 
 EmpowerBeaconSource::EmpowerBeaconSource() :
-		_el(0), _period(500), _timer(this), _debug(false) {
+		_el(0), _period(500), _timer(this), _template_hits(0),
+		_template_misses(0), _next_phase(0), _slots(10), _slot(0),
+		_wheel_dirty(true), _ticks(0), _debug(false) {
 }
 
 EmpowerBeaconSource::~EmpowerBeaconSource() {
@@ -37,12 +39,42 @@ EmpowerBeaconSource::~EmpowerBeaconSource() {
 
 int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
 
+	String queue_strings;
+
 	int ret = Args(conf, this, errh)
               .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			  .read("PERIOD", _period)
+			  .read("SLOTS", _slots)
+			  .read("QUEUE", queue_strings)
 			  .read("DEBUG", _debug).complete();
 
-	return ret;
+	if (ret < 0) {
+		return ret;
+	}
+
+	Vector<String> tokens;
+	cp_spacevec(queue_strings, tokens);
+
+	for (int i = 0; i < tokens.size(); i++) {
+		Storage *queue;
+		if (!ElementCastArg("Storage").parse(tokens[i], queue, Args(conf, this, errh))) {
+			return errh->error("error param %s: must be a Storage element", tokens[i].c_str());
+		}
+		_queues.push_back(queue);
+		_queue_names.push_back(tokens[i]);
+	}
+
+	_occupancy.resize(_queues.size(), 0);
+	_max_occupancy.resize(_queues.size(), 0);
+
+	if (_slots < 1 || (unsigned) _slots > _period) {
+		return errh->error("SLOTS must be between 1 and PERIOD");
+	}
+
+	_wheel.resize(_slots);
+	_slot_interval = Timestamp::make_usec((uint64_t) _period * 1000 / _slots);
+
+	return 0;
 
 }
 
@@ -52,34 +84,118 @@ int EmpowerBeaconSource::initialize(ErrorHandler *) {
 	return 0;
 }
 
-void EmpowerBeaconSource::run_timer(Timer *) {
+int EmpowerBeaconSource::assign_phase(EtherAddress addr, HashTable<EtherAddress, int> &phases) {
+	int *phase = _phases.get_pointer(addr);
+	int slot = phase ? *phase : _next_phase++ % _slots;
+	phases.set(addr, slot);
+	return slot;
+}
+
+void EmpowerBeaconSource::build_wheel() {
+
+	for (int i = 0; i < _wheel.size(); i++) {
+		_wheel[i].clear();
+	}
 
-	// send LVAP beacon
-	for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
-		for (int i = 0; i < it.value()._networks.size(); i++) {
-			EtherAddress bssid = it.value()._networks[i]._bssid;
-			String ssid = it.value()._networks[i]._ssid;
-			if (it.value()._bssid == bssid && it.value()._ssid == ssid && it.value()._csa_active) {
-				send_lvap_csa_beacon(&it.value());
+	// new LVAPs and VAPs are dealt to the slots in turn, the known ones
+	// keep their beacon phase when other LVAPs come and go
+	HashTable<EtherAddress, int> phases;
+
+	const StationIndex *stations = _el->stations();
+
+	for (LVAPIndexIter it = stations->_lvaps.begin(); it.live(); it++) {
+		_wheel[assign_phase(it.key(), phases)].push_back(BeaconSlot(it.key(), false));
+	}
+
+	for (VAPIndexIter it = stations->_vaps.begin(); it.live(); it++) {
+		_wheel[assign_phase(it.key(), phases)].push_back(BeaconSlot(it.key(), true));
+	}
+
+	_phases.swap(phases);
+
+}
+
+void EmpowerBeaconSource::invalidate_templates(EtherAddress bssid, int iface_id) {
+	_templates_lock.acquire();
+	for (BTIter it = _templates.begin(); it.live(); ) {
+		if (it.key()._bssid == bssid && it.key()._iface_id == iface_id) {
+			it = _templates.erase(it);
+		} else {
+			it++;
+		}
+	}
+	_templates_lock.release();
+}
+
+void EmpowerBeaconSource::send_slot(const BeaconWheelSlot &slot) {
+
+	for (int i = 0; i < slot.size(); i++) {
+
+		// send VAP beacons
+		if (slot[i]._vap) {
+			const EmpowerVAPState *vap = _el->get_vap(slot[i]._addr);
+			if (vap) {
+				send_beacon(EtherAddress::make_broadcast(), vap->_bssid,
+						vap->_ssid, vap->_channel, vap->_iface_id,
+						false, false, 0, 0, 0);
+			}
+			continue;
+		}
+
+		// send LVAP beacon
+		const EmpowerStationState *ess = _el->get_ess(slot[i]._addr);
+		if (!ess) {
+			continue;
+		}
+		for (int j = 0; j < ess->_networks.size(); j++) {
+			EtherAddress bssid = ess->_networks[j]._bssid;
+			String ssid = ess->_networks[j]._ssid;
+			if (ess->_bssid == bssid && ess->_ssid == ssid && ess->_csa_active) {
+				send_lvap_csa_beacon(ess);
 			} else {
-				send_beacon(it.value()._sta, bssid, ssid, it.value()._channel, it.value()._iface_id, false, false, 0, 0, 0);
+				send_beacon(ess->_sta, bssid, ssid, ess->_channel, ess->_iface_id, false, false, 0, 0, 0);
 			}
 		}
+
 	}
 
-	// send VAP beacons
-	for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-		send_beacon(EtherAddress::make_broadcast(), it.value()._bssid,
-				it.value()._ssid, it.value()._channel, it.value()._iface_id,
-				false, false, 0, 0, 0);
+}
+
+void EmpowerBeaconSource::run_timer(Timer *) {
+
+	Timestamp late = Timestamp::now_steady() - _timer.expiry_steady();
+	if (late > _max_lateness) {
+		_max_lateness = late;
+	}
+	_lateness += late;
+	_ticks++;
+
+	// clear the flag first, a change landing during the rebuild marks the
+	// wheel dirty again and is picked up by the next slot
+	if (_wheel_dirty) {
+		_wheel_dirty = false;
+		click_fence();
+		build_wheel();
 	}
 
-	// re-schedule the timer with some jitter
-	_timer.schedule_after_msec(_period);
+	send_slot(_wheel[_slot]);
+
+	for (int i = 0; i < _queues.size(); i++) {
+		int occupancy = _queues[i]->size();
+		_occupancy[i] += occupancy;
+		if (occupancy > _max_occupancy[i]) {
+			_max_occupancy[i] = occupancy;
+		}
+	}
+
+	// keep the slots aligned to the first expiry so that lateness does not
+	// accumulate into the beacon interval
+	_slot = (_slot + 1) % _slots;
+	_timer.reschedule_after(_slot_interval);
 
 }
 
-void EmpowerBeaconSource::send_lvap_csa_beacon(EmpowerStationState *ess) {
+void EmpowerBeaconSource::send_lvap_csa_beacon(const EmpowerStationState *ess) {
 
 	if (_debug) {
 		click_chatter("%{element} :: %s :: sending CSA to %s current channel %u target channel %u csa mode %u csa count %u",
@@ -96,9 +212,7 @@ void EmpowerBeaconSource::send_lvap_csa_beacon(EmpowerStationState *ess) {
 			ess->_iface_id, false, true, ess->_csa_switch_mode,
 			ess->_csa_switch_count, ess->_csa_switch_channel);
 
-	ess->_csa_switch_count--;
-
-	if (ess->_csa_switch_count < 0) {
+	if (_el->decrement_csa_count(ess->_sta) < 0) {
 
 		click_chatter("%{element} :: %s :: CSA procedure for %s is over, removing LVAP",
 					  this,
@@ -107,6 +221,7 @@ void EmpowerBeaconSource::send_lvap_csa_beacon(EmpowerStationState *ess) {
 
 		// remove lvap
 		_el->remove_lvap(ess->_sta);
+		update_beacons();
 		// send del lvap response
 		_el->send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, ess->_sta, ess->_module_id, 0);
 
@@ -129,6 +244,52 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 					  iface_id);
 	}
 
+	WritablePacket *p;
+
+	if (csa_active) {
+		p = build_beacon(dst, bssid, ssid, channel, iface_id, probe, csa_active, csa_mode, csa_count, csa_channel);
+	} else {
+		BeaconKey key = BeaconKey(bssid, ssid, channel, iface_id, probe);
+		_templates_lock.acquire();
+		String frame = _templates.get(key);
+		_templates_lock.release();
+		if (frame.length()) {
+			// only the destination differs between frames from the same template
+			_template_hits++;
+			p = Packet::make(frame.data(), frame.length());
+			if (p) {
+				struct click_wifi *w = (struct click_wifi *) p->data();
+				memcpy(w->i_addr1, dst.data(), 6);
+			}
+		} else {
+			_template_misses++;
+			Timestamp start = Timestamp::now();
+			p = build_beacon(dst, bssid, ssid, channel, iface_id, probe, false, 0, 0, 0);
+			_build_time += Timestamp::now() - start;
+			if (p) {
+				_templates_lock.acquire();
+				_templates.set(key, String(p->data(), p->length()));
+				_templates_lock.release();
+			}
+		}
+	}
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		return;
+	}
+
+	SET_PAINT_ANNO(p, iface_id);
+	output(0).push(p);
+
+}
+
+WritablePacket *EmpowerBeaconSource::build_beacon(EtherAddress dst, EtherAddress bssid,
+		String ssid, int channel, int iface_id, bool probe, bool csa_active,
+		int csa_mode, int csa_count, int csa_channel) {
+
 	/* order elements by standard
 	 * needed by sloppy 802.11b driver implementations
 	 * to be able to connect to 802.11g APs
@@ -154,15 +315,13 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	WritablePacket *p = Packet::make(max_len);
-	memset(p->data(), 0, p->length());
 
 	if (!p) {
-		click_chatter("%{element} :: %s :: cannot make packet!",
-				      this,
-				      __func__);
-		return;
+		return 0;
 	}
 
+	memset(p->data(), 0, p->length());
+
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
 	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT;
@@ -358,8 +517,8 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	p->take(max_len - actual_length);
-	SET_PAINT_ANNO(p, iface_id);
-	output(0).push(p);
+
+	return p;
 
 }
 
@@ -637,7 +796,7 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 
 }
 
-void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String ssid) {
+void EmpowerBeaconSource::send_probe_response(const EmpowerStationState *ess, String ssid) {
 
 	if (ssid == "") {
 
@@ -648,9 +807,9 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		}
 
 		// reply also with all vaps
-		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-			send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-					it.value()._channel, it.value()._iface_id, true, false, 0,
+		for (VAPIndexIter it = _el->stations()->_vaps.begin(); it.live(); it++) {
+			send_beacon(ess->_sta, it.value()->_bssid, it.value()->_ssid,
+					it.value()->_channel, it.value()->_iface_id, true, false, 0,
 					0, 0);
 		}
 
@@ -666,10 +825,10 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		}
 
 		// reply also with all vaps
-		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-			if (it.value()._ssid == ssid) {
-				send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-						it.value()._channel, it.value()._iface_id, true, false,
+		for (VAPIndexIter it = _el->stations()->_vaps.begin(); it.live(); it++) {
+			if (it.value()->_ssid == ssid) {
+				send_beacon(ess->_sta, it.value()->_bssid, it.value()->_ssid,
+						it.value()->_channel, it.value()->_iface_id, true, false,
 						0, 0, 0);
 			}
 		}
@@ -679,7 +838,7 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 }
 
 enum {
-	H_DEBUG,
+	H_DEBUG, H_TEMPLATES, H_SCHEDULE
 };
 
 String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
@@ -687,6 +846,32 @@ String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
 	switch ((uintptr_t) thunk) {
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_TEMPLATES: {
+		StringAccum sa;
+		uint32_t total = td->_template_hits + td->_template_misses;
+		sa << "hits " << td->_template_hits
+		   << " misses " << td->_template_misses
+		   << " hit_rate " << (total ? (uint32_t) ((uint64_t) td->_template_hits * 100 / total) : 0) << "%"
+		   << " entries " << td->_templates.size()
+		   << " build_usec " << (td->_template_misses ? td->_build_time.usecval() / td->_template_misses : 0)
+		   << "\n";
+		return sa.take_string();
+	}
+	case H_SCHEDULE: {
+		StringAccum sa;
+		uint32_t ticks = td->_ticks;
+		sa << "slots " << td->_slots
+		   << " lateness " << (ticks ? (uint32_t) (td->_lateness.usecval() / ticks) : 0)
+		   << " max_lateness " << (uint32_t) td->_max_lateness.usecval()
+		   << "\n";
+		for (int i = 0; i < td->_queues.size(); i++) {
+			sa << td->_queue_names[i]
+			   << " occupancy " << (ticks ? (uint32_t) (td->_occupancy[i] / ticks) : 0)
+			   << " max_occupancy " << td->_max_occupancy[i]
+			   << "\n";
+		}
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -712,6 +897,8 @@ int EmpowerBeaconSource::write_handler(const String &in_s, Element *e,
 
 void EmpowerBeaconSource::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("templates", read_handler, (void *) H_TEMPLATES);
+	add_read_handler("schedule", read_handler, (void *) H_SCHEDULE);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
@@ -4,6 +4,8 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/timer.hh>
+#include <click/hashtable.hh>
+#include <click/standard/storage.hh>
 #include <elements/wifi/availablerates.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
@@ -40,14 +42,90 @@ The wireless channel it is operating on.
 =item PERIOD
 How often beacon packets are sent, in milliseconds.
 
+=item SLOTS
+Number of slots the beacon interval is divided into, default is 10. LVAPs
+and VAPs are assigned to the slots round-robin the first time they are seen
+and keep their slot for as long as they exist, and each slot only sends the
+beacons of its own LVAPs and VAPs, so transmissions are spread evenly across
+the interval instead of leaving in one burst.
+
+=item QUEUE
+Space-separated list of the management queues fed by this element, one per
+radio. If set, their occupancy is sampled after each slot.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+Beacons and probe responses are built once per (BSSID, SSID, channel,
+interface) and kept as templates. Each transmission copies the template and
+patches the destination address; the timestamp is left to the driver. The
+EmpowerLVAPManager drops the templates of a BSSID on an interface when the
+transmission policy of that BSSID changes and when the LVAP or VAP owning it
+is updated or removed, the other templates are kept. Beacons carrying a
+channel switch announcement change at every period and are always built from
+scratch.
+
+=h templates read-only
+Template hits, misses, hit rate, cached entries and average build time in
+microseconds.
+
+=h schedule read-only
+Number of slots and average and maximum lateness of the slots in
+microseconds, followed by the average and maximum occupancy of each QUEUE.
+
 =a EmpowerLVAPManager
 */
 
+class BeaconKey {
+  public:
+
+	EtherAddress _bssid;
+	String _ssid;
+	int _channel;
+	int _iface_id;
+	bool _probe;
+
+	BeaconKey() : _channel(0), _iface_id(0), _probe(false) {
+	}
+
+	BeaconKey(EtherAddress bssid, String ssid, int channel, int iface_id, bool probe) :
+			_bssid(bssid), _ssid(ssid), _channel(channel), _iface_id(iface_id), _probe(probe) {
+	}
+
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_bssid) + CLICK_NAME(hashcode)(_ssid) +
+				(_channel << 9) + (_iface_id << 1) + _probe;
+	}
+
+	inline bool operator==(const BeaconKey &other) const {
+		return (other._bssid == _bssid && other._ssid == _ssid &&
+				other._channel == _channel && other._iface_id == _iface_id &&
+				other._probe == _probe);
+	}
+
+};
+
+typedef HashTable<BeaconKey, String> BeaconTemplates;
+typedef BeaconTemplates::iterator BTIter;
+
+class BeaconSlot {
+  public:
+
+	EtherAddress _addr;
+	bool _vap;
+
+	BeaconSlot() : _vap(false) {
+	}
+
+	BeaconSlot(EtherAddress addr, bool vap) : _addr(addr), _vap(vap) {
+	}
+
+};
+
+typedef Vector<BeaconSlot> BeaconWheelSlot;
+
 class EmpowerBeaconSource: public Element {
 public:
 
@@ -64,9 +142,17 @@ public:
 	void run_timer(Timer *);
 
 	void send_beacon(EtherAddress, EtherAddress, String, int, int, bool, bool, int, int, int);
-	void send_lvap_csa_beacon(EmpowerStationState *);
+	void send_lvap_csa_beacon(const EmpowerStationState *);
 
-	void send_probe_response(EmpowerStationState *, String);
+	void send_probe_response(const EmpowerStationState *, String);
+
+	// called whenever LVAPs or VAPs are added or removed
+	void update_beacons() {
+		_wheel_dirty = true;
+	}
+
+	// drops the templates of a BSSID on an interface
+	void invalidate_templates(EtherAddress, int);
 
 	void push(int, Packet *);
 
@@ -77,6 +163,35 @@ private:
 	unsigned int _period; // msecs
 	Timer _timer;
 
+	// probe responses are built on the RX threads, beacons on the timer
+	SimpleSpinlock _templates_lock;
+	BeaconTemplates _templates;
+	uint32_t _template_hits;
+	uint32_t _template_misses;
+	Timestamp _build_time;
+
+	WritablePacket *build_beacon(EtherAddress, EtherAddress, String, int, int, bool, bool, int, int, int);
+
+	Vector<BeaconWheelSlot> _wheel;
+	HashTable<EtherAddress, int> _phases;
+	int _next_phase;
+	int _slots;
+	int _slot;
+	volatile bool _wheel_dirty;
+	Timestamp _slot_interval;
+
+	Vector<Storage *> _queues;
+	Vector<String> _queue_names;
+	Vector<uint64_t> _occupancy;
+	Vector<int> _max_occupancy;
+	uint32_t _ticks;
+	Timestamp _lateness;
+	Timestamp _max_lateness;
+
+	void build_wheel();
+	int assign_phase(EtherAddress, HashTable<EtherAddress, int> &);
+	void send_slot(const BeaconWheelSlot &);
+
 	bool _debug;
 
 	// Read/Write handlers
@@ -0,0 +1,734 @@
+/*
+ * empowercontrolleremulator.{cc,hh} -- stand-in EmPOWER controller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include "empowerpacket.hh"
+#include "empowerlvapmanager.hh"
+#include "empowercontrolleremulator.hh"
+CLICK_DECLS
+
+static const char * const message_names[] = {
+	"add_lvap", "del_lvap", "set_slice", "counters", "ucqm"
+};
+
+static int
+compare_samples(const void *a, const void *b, void *)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+String EmulatorLatency::unparse(uint32_t pending) const {
+	Vector<uint32_t> sorted(_samples);
+	if (sorted.size()) {
+		click_qsort(sorted.begin(), sorted.size(), sizeof(uint32_t), compare_samples, 0);
+	}
+	StringAccum sa;
+	sa << "sent " << _sent << " answered " << _answered << " pending " << pending;
+	if (sorted.size()) {
+		int n = sorted.size();
+		sa << " p50 " << sorted[n * 50 / 100]
+		   << " p90 " << sorted[n * 90 / 100]
+		   << " p99 " << sorted[n * 99 / 100]
+		   << " max " << sorted[n - 1];
+	} else {
+		sa << " p50 0 p90 0 p99 0 max 0";
+	}
+	return sa.take_string();
+}
+
+EmpowerControllerEmulator::EmpowerControllerEmulator() :
+		_channel(0), _band(EMPOWER_BT_HT20), _nb_lvaps(256), _ssid("empower"),
+		_nb_slices(8), _graph_id(1), _delta(false), _limit(0), _active(true), _debug(false),
+		_timer(this), _seq(0), _next_id(0), _reset_id(0), _generated(0), _next_sta(0),
+		_next_counters(0), _next_slice(0), _ucqm_dropped(0), _ucqm_responses(0),
+		_ucqm_full(0), _ucqm_entries(0), _ucqm_bytes(0), _unexpected(0) {
+	static const uint8_t sta[6] = { 0x02, 0, 0, 0, 0, 0 };
+	static const uint8_t bssid[6] = { 0x02, 0xca, 0xfe, 0, 0, 0 };
+	_sta = EtherAddress(sta);
+	_bssid = EtherAddress(bssid);
+	for (int i = 0; i < T_MAX; i++) {
+		_rates[i] = 0;
+		_credits[i] = 0;
+	}
+}
+
+EmpowerControllerEmulator::~EmpowerControllerEmulator() {
+}
+
+int EmpowerControllerEmulator::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	int channel;
+	String band;
+
+	int res = Args(conf, this, errh)
+			.read_mp("HWADDR", _hwaddr)
+			.read_mp("CHANNEL", channel)
+			.read_mp("BAND", band)
+			.read("STA", _sta)
+			.read("LVAPS", _nb_lvaps)
+			.read("BSSID", _bssid)
+			.read("SSID", _ssid)
+			.read("SLICES", _nb_slices)
+			.read("ADD_RATE", _rates[T_ADD_LVAP])
+			.read("DEL_RATE", _rates[T_DEL_LVAP])
+			.read("SLICE_RATE", _rates[T_SET_SLICE])
+			.read("COUNTERS_RATE", _rates[T_COUNTERS])
+			.read("UCQM_RATE", _rates[T_UCQM])
+			.read("GRAPH_ID", _graph_id)
+			.read("DELTA", _delta)
+			.read("LIMIT", _limit)
+			.read("ACTIVE", _active)
+			.read("DEBUG", _debug)
+			.complete();
+
+	if (res < 0) {
+		return res;
+	}
+
+	if (band == "L20") {
+		_band = EMPOWER_BT_L20;
+	} else if (band == "HT20") {
+		_band = EMPOWER_BT_HT20;
+	} else {
+		return errh->error("invalid band %s", band.c_str());
+	}
+
+	if (channel < 1 || channel > 255) {
+		return errh->error("invalid channel %d", channel);
+	}
+	_channel = channel;
+
+	if (!_nb_lvaps || _nb_lvaps > 0xFFFFFF) {
+		return errh->error("LVAPS must be between 1 and %d", 0xFFFFFF);
+	}
+
+	if (!_nb_slices || _nb_slices > 64) {
+		return errh->error("SLICES must be between 1 and 64");
+	}
+
+	if (_ssid.length() > WIFI_NWID_MAXSIZE) {
+		return errh->error("SSID longer than %d characters", WIFI_NWID_MAXSIZE);
+	}
+
+	_slice_requests.resize(_nb_slices, Timestamp());
+
+	return 0;
+
+}
+
+int EmpowerControllerEmulator::initialize(ErrorHandler *) {
+	_timer.initialize(this);
+	_last_tick = Timestamp::now_steady();
+	_timer.schedule_after_msec(TICK_MSEC);
+	return 0;
+}
+
+void EmpowerControllerEmulator::run_timer(Timer *) {
+
+	Timestamp now = Timestamp::now_steady();
+	uint64_t usec = (now - _last_tick).usecval();
+	_last_tick = now;
+
+	if (_active) {
+		// credits are kept in millionths of a message
+		for (int t = 0; t < T_MAX; t++) {
+			_credits[t] += (uint64_t) _rates[t] * usec;
+			// do not burst after a stall longer than a second
+			if (_credits[t] > (uint64_t) _rates[t] * 1000000) {
+				_credits[t] = (uint64_t) _rates[t] * 1000000;
+			}
+		}
+		bool more = true;
+		while (more) {
+			more = false;
+			for (int t = 0; t < T_MAX; t++) {
+				if (_credits[t] < 1000000) {
+					continue;
+				}
+				if (_limit && _generated >= _limit) {
+					_active = false;
+					break;
+				}
+				_credits[t] -= 1000000;
+				bool sent = false;
+				switch (t) {
+				case T_ADD_LVAP:
+					sent = send_add_lvap();
+					break;
+				case T_DEL_LVAP:
+					sent = send_del_lvap();
+					break;
+				case T_SET_SLICE:
+					sent = send_set_slice();
+					break;
+				case T_COUNTERS:
+					sent = send_counters_request();
+					break;
+				case T_UCQM:
+					sent = send_ucqm_request();
+					break;
+				}
+				if (sent) {
+					_generated++;
+				}
+				more = true;
+			}
+		}
+	}
+
+	_timer.reschedule_after_msec(TICK_MSEC);
+
+}
+
+void EmpowerControllerEmulator::send(WritablePacket *p) {
+	struct empower_header *h = (struct empower_header *) p->data();
+	h->set_version(_empower_version);
+	h->set_length(p->length());
+	h->set_seq(++_seq);
+	output(0).push(p);
+}
+
+bool EmpowerControllerEmulator::send_add_lvap() {
+
+	// the pool is exhausted, the LVAPs have to be removed first
+	if ((uint32_t) _added.size() >= _nb_lvaps) {
+		return false;
+	}
+
+	EtherAddress sta;
+	do {
+		uint32_t index = _next_sta++ % _nb_lvaps;
+		const uint8_t *d = _sta.data();
+		uint32_t suffix = ((d[3] << 16) | (d[4] << 8) | d[5]) + index;
+		uint8_t addr[6] = { d[0], d[1], d[2], (uint8_t) (suffix >> 16), (uint8_t) (suffix >> 8), (uint8_t) suffix };
+		sta = EtherAddress(addr);
+	} while (_is_added.get(sta));
+
+	int len = sizeof(empower_add_lvap) + sizeof(ssid_entry);
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return false;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	uint32_t id = ++_next_id;
+
+	empower_add_lvap *add_lvap = (struct empower_add_lvap *) (p->data());
+	add_lvap->set_type(EMPOWER_PT_ADD_LVAP);
+	add_lvap->set_module_id(id);
+	add_lvap->set_flag(EMPOWER_STATUS_LVAP_AUTHENTICATED);
+	add_lvap->set_flag(EMPOWER_STATUS_LVAP_ASSOCIATED);
+	add_lvap->set_flag(EMPOWER_STATUS_LVAP_SET_MASK);
+	add_lvap->set_assoc_id(_next_sta & 0x3FFF);
+	add_lvap->set_hwaddr(_hwaddr);
+	add_lvap->set_channel(_channel);
+	add_lvap->set_band(_band);
+	add_lvap->set_supported_band(_band);
+	add_lvap->set_sta(sta);
+	add_lvap->set_encap(EtherAddress());
+	add_lvap->set_bssid(_bssid);
+	add_lvap->set_ssid(_ssid);
+
+	ssid_entry *entry = (ssid_entry *) (p->data() + sizeof(empower_add_lvap));
+	entry->set_bssid(_bssid);
+	entry->set_ssid(_ssid);
+
+	_added.push_back(sta);
+	_is_added.set(sta, true);
+
+	_requests.set(id, EmulatorRequest(T_ADD_LVAP));
+	_latency[T_ADD_LVAP]._sent++;
+	send(p);
+	return true;
+
+}
+
+bool EmpowerControllerEmulator::send_del_lvap() {
+
+	if (!_added.size()) {
+		return false;
+	}
+
+	EtherAddress sta = _added.front();
+	_added.pop_front();
+	_is_added.erase(sta);
+
+	WritablePacket *p = Packet::make(sizeof(empower_del_lvap));
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return false;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	uint32_t id = ++_next_id;
+
+	empower_del_lvap *del_lvap = (struct empower_del_lvap *) (p->data());
+	del_lvap->set_type(EMPOWER_PT_DEL_LVAP);
+	del_lvap->set_module_id(id);
+	del_lvap->set_sta(sta);
+
+	_requests.set(id, EmulatorRequest(T_DEL_LVAP));
+	_latency[T_DEL_LVAP]._sent++;
+	send(p);
+	return true;
+
+}
+
+bool EmpowerControllerEmulator::send_set_slice() {
+
+	uint32_t dscp = _next_slice++ % _nb_slices;
+
+	WritablePacket *p = Packet::make(sizeof(empower_set_slice));
+	WritablePacket *q = Packet::make(sizeof(empower_header));
+
+	if (!p || !q) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		if (p) {
+			p->kill();
+		}
+		if (q) {
+			q->kill();
+		}
+		return false;
+	}
+
+	memset(p->data(), 0, p->length());
+	memset(q->data(), 0, q->length());
+
+	empower_set_slice *set_slice = (struct empower_set_slice *) (p->data());
+	set_slice->set_type(EMPOWER_PT_SET_SLICE);
+	set_slice->set_hwaddr(_hwaddr);
+	set_slice->set_channel(_channel);
+	set_slice->set_band(_band);
+	set_slice->set_quantum(12000 + 1000 * (_next_slice % 4));
+	set_slice->set_dscp(dscp);
+	set_slice->set_ssid(_ssid);
+
+	empower_header *status_req = (struct empower_header *) (q->data());
+	status_req->set_type(EMPOWER_PT_SLICE_STATUS_REQ);
+
+	// a newer request for the same slice supersedes the pending one
+	_slice_requests[dscp] = Timestamp::now_steady();
+	_latency[T_SET_SLICE]._sent++;
+	send(p);
+	send(q);
+	return true;
+
+}
+
+bool EmpowerControllerEmulator::send_counters_request() {
+
+	if (!_added.size()) {
+		return false;
+	}
+
+	if (_next_counters >= _added.size()) {
+		_next_counters = 0;
+	}
+
+	EtherAddress sta = _added[_next_counters++];
+
+	WritablePacket *p = Packet::make(sizeof(empower_counters_request));
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return false;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	uint32_t id = ++_next_id;
+
+	empower_counters_request *counters = (struct empower_counters_request *) (p->data());
+	counters->set_type(EMPOWER_PT_COUNTERS_REQUEST);
+	counters->set_counters_id(id);
+	counters->set_sta(sta);
+
+	_requests.set(id, EmulatorRequest(T_COUNTERS));
+	_latency[T_COUNTERS]._sent++;
+	send(p);
+	return true;
+
+}
+
+bool EmpowerControllerEmulator::send_ucqm_request() {
+
+	WritablePacket *p = Packet::make(sizeof(empower_cqm_request));
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return false;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	empower_cqm_request *ucqm = (struct empower_cqm_request *) (p->data());
+	ucqm->set_type(_delta ? EMPOWER_PT_UCQM_DELTA_REQUEST : EMPOWER_PT_UCQM_REQUEST);
+	ucqm->set_graph_id(_graph_id);
+	ucqm->set_hwaddr(_hwaddr);
+	ucqm->set_channel(_channel);
+	ucqm->set_band(_band);
+
+	_ucqm_requests.push_back(Timestamp::now_steady());
+	_latency[T_UCQM]._sent++;
+	send(p);
+	return true;
+
+}
+
+void EmpowerControllerEmulator::handle_ucqm_response(const uint8_t *start, const uint8_t *entries, uint32_t len, uint32_t nb_entries, bool full) {
+
+	// answers to requests dropped by a reset
+	if (_ucqm_dropped) {
+		_ucqm_dropped--;
+		return;
+	}
+
+	// the entries must fit in the message
+	if (!_ucqm_requests.size() || nb_entries > (len - (entries - start)) / sizeof(cqm_entry)) {
+		_unexpected++;
+		return;
+	}
+
+	answered(T_UCQM, _ucqm_requests.front());
+	_ucqm_requests.pop_front();
+	_ucqm_responses++;
+	_ucqm_entries += nb_entries;
+	_ucqm_bytes += len;
+
+	// a full response replaces the map, a delta one only updates it
+	if (full) {
+		_ucqm_full++;
+		_ucqm_map.clear();
+	}
+
+	for (uint32_t i = 0; i < nb_entries; i++) {
+		cqm_entry *entry = (cqm_entry *) (entries + i * sizeof(cqm_entry));
+		_ucqm_map.set(entry->sta(), true);
+	}
+
+}
+
+void EmpowerControllerEmulator::answered(int type, const Timestamp &sent) {
+	Timestamp delay = Timestamp::now_steady() - sent;
+	_latency[type].add_sample(delay.usecval());
+}
+
+void EmpowerControllerEmulator::handle_message(const uint8_t *data, uint32_t len) {
+
+	struct empower_header *h = (struct empower_header *) data;
+	uint32_t id = 0;
+	int type = -1;
+
+	switch (h->type()) {
+	case EMPOWER_PT_ADD_LVAP_RESPONSE:
+	case EMPOWER_PT_DEL_LVAP_RESPONSE:
+		if (len >= sizeof(empower_add_del_lvap_response)) {
+			id = ((struct empower_add_del_lvap_response *) data)->module_id();
+			type = h->type() == EMPOWER_PT_ADD_LVAP_RESPONSE ? T_ADD_LVAP : T_DEL_LVAP;
+		}
+		break;
+	case EMPOWER_PT_COUNTERS_RESPONSE:
+		if (len >= sizeof(empower_counters_response)) {
+			id = ((struct empower_counters_response *) data)->counters_id();
+			type = T_COUNTERS;
+		}
+		break;
+	case EMPOWER_PT_STATUS_SLICE:
+		if (len >= sizeof(empower_status_slice)) {
+			struct empower_status_slice *status = (struct empower_status_slice *) data;
+			uint32_t dscp = status->dscp();
+			// the status of the default slices and of answered ones is ignored
+			if (dscp < _nb_slices && status->ssid() == _ssid && _slice_requests[dscp]) {
+				answered(T_SET_SLICE, _slice_requests[dscp]);
+				_slice_requests[dscp] = Timestamp();
+			}
+		}
+		return;
+	case EMPOWER_PT_UCQM_RESPONSE:
+		if (len >= sizeof(empower_cqm_response)) {
+			struct empower_cqm_response *ucqm = (struct empower_cqm_response *) data;
+			if (ucqm->graph_id() == _graph_id) {
+				handle_ucqm_response(data, data + sizeof(empower_cqm_response), len, ucqm->nb_entries(), true);
+			}
+		}
+		return;
+	case EMPOWER_PT_UCQM_DELTA_RESPONSE:
+		if (len >= sizeof(empower_cqm_delta_response)) {
+			struct empower_cqm_delta_response *ucqm = (struct empower_cqm_delta_response *) data;
+			if (ucqm->graph_id() == _graph_id) {
+				handle_ucqm_response(data, data + sizeof(empower_cqm_delta_response), len,
+						ucqm->nb_entries(), ucqm->flag(EMPOWER_CQM_FULL));
+			}
+		}
+		return;
+	default:
+		// hello, status and other unsolicited messages
+		return;
+	}
+
+	// answers to requests dropped by a reset
+	if (type >= 0 && id <= _reset_id) {
+		return;
+	}
+
+	ERIter it = _requests.find(id);
+
+	if (type < 0 || it == _requests.end() || it.value()._type != type) {
+		_unexpected++;
+		if (_debug) {
+			click_chatter("%{element} :: %s :: unexpected response type 0x%x id %u",
+						  this,
+						  __func__,
+						  h->type(),
+						  id);
+		}
+		return;
+	}
+
+	answered(type, it.value()._sent);
+	_requests.erase(it);
+
+}
+
+void EmpowerControllerEmulator::push(int, Packet *p) {
+
+	// a stream socket may split or merge messages
+	const uint8_t *data = p->data();
+	uint32_t len = p->length();
+
+	if (_partial.length()) {
+		_partial += String((const char *) data, len);
+		data = (const uint8_t *) _partial.data();
+		len = _partial.length();
+	}
+
+	uint32_t offset = 0;
+
+	while (len - offset >= sizeof(empower_header)) {
+		struct empower_header *h = (struct empower_header *) (data + offset);
+		uint32_t msg_len = h->length();
+		if (msg_len < sizeof(empower_header)) {
+			click_chatter("%{element} :: %s :: invalid message length %u, dropping %u bytes",
+						  this,
+						  __func__,
+						  msg_len,
+						  len - offset);
+			offset = len;
+			break;
+		}
+		if (msg_len > len - offset) {
+			break;
+		}
+		handle_message(data + offset, msg_len);
+		offset += msg_len;
+	}
+
+	if (offset < len) {
+		_partial = String((const char *) data + offset, len - offset);
+	} else {
+		_partial = String();
+	}
+
+	p->kill();
+
+}
+
+uint32_t EmpowerControllerEmulator::pending(int type) const {
+	if (type == T_SET_SLICE) {
+		uint32_t n = 0;
+		for (int i = 0; i < _slice_requests.size(); i++) {
+			if (_slice_requests[i]) {
+				n++;
+			}
+		}
+		return n;
+	}
+	if (type == T_UCQM) {
+		return _ucqm_requests.size();
+	}
+	uint32_t n = 0;
+	for (EmulatorRequests::const_iterator it = _requests.begin(); it != _requests.end(); it++) {
+		if (it.value()._type == type) {
+			n++;
+		}
+	}
+	return n;
+}
+
+void EmpowerControllerEmulator::reset() {
+	for (int t = 0; t < T_MAX; t++) {
+		_latency[t].clear();
+		_credits[t] = 0;
+	}
+	_requests.clear();
+	_reset_id = _next_id;
+	for (int i = 0; i < _slice_requests.size(); i++) {
+		_slice_requests[i] = Timestamp();
+	}
+	_ucqm_dropped += _ucqm_requests.size();
+	_ucqm_requests.clear();
+	_ucqm_responses = 0;
+	_ucqm_full = 0;
+	_ucqm_entries = 0;
+	_ucqm_bytes = 0;
+	_generated = 0;
+	_unexpected = 0;
+}
+
+enum {
+	H_LATENCY,
+	H_LVAPS,
+	H_ADD_RATE,
+	H_DEL_RATE,
+	H_SLICE_RATE,
+	H_COUNTERS_RATE,
+	H_UCQM_RATE,
+	H_CQM,
+	H_DELTA,
+	H_ACTIVE,
+	H_RESET,
+	H_DEBUG
+};
+
+String EmpowerControllerEmulator::read_handler(Element *e, void *thunk) {
+	EmpowerControllerEmulator *td = (EmpowerControllerEmulator *) e;
+	switch ((uintptr_t) thunk) {
+	case H_LATENCY: {
+		StringAccum sa;
+		for (int t = 0; t < T_MAX; t++) {
+			sa << message_names[t] << " " << td->_latency[t].unparse(td->pending(t)) << "\n";
+		}
+		sa << "unexpected " << td->_unexpected << "\n";
+		return sa.take_string();
+	}
+	case H_LVAPS:
+		return String(td->_added.size()) + "\n";
+	case H_CQM: {
+		StringAccum sa;
+		sa << "responses " << td->_ucqm_responses << " full " << td->_ucqm_full
+		   << " entries " << td->_ucqm_entries << " bytes " << td->_ucqm_bytes
+		   << " neighbors " << td->_ucqm_map.size() << "\n";
+		return sa.take_string();
+	}
+	case H_ADD_RATE:
+	case H_DEL_RATE:
+	case H_SLICE_RATE:
+	case H_COUNTERS_RATE:
+	case H_UCQM_RATE:
+		return String(td->_rates[(uintptr_t) thunk - H_ADD_RATE]) + "\n";
+	case H_DELTA:
+		return String(td->_delta) + "\n";
+	case H_ACTIVE:
+		return String(td->_active) + "\n";
+	case H_DEBUG:
+		return String(td->_debug) + "\n";
+	default:
+		return String();
+	}
+}
+
+int EmpowerControllerEmulator::write_handler(const String &in_s, Element *e, void *vparam, ErrorHandler *errh) {
+
+	EmpowerControllerEmulator *f = (EmpowerControllerEmulator *) e;
+	String s = cp_uncomment(in_s);
+
+	switch ((intptr_t) vparam) {
+	case H_ADD_RATE:
+	case H_DEL_RATE:
+	case H_SLICE_RATE:
+	case H_COUNTERS_RATE:
+	case H_UCQM_RATE: {
+		uint32_t rate;
+		if (!IntArg().parse(s, rate))
+			return errh->error("rate parameter must be unsigned");
+		f->_rates[(intptr_t) vparam - H_ADD_RATE] = rate;
+		break;
+	}
+	case H_DELTA: {
+		bool delta;
+		if (!BoolArg().parse(s, delta))
+			return errh->error("delta parameter must be boolean");
+		f->_delta = delta;
+		break;
+	}
+	case H_ACTIVE: {
+		bool active;
+		if (!BoolArg().parse(s, active))
+			return errh->error("active parameter must be boolean");
+		f->_active = active;
+		break;
+	}
+	case H_RESET: {
+		f->reset();
+		break;
+	}
+	case H_DEBUG: {
+		bool debug;
+		if (!BoolArg().parse(s, debug))
+			return errh->error("debug parameter must be boolean");
+		f->_debug = debug;
+		break;
+	}
+	}
+
+	return 0;
+
+}
+
+void EmpowerControllerEmulator::add_handlers() {
+	add_read_handler("latency", read_handler, (void *) H_LATENCY);
+	add_read_handler("lvaps", read_handler, (void *) H_LVAPS);
+	add_read_handler("add_rate", read_handler, (void *) H_ADD_RATE);
+	add_read_handler("del_rate", read_handler, (void *) H_DEL_RATE);
+	add_read_handler("slice_rate", read_handler, (void *) H_SLICE_RATE);
+	add_read_handler("counters_rate", read_handler, (void *) H_COUNTERS_RATE);
+	add_read_handler("ucqm_rate", read_handler, (void *) H_UCQM_RATE);
+	add_read_handler("cqm", read_handler, (void *) H_CQM);
+	add_read_handler("delta", read_handler, (void *) H_DELTA);
+	add_read_handler("active", read_handler, (void *) H_ACTIVE);
+	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_write_handler("add_rate", write_handler, (void *) H_ADD_RATE);
+	add_write_handler("del_rate", write_handler, (void *) H_DEL_RATE);
+	add_write_handler("slice_rate", write_handler, (void *) H_SLICE_RATE);
+	add_write_handler("counters_rate", write_handler, (void *) H_COUNTERS_RATE);
+	add_write_handler("ucqm_rate", write_handler, (void *) H_UCQM_RATE);
+	add_write_handler("delta", write_handler, (void *) H_DELTA);
+	add_write_handler("active", write_handler, (void *) H_ACTIVE);
+	add_write_handler("reset", write_handler, (void *) H_RESET);
+	add_write_handler("debug", write_handler, (void *) H_DEBUG);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerControllerEmulator)
+ELEMENT_REQUIRES(userlevel)
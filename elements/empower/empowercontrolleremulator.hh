@@ -0,0 +1,248 @@
+#ifndef CLICK_EMPOWERCONTROLLEREMULATOR_HH
+#define CLICK_EMPOWERCONTROLLEREMULATOR_HH
+#include <click/element.hh>
+#include <click/config.h>
+#include <click/etheraddress.hh>
+#include <click/hashtable.hh>
+#include <click/deque.hh>
+#include <click/timer.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerControllerEmulator(HWADDR, CHANNEL, BAND[, I<KEYWORDS>])
+
+=s EmPOWER
+
+Stand-in EmPOWER controller generating control plane load
+
+=d
+
+Generates ADD_LVAP, DEL_LVAP, SET_SLICE, COUNTERS_REQUEST and UCQM_REQUEST
+messages at configurable rates on its output and measures how long the agent takes to
+answer each of them. Its input and output are connected to an
+EmpowerLVAPManager, either directly or through the Socket elements of a
+controller connection, in which case the input may carry partial or
+multiple messages.
+
+LVAPs are added round-robin from a pool of stations, the oldest LVAP is
+removed first and counters are requested for the added LVAPs in turn.
+ADD_LVAP and DEL_LVAP are answered by the matching LVAP response,
+COUNTERS_REQUEST by the counters response with the same id and
+UCQM_REQUEST, always for the same graph, by the next UCQM response. SET_SLICE has
+no response, so each one is followed by a slice status request and is
+answered by the status of its slice. A SET_SLICE superseded by a newer
+one for the same slice before the status arrives is never answered.
+
+Rates can be changed at runtime, so a Script can replay a sequence of
+storms, for example a number of handovers per second given by equal ADD
+and DEL rates.
+
+Keyword arguments are:
+
+=over 8
+
+=item HWADDR, CHANNEL, BAND
+The resource element the LVAPs and the slices are created on, BAND is
+either L20 or HT20.
+
+=item STA
+Address of the first station of the pool. Default is 02:00:00:00:00:00.
+
+=item LVAPS
+Number of stations in the pool. Default is 256.
+
+=item BSSID, SSID
+Network of the LVAPs. Default is 02:CA:FE:00:00:00 and "empower".
+
+=item SLICES
+Number of DSCP values SET_SLICE cycles through. Default is 8.
+
+=item ADD_RATE, DEL_RATE, SLICE_RATE, COUNTERS_RATE, UCQM_RATE
+Messages per second of each type. Default is 0.
+
+=item GRAPH_ID
+Graph id of the UCQM requests. Default is 1.
+
+=item DELTA
+Boolean. Whether UCQM_DELTA_REQUEST is sent instead of UCQM_REQUEST.
+Default is false.
+
+=item LIMIT
+Stop generating after this many messages in total, 0 means no limit.
+Default is 0.
+
+=item ACTIVE
+Boolean. Whether messages are generated. Default is true.
+
+=item DEBUG
+Turn debug on/off
+
+=back 8
+
+=h latency read-only
+For every message type, the number of messages sent and answered, the
+number of messages still pending and the 50th, 90th and 99th percentile
+and maximum response latency in microseconds.
+
+=h lvaps read-only
+Number of LVAPs currently added.
+
+=h cqm read-only
+Number of UCQM responses received and of those carrying every neighbor, of
+entries they carried, their size in bytes and the number of neighbors in
+the channel quality map rebuilt from them.
+
+=h add_rate, del_rate, slice_rate, counters_rate, ucqm_rate read/write
+Message rates.
+
+=h delta read/write
+Whether delta UCQM requests are sent.
+
+=h active read/write
+Whether messages are generated.
+
+=h reset write-only
+Clears the latency samples and the pending messages.
+
+=a EmpowerLVAPManager, Socket
+*/
+
+// Response latencies of one message type
+class EmulatorLatency {
+public:
+
+	enum { MAX_SAMPLES = 1 << 20 };
+
+	uint32_t _sent;
+	uint32_t _answered;
+	uint32_t _dropped_samples;
+	Vector<uint32_t> _samples;
+
+	EmulatorLatency() : _sent(0), _answered(0), _dropped_samples(0) {
+	}
+
+	void add_sample(uint32_t usec) {
+		_answered++;
+		if (_samples.size() < MAX_SAMPLES) {
+			_samples.push_back(usec);
+		} else {
+			_dropped_samples++;
+		}
+	}
+
+	void clear() {
+		_sent = 0;
+		_answered = 0;
+		_dropped_samples = 0;
+		_samples.clear();
+	}
+
+	String unparse(uint32_t pending) const;
+
+};
+
+class EmulatorRequest {
+public:
+	int _type;
+	Timestamp _sent;
+	EmulatorRequest() : _type(-1) {
+	}
+	EmulatorRequest(int type) : _type(type), _sent(Timestamp::now_steady()) {
+	}
+};
+
+typedef HashTable<uint32_t, EmulatorRequest> EmulatorRequests;
+typedef EmulatorRequests::iterator ERIter;
+
+class EmpowerControllerEmulator: public Element {
+public:
+
+	EmpowerControllerEmulator();
+	~EmpowerControllerEmulator();
+
+	const char *class_name() const { return "EmpowerControllerEmulator"; }
+	const char *port_count() const { return PORTS_1_1; }
+	const char *processing() const { return PUSH; }
+
+	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+	void run_timer(Timer *);
+
+	void push(int, Packet *);
+
+	void add_handlers();
+
+private:
+
+	enum { T_ADD_LVAP, T_DEL_LVAP, T_SET_SLICE, T_COUNTERS, T_UCQM, T_MAX };
+	enum { TICK_MSEC = 1 };
+
+	EtherAddress _hwaddr;
+	uint8_t _channel;
+	uint8_t _band;
+	EtherAddress _sta;
+	uint32_t _nb_lvaps;
+	EtherAddress _bssid;
+	String _ssid;
+	uint32_t _nb_slices;
+	uint32_t _graph_id;
+	bool _delta;
+	uint32_t _rates[T_MAX];
+	uint32_t _limit;
+	bool _active;
+	bool _debug;
+
+	Timer _timer;
+	Timestamp _last_tick;
+	uint64_t _credits[T_MAX];
+
+	uint32_t _seq;
+	uint32_t _next_id;
+	uint32_t _reset_id;
+	uint32_t _generated;
+
+	// stations in the pool, those with an LVAP in order of addition
+	uint32_t _next_sta;
+	Deque<EtherAddress> _added;
+	HashTable<EtherAddress, bool> _is_added;
+	int _next_counters;
+	uint32_t _next_slice;
+
+	EmulatorRequests _requests;
+	Vector<Timestamp> _slice_requests;
+	EmulatorLatency _latency[T_MAX];
+
+	// UCQM responses only carry the graph id, they are answered in order
+	Deque<Timestamp> _ucqm_requests;
+	uint32_t _ucqm_dropped;
+	uint32_t _ucqm_responses;
+	uint32_t _ucqm_full;
+	uint32_t _ucqm_entries;
+	uint64_t _ucqm_bytes;
+	HashTable<EtherAddress, bool> _ucqm_map;
+
+	String _partial;
+	uint32_t _unexpected;
+
+	bool send_add_lvap();
+	bool send_del_lvap();
+	bool send_set_slice();
+	bool send_counters_request();
+	bool send_ucqm_request();
+	void send(WritablePacket *);
+	void handle_message(const uint8_t *, uint32_t);
+	void handle_ucqm_response(const uint8_t *, const uint8_t *, uint32_t, uint32_t, bool);
+	void answered(int, const Timestamp &);
+	uint32_t pending(int) const;
+	void reset();
+
+	static int write_handler(const String &, Element *, void *, ErrorHandler *);
+	static String read_handler(Element *, void *);
+
+};
+
+CLICK_ENDDECLS
+#endif
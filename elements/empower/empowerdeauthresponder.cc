@@ -86,7 +86,7 @@ void EmpowerDeAuthResponder::push(int, Packet *p) {
 
 	EtherAddress src = EtherAddress(w->i_addr2);
 
-    EmpowerStationState *ess = _el->get_ess(src);
+    const EmpowerStationState *ess = _el->get_ess(src);
 
     //If we're not aware of this LVAP, ignore
 	if (!ess) {
@@ -152,10 +152,7 @@ void EmpowerDeAuthResponder::push(int, Packet *p) {
 				      reason);
 	}
 
-	ess->_association_status = false;
-	ess->_authentication_status = false;
-	ess->_ssid = "";
-	ess->_bssid = EtherAddress();
+	_el->deauthenticate_lvap(src);
 
 	_el->send_status_lvap(src);
 
@@ -165,7 +162,7 @@ void EmpowerDeAuthResponder::push(int, Packet *p) {
 
 void EmpowerDeAuthResponder::send_deauth_request(EtherAddress dst, uint16_t reason, int iface_id)
 {
-	EmpowerStationState *ess = _el->get_ess(dst);
+	const EmpowerStationState *ess = _el->get_ess(dst);
 
 	if (_debug) {
 		click_chatter("%{element} :: %s :: sending deauthentication request to %s",
@@ -81,7 +81,7 @@ void EmpowerDisassocResponder::push(int, Packet *p) {
 	}
 
 	EtherAddress src = EtherAddress(w->i_addr2);
-	EmpowerStationState *ess = _el->get_ess(src);
+	const EmpowerStationState *ess = _el->get_ess(src);
 
     //If we're not aware of this LVAP, ignore
 	if (!ess) {
@@ -141,8 +141,7 @@ void EmpowerDisassocResponder::push(int, Packet *p) {
 					  bssid.unparse().c_str());
 	}
 
-	ess->_association_status = false;
-	ess->_ssid = "";
+	_el->disassociate_lvap(src);
 
 	_el->send_status_lvap(src);
 
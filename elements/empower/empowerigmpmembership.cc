@@ -73,7 +73,7 @@ void EmpowerIgmpMembership::push(int, Packet *p) {
 	EtherAddress src = EtherAddress(eh->ether_shost);
 	Vector<IPAddress> mcast_addresses;
 	Vector<enum empower_igmp_record_type> igmp_types;
-	EmpowerStationState *ess = _el->get_ess(src);
+	const EmpowerStationState *ess = _el->get_ess(src);
 
 	if (!ess) {
 		click_chatter("%{element} :: %s :: Unknown station %s",
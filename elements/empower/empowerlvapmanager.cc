@@ -22,6 +22,8 @@
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
 #include <clicknet/ether.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <elements/standard/counter.hh>
 #include <elements/wifi/minstrel.hh>
 #include <elements/wifi/transmissionpolicy.hh>
@@ -37,22 +39,68 @@
 CLICK_DECLS
 
 EmpowerLVAPManager::EmpowerLVAPManager() :
-		_e11k(0), _ebs(0), _eauthr(0), _eassor(0), _edeauthr(0), _ers(0),
-		_mtbl(0), _timer(this), _seq(0), _period(5000), _debug(false) {
+		_stations(&_reclaimer), _elements_to_ifaces(-1), _e11k(0), _ebs(0),
+		_eauthr(0), _eassor(0), _edeauthr(0), _ers(0), _mtbl(0), _timer(this), _seq(0), _period(5000),
+		_debug(false), _flush_timer(this), _pending(0), _pending_messages(0),
+		_coalesce_size(1460), _flush_deadline(1000), _sent_messages(0),
+		_sent_packets(0), _cqm_rssi_delta(0), _cqm_packets_delta(0),
+		_cqm_refresh(10), _cqm_responses(0), _cqm_entries(0),
+		_cqm_suppressed(0), _cqm_bytes(0) {
 }
 
 EmpowerLVAPManager::~EmpowerLVAPManager() {
+	// the live records are only referenced by the station indexes
+	for (LVAPIndexIter it = _stations._lvaps.begin(); it.live(); it++) {
+		delete it.value();
+	}
+	for (VAPIndexIter it = _stations._vaps.begin(); it.live(); it++) {
+		delete it.value();
+	}
 }
 //edit by LL as test
 
 int EmpowerLVAPManager::initialize(ErrorHandler *) {
+	_reclaimer.initialize(this);
 	_timer.initialize(this);
 	_timer.schedule_now();
-	compute_bssid_mask();
+	_flush_timer.initialize(this);
+	for (int i = 0; i < _masks.size(); i++) {
+		_bssid_masks.push_back(BssidMask(_ifaces[i]._element._hwaddr));
+		_debugfs_fds.push_back(open(_debugfs_strings[i].c_str(), O_WRONLY));
+		_mask_writes.push_back(0);
+		_mask_skipped.push_back(0);
+		if (_debugfs_fds[i] < 0) {
+			click_chatter("%{element} :: %s :: unable to open debugfs file %s",
+						  this,
+						  __func__,
+						  _debugfs_strings[i].c_str());
+		}
+		write_bssid_mask(i, true);
+	}
 	return 0;
 }
 
-void EmpowerLVAPManager::run_timer(Timer *) {
+void EmpowerLVAPManager::cleanup(CleanupStage) {
+	if (_pending) {
+		_pending->kill();
+		_pending = 0;
+	}
+	for (int i = 0; i < _debugfs_fds.size(); i++) {
+		if (_debugfs_fds[i] >= 0) {
+			close(_debugfs_fds[i]);
+		}
+	}
+	_debugfs_fds.clear();
+}
+
+void EmpowerLVAPManager::run_timer(Timer *timer) {
+	// flush deadline expired
+	if (timer == &_flush_timer) {
+		flush_messages();
+		return;
+	}
+	// forget the graphs the controller stopped polling
+	reclaim_cqm_images();
 	// send hello packet
 	send_hello();
 	// re-schedule the timer with some jitter
@@ -98,9 +146,18 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 			                    .read_m("ERS", ElementCastArg("EmpowerRXStats"), _ers)
 								.read("MTBL", ElementCastArg("EmpowerMulticastTable"), _mtbl)
 								.read("PERIOD", _period)
+								.read("COALESCE_SIZE", _coalesce_size)
+								.read("FLUSH_DEADLINE", _flush_deadline)
+								.read("CQM_RSSI_DELTA", _cqm_rssi_delta)
+								.read("CQM_PACKETS_DELTA", _cqm_packets_delta)
+								.read("CQM_REFRESH", _cqm_refresh)
 			                    .read("DEBUG", _debug)
 			                    .complete();
 
+	if (_cqm_rssi_delta < 0 || _cqm_packets_delta < 0) {
+		return errh->error("CQM_RSSI_DELTA and CQM_PACKETS_DELTA must be positive");
+	}
+
 	for (int i = 0; i < dpid_string.length(); i += 2) {
 	    String chunk = dpid_string.substring(i, 2);
 	    _dpid[i / 2] = (uint8_t) strtoul(chunk.c_str(), NULL, 16);
@@ -112,24 +169,28 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 		_masks.push_back(EtherAddress::make_broadcast());
 	}
 
+	_ifaces.resize(_masks.size());
+
 	Vector<String> tokens;
 	cp_spacevec(rcs_strings, tokens);
 
+	if (tokens.size() != _masks.size()) {
+		return errh->error("rcs has %u values, while masks has %u values", tokens.size(), _masks.size());
+	}
+
 	for (int i = 0; i < tokens.size(); i++) {
-		Minstrel * rc;
-		if (!ElementCastArg("Minstrel").parse(tokens[i], rc, Args(conf, this, errh))) {
+		if (!ElementCastArg("Minstrel").parse(tokens[i], _ifaces[i]._rc, Args(conf, this, errh))) {
 			return errh->error("error param %s: must be a Minstrel element", tokens[i].c_str());
 		}
-		_rcs.push_back(rc);
-	}
-
-	if (_rcs.size() != _masks.size()) {
-		return errh->error("rcs has %u values, while masks has %u values", _rcs.size(), _masks.size());
 	}
 
 	tokens.clear();
 	cp_spacevec(res_strings, tokens);
 
+	if (tokens.size() != _masks.size()) {
+		return errh->error("res has %u values, while masks has %u values", tokens.size(), _masks.size());
+	}
+
 	for (int x = 0; x < tokens.size(); x++) {
 
 		Vector<String> tokens_re;
@@ -155,38 +216,41 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 			band = EMPOWER_BT_HT20;
 		}
 
-		ResourceElement *elm = new ResourceElement(hwaddr, channel, band);
-		_ifaces_to_elements.set(x, elm);
+		ResourceElement elm(hwaddr, channel, band);
+
+		if (_elements_to_ifaces.get(elm) != -1) {
+			return errh->error("error param %s: duplicate resource element", tokens[x].c_str());
+		}
+
+		_ifaces[x]._element = elm;
+		_elements_to_ifaces.set(elm, x);
 
 	}
 
 	tokens.clear();
 	cp_spacevec(eqms_strings, tokens);
 
+	if (tokens.size() != _masks.size()) {
+		return errh->error("eqms has %u values, while masks has %u values", tokens.size(), _masks.size());
+	}
+
 	for (int i = 0; i < tokens.size(); i++) {
-		EmpowerQOSManager * eqm;
-		if (!ElementCastArg("EmpowerQOSManager").parse(tokens[i], eqm, Args(conf, this, errh))) {
+		if (!ElementCastArg("EmpowerQOSManager").parse(tokens[i], _ifaces[i]._eqm, Args(conf, this, errh))) {
 			return errh->error("error param %s: must be an EmpowerQOSManager element", tokens[i].c_str());
 		}
-		_eqms.push_back(eqm);
-	}
-
-	if (_eqms.size() != _masks.size()) {
-		return errh->error("eqms has %u values, while masks has %u values", _eqms.size(), _masks.size());
 	}
 
 	tokens.clear();
 	cp_spacevec(regmon_strings, tokens);
+
+	if (tokens.size() != _masks.size()) {
+		return errh->error("regmons has %u values, while masks has %u values", tokens.size(), _masks.size());
+	}
+
 	for (int i = 0; i < tokens.size(); i++) {
-		EmpowerRegmon *regmon;
-		if (!ElementCastArg("EmpowerRegmon").parse(tokens[i], regmon, Args(conf, this, errh))) {
+		if (!ElementCastArg("EmpowerRegmon").parse(tokens[i], _ifaces[i]._regmon, Args(conf, this, errh))) {
 			return errh->error("error param %s: must be a EmpowerRegmon element", tokens[i].c_str());
 		}
-		_regmons.push_back(regmon);
-	}
-
-	if (_regmons.size() != _masks.size()) {
-		return errh->error("regmons has %u values, while masks has %u values", _regmons.size(), _masks.size());
 	}
 
 	return res;
@@ -320,7 +384,76 @@ void EmpowerLVAPManager::send_message(Packet *p) {
 		p->kill();
 		return;
 	}
-	output(0).push(p);
+
+	// messages are self-delimited, pack them back to back in one packet
+	// so that the socket sees one write instead of many small ones. The
+	// lock is held while pushing, so that messages reach the socket in the
+	// order they were sent whatever thread sends them. It is recursive, in
+	// case the socket side sends a message back from its push.
+	_send_lock.acquire();
+
+	if (p->length() >= _coalesce_size) {
+		push_pending();
+		_sent_messages++;
+		_sent_packets++;
+		output(0).push(p);
+		_send_lock.release();
+		return;
+	}
+
+	if (_pending && _pending->length() + p->length() > _coalesce_size) {
+		push_pending();
+	}
+
+	if (!_pending) {
+		_pending = Packet::make(Packet::default_headroom, 0, 0, _coalesce_size);
+	}
+
+	if (!_pending) {
+		_sent_messages++;
+		_sent_packets++;
+		output(0).push(p);
+		_send_lock.release();
+		return;
+	}
+
+	// the tailroom was reserved up front, put() does not reallocate
+	uint32_t offset = _pending->length();
+	_pending = _pending->put(p->length());
+	memcpy(_pending->data() + offset, p->data(), p->length());
+	bool schedule = (_pending_messages++ == 0);
+	_sent_messages++;
+
+	_send_lock.release();
+
+	p->kill();
+
+	if (schedule) {
+		_flush_timer.schedule_after(Timestamp::make_usec(_flush_deadline));
+	}
+
+}
+
+// called with the send lock held
+void EmpowerLVAPManager::push_pending() {
+	Packet *p = _pending;
+	if (p) {
+		_pending = 0;
+		_pending_messages = 0;
+		_sent_packets++;
+		output(0).push(p);
+	}
+}
+
+void EmpowerLVAPManager::flush_messages() {
+
+	// a message queued after this point schedules the timer again
+	_flush_timer.unschedule();
+
+	_send_lock.acquire();
+	push_pending();
+	_send_lock.release();
+
 }
 
 void EmpowerLVAPManager::send_hello() {
@@ -352,7 +485,7 @@ void EmpowerLVAPManager::send_hello() {
 void EmpowerLVAPManager::send_status_slice(String ssid, int dscp, int iface_id) {
 
 	Slice slice = Slice(ssid, dscp);
-	SliceQueue * queue = _eqms[iface_id]->slices()->find(slice).value();
+	SliceQueue * queue = _ifaces[iface_id]._eqm->slices()->find(slice).value();
 
 	int len = sizeof(empower_status_slice) + ssid.length();
     ResourceElement* re = iface_to_element(iface_id);
@@ -402,9 +535,8 @@ int EmpowerLVAPManager::handle_slice_queue_counters_request(Packet *p, uint32_t
 
 int EmpowerLVAPManager::handle_slice_status_request(Packet *, uint32_t) {
 
-	for (REIter it_re = _ifaces_to_elements.begin(); it_re.live(); it_re++) {
-		int iface_id = it_re.key();
-		for (SIter it = _eqms[iface_id]->slices()->begin(); it.live(); it++) {
+	for (int iface_id = 0; iface_id < _ifaces.size(); iface_id++) {
+		for (SIter it = _ifaces[iface_id]._eqm->slices()->begin(); it.live(); it++) {
 			send_status_slice(it.key()._ssid, it.key()._dscp, iface_id);
 		}
 	}
@@ -415,10 +547,10 @@ int EmpowerLVAPManager::handle_slice_status_request(Packet *, uint32_t) {
 
 int EmpowerLVAPManager::handle_port_status_request(Packet *, uint32_t) {
 
-	for (REIter it_re = _ifaces_to_elements.begin(); it_re.live(); it_re++) {
-		int iface_id = it_re.key();
-		for (TxTableIter it = _rcs[iface_id]->tx_policies()->tx_table()->begin(); it.live(); it++) {
-			send_status_port(it.key(), iface_id);
+	for (int iface_id = 0; iface_id < _ifaces.size(); iface_id++) {
+		Vector<EtherAddress> stations = _ifaces[iface_id]._rc->tx_policies()->stations();
+		for (int i = 0; i < stations.size(); i++) {
+			send_status_port(stations[i], iface_id);
 		}
 	}
 
@@ -441,7 +573,7 @@ void EmpowerLVAPManager::send_slice_queue_counters_response(uint32_t counters_id
     }
 
 	Slice slice = Slice(ssid, dscp);
-	SliceQueue * queue = _eqms[iface_id]->slices()->get(slice);
+	SliceQueue * queue = _ifaces[iface_id]._eqm->slices()->get(slice);
 
 	if (!queue) {
 		return;
@@ -478,7 +610,7 @@ void EmpowerLVAPManager::send_slice_queue_counters_response(uint32_t counters_id
 
 void EmpowerLVAPManager::send_status_lvap(EtherAddress sta) {
 
-	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	const EmpowerStationState *ess = get_ess(sta);
 
 	if (!ess) {
 		click_chatter("%{element} :: %s :: unable to find lvap %s",
@@ -544,7 +676,7 @@ void EmpowerLVAPManager::send_status_vap(EtherAddress bssid) {
 
 	Vector<String> ssids;
 
-	EmpowerVAPState *evs = _vaps.get_pointer(bssid);
+	const EmpowerVAPState *evs = get_vap(bssid);
 
 	if (!evs) {
 		click_chatter("%{element} :: %s :: unable to find vap %s",
@@ -585,7 +717,15 @@ void EmpowerLVAPManager::send_status_vap(EtherAddress bssid) {
 
 void EmpowerLVAPManager::send_status_port(EtherAddress sta, int iface) {
 
-	TxPolicyInfo * tx_policy = _rcs[iface]->tx_policies()->tx_table()->find(sta);
+	TxPolicyInfo * tx_policy = _ifaces[iface]._rc->tx_policies()->supported(sta);
+
+	if (!tx_policy) {
+		click_chatter("%{element} :: %s :: unable to find TXP for station %s!",
+					  this,
+					  __func__,
+					  sta.unparse().c_str());
+		return;
+	}
 
 	int len = sizeof(empower_status_port) + tx_policy->_mcs.size() + tx_policy->_ht_mcs.size();
 
@@ -640,7 +780,7 @@ void EmpowerLVAPManager::send_status_port(EtherAddress sta, int iface) {
 }
 
 void EmpowerLVAPManager::send_img_response(int type, uint32_t graph_id,
-		EtherAddress hwaddr, uint8_t channel, empower_bands_types band) {
+		EtherAddress hwaddr, uint8_t channel, empower_bands_types band, bool delta) {
 
 	int iface_id = element_to_iface(hwaddr, channel, band);
 
@@ -654,71 +794,123 @@ void EmpowerLVAPManager::send_img_response(int type, uint32_t graph_id,
 		return;
 	}
 
-	// Select stations active on the specified resource element (iface_id)
+	// In a delta response only the neighbors whose statistics moved past
+	// the thresholds since they were last sent for this graph are included,
+	// except in every _cqm_refresh-th response. The image starts empty, so
+	// such a response carries every neighbor and is flagged as full.
 
-	Vector<DstInfo> neighbors;
-	_ers->lock.acquire_read();
+	CQMImage *image = 0;
+	bool track = delta && (_cqm_rssi_delta > 0 || _cqm_packets_delta > 0);
+	bool full = true;
 
-	if (type == EMPOWER_PT_UCQM_RESPONSE) {
-		for (NTIter iter = _ers->stas.begin(); iter.live(); iter++) {
-			if (iter.value()._iface_id != iface_id) {
-				continue;
-			}
-			neighbors.push_back(iter.value());
+	if (track) {
+		image = _cqm_images.get_pointer(graph_id);
+		if (!image || image->_type != type || image->_iface_id != iface_id) {
+			_cqm_images.set(graph_id, CQMImage(type, iface_id));
+			image = _cqm_images.get_pointer(graph_id);
 		}
-	} else {
-		for (NTIter iter = _ers->aps.begin(); iter.live(); iter++) {
-			if (iter.value()._iface_id != iface_id) {
-				continue;
-			}
-			neighbors.push_back(iter.value());
+		if (_cqm_refresh && image->_responses % _cqm_refresh == 0) {
+			image->_samples.clear();
 		}
+		full = !image->_samples.size();
+		image->_responses++;
+		image->_last_request = Timestamp::now_steady();
 	}
 
-	_ers->lock.release_read();
+	int header = delta ? sizeof(empower_cqm_delta_response) : sizeof(empower_cqm_response);
+
+	// Serialize the stations active on the specified resource element
+	// (iface_id) straight from the neighbor table
 
-	int len = sizeof(empower_cqm_response) + neighbors.size() * sizeof(cqm_entry);
+	NeighborTable &table = (type == EMPOWER_PT_UCQM_RESPONSE) ? _ers->stas : _ers->aps;
+
+	_ers->lock.acquire_read();
+
+	int len = header + table.size() * sizeof(cqm_entry);
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
+		_ers->lock.release_read();
 		click_chatter("%{element} :: %s :: cannot make packet!",
 					  this,
 					  __func__);
 		return;
 	}
 
-	memset(p->data(), 0, p->length());
-
-	empower_cqm_response *imgs = (struct empower_cqm_response *) (p->data());
-	imgs->set_version(_empower_version);
-	imgs->set_length(len);
-	imgs->set_type(type);
-	imgs->set_seq(get_next_seq());
-	imgs->set_graph_id(graph_id);
-	imgs->set_wtp(_wtp);
-	imgs->set_nb_entries(neighbors.size());
-
-	uint8_t *ptr = (uint8_t *) imgs;
-	ptr += sizeof(struct empower_cqm_response);
+	uint8_t *ptr = p->data() + header;
+	uint8_t *end = p->end_data();
+	int nb_entries = 0;
 
-	uint8_t *end = ptr + (len - sizeof(struct empower_cqm_response));
-
-	for (int i = 0; i < neighbors.size(); i++) {
-		assert (ptr <= end);
+	for (NTIter iter = table.begin(); iter.live(); iter++) {
+		const DstInfo &nfo = iter.value();
+		if (nfo._iface_id != iface_id) {
+			continue;
+		}
+		if (track && !image->update(nfo, _cqm_rssi_delta, _cqm_packets_delta)) {
+			_cqm_suppressed++;
+			continue;
+		}
+		assert (ptr < end);
 		cqm_entry *entry = (cqm_entry *) ptr;
-		entry->set_sta(neighbors[i]._eth);
-		entry->set_last_rssi_avg(neighbors[i]._last_rssi);
-		entry->set_last_rssi_std(neighbors[i]._last_std);
-		entry->set_last_packets(neighbors[i]._last_packets);
-		entry->set_hist_packets(neighbors[i]._hist_packets);
-		entry->set_mov_rssi(neighbors[i]._sma_rssi->avg());
+		entry->set_sta(nfo._eth);
+		entry->set_last_rssi_avg(nfo.last_rssi());
+		entry->set_last_rssi_std(nfo.last_std());
+		entry->set_last_packets(nfo.last_packets());
+		entry->set_hist_packets(nfo.hist_packets());
+		entry->set_mov_rssi(nfo.sma_rssi());
 		ptr += sizeof(struct cqm_entry);
+		nb_entries++;
+	}
+
+	_ers->lock.release_read();
+
+	p->take(end - ptr);
+	len = p->length();
+
+	memset(p->data(), 0, header);
+
+	if (delta) {
+		empower_cqm_delta_response *imgs = (struct empower_cqm_delta_response *) (p->data());
+		imgs->set_version(_empower_version);
+		imgs->set_length(len);
+		imgs->set_type(type == EMPOWER_PT_UCQM_RESPONSE ? EMPOWER_PT_UCQM_DELTA_RESPONSE : EMPOWER_PT_NCQM_DELTA_RESPONSE);
+		imgs->set_seq(get_next_seq());
+		imgs->set_graph_id(graph_id);
+		imgs->set_wtp(_wtp);
+		imgs->set_nb_entries(nb_entries);
+		if (full) {
+			imgs->set_flag(EMPOWER_CQM_FULL);
+		}
+	} else {
+		empower_cqm_response *imgs = (struct empower_cqm_response *) (p->data());
+		imgs->set_version(_empower_version);
+		imgs->set_length(len);
+		imgs->set_type(type);
+		imgs->set_seq(get_next_seq());
+		imgs->set_graph_id(graph_id);
+		imgs->set_wtp(_wtp);
+		imgs->set_nb_entries(nb_entries);
 	}
 
+	_cqm_responses++;
+	_cqm_entries += nb_entries;
+	_cqm_bytes += len;
+
 	send_message(p);
 
 }
 
+void EmpowerLVAPManager::reclaim_cqm_images() {
+	Timestamp now = Timestamp::now_steady();
+	for (CQMIter it = _cqm_images.begin(); it.live();) {
+		if ((now - it.value()._last_request).sec() >= CQM_IMAGE_TIMEOUT) {
+			it = _cqm_images.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
 void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherAddress hwaddr, uint8_t channel, empower_bands_types band) {
 
 	int iface_id = element_to_iface(hwaddr, channel, band);
@@ -733,7 +925,9 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 		return;
 	}
 
-	int len = sizeof(empower_wifi_stats_response) + sizeof(wifi_stats_entry) * _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3;
+	EmpowerRegmon *regmon = _ifaces[iface_id]._regmon;
+
+	int len = sizeof(empower_wifi_stats_response) + sizeof(wifi_stats_entry) * regmon->registers(EMPOWER_REGMON_TX)->_size * 3;
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -752,37 +946,37 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 	stats->set_seq(get_next_seq());
 	stats->set_wifi_stats_id(wifi_stats_id);
 	stats->set_wtp(_wtp);
-	stats->set_nb_entries(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3);
+	stats->set_nb_entries(regmon->registers(EMPOWER_REGMON_TX)->_size * 3);
 
 	uint8_t *ptr = (uint8_t *) stats;
 	ptr += sizeof(struct empower_wifi_stats_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_wifi_stats_response));
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size; i++) {
+	for (int i = 0; i < regmon->registers(EMPOWER_REGMON_TX)->_size; i++) {
 		assert (ptr <= end);
 		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_samples[i]);
+		entry->set_type(regmon->registers(EMPOWER_REGMON_TX)->_type);
+		entry->set_timestamp(regmon->registers(EMPOWER_REGMON_TX)->_timestamps[i]);
+		entry->set_sample(regmon->registers(EMPOWER_REGMON_TX)->_samples[i]);
 		ptr += sizeof(struct wifi_stats_entry);
 	}
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_size; i++) {
+	for (int i = 0; i < regmon->registers(EMPOWER_REGMON_RX)->_size; i++) {
 		assert (ptr <= end);
 		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_samples[i]);
+		entry->set_type(regmon->registers(EMPOWER_REGMON_RX)->_type);
+		entry->set_timestamp(regmon->registers(EMPOWER_REGMON_RX)->_timestamps[i]);
+		entry->set_sample(regmon->registers(EMPOWER_REGMON_RX)->_samples[i]);
 		ptr += sizeof(struct wifi_stats_entry);
 	}
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_size; i++) {
+	for (int i = 0; i < regmon->registers(EMPOWER_REGMON_ED)->_size; i++) {
 		assert (ptr <= end);
 		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_samples[i]);
+		entry->set_type(regmon->registers(EMPOWER_REGMON_ED)->_type);
+		entry->set_timestamp(regmon->registers(EMPOWER_REGMON_ED)->_timestamps[i]);
+		entry->set_sample(regmon->registers(EMPOWER_REGMON_ED)->_samples[i]);
 		ptr += sizeof(struct wifi_stats_entry);
 	}
 
@@ -792,8 +986,9 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 
 void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 
-	int len = sizeof(empower_summary_trigger) + summary->_frames.size() * sizeof(summary_entry);
-	WritablePacket *p = Packet::make(len);
+	// the entries are already in place, only the header is left
+	uint16_t nframes = 0;
+	WritablePacket *p = summary->swap(nframes);
 
 	if (!p) {
 		click_chatter("%{element} :: %s :: cannot make packet!",
@@ -802,38 +997,16 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 		return;
 	}
 
-	memset(p->data(), 0, p->length());
+	memset(p->data(), 0, sizeof(empower_summary_trigger));
 
 	empower_summary_trigger* request = (struct empower_summary_trigger *) (p->data());
 	request->set_version(_empower_version);
-	request->set_length(len);
+	request->set_length(p->length());
 	request->set_type(EMPOWER_PT_SUMMARY_TRIGGER);
 	request->set_seq(get_next_seq());
 	request->set_trigger_id(summary->_trigger_id);
 	request->set_wtp(_wtp);
-	request->set_nb_frames(summary->_frames.size());
-
-	uint8_t *ptr = (uint8_t *) request;
-	ptr += sizeof(struct empower_summary_trigger);
-	uint8_t *end = ptr + (len - sizeof(struct empower_summary_trigger));
-
-	for (int i = 0; i < summary->_frames.size(); i++) {
-		assert (ptr <= end);
-		summary_entry *entry = (summary_entry *) ptr;
-		entry->set_ra(summary->_frames[i]._ra);
-		entry->set_ta(summary->_frames[i]._ta);
-		entry->set_tsft(summary->_frames[i]._tsft);
-		entry->set_flags(summary->_frames[i]._flags);
-		entry->set_seq(summary->_frames[i]._seq);
-		entry->set_rssi(summary->_frames[i]._rssi);
-		entry->set_rate(summary->_frames[i]._rate);
-		entry->set_length(summary->_frames[i]._length);
-		entry->set_type(summary->_frames[i]._type);
-		entry->set_subtype(summary->_frames[i]._subtype);
-		ptr += sizeof(struct summary_entry);
-	}
-
-	summary->_frames.clear();
+	request->set_nb_frames(nframes);
 
 	send_message(p);
 
@@ -841,7 +1014,7 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 
 void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lvap_stats_id) {
 
-	EmpowerStationState *ess = _lvaps.get_pointer(lvap);
+	const EmpowerStationState *ess = get_ess(lvap);
 
 	if (!ess) {
 		click_chatter("%{element} :: %s :: unable to find lvap %s",
@@ -851,9 +1024,9 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 		return;
 	}
 
-	MinstrelDstInfo *nfo = _rcs.at(ess->_iface_id)->neighbors()->findp(lvap);
+	MinstrelDstInfo info;
 
-	if (!nfo) {
+	if (!_ifaces[ess->_iface_id]._rc->neighbor(lvap, info)) {
 		click_chatter("%{element} :: %s :: no rate information for %s",
 					  this,
 					  __func__,
@@ -861,7 +1034,7 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 		return;
 	}
 
-	int len = sizeof(empower_lvap_stats_response) + nfo->rates.size() * sizeof(lvap_stats_entry);
+	int len = sizeof(empower_lvap_stats_response) + info.rates.size() * sizeof(lvap_stats_entry);
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -880,18 +1053,18 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 	lvap_stats->set_seq(get_next_seq());
 	lvap_stats->set_lvap_stats_id(lvap_stats_id);
 	lvap_stats->set_wtp(_wtp);
-	lvap_stats->set_nb_entries(nfo->rates.size());
+	lvap_stats->set_nb_entries(info.rates.size());
 
 	uint8_t *ptr = (uint8_t *) lvap_stats;
 	ptr += sizeof(struct empower_lvap_stats_response);
 	uint8_t *end = ptr + (len - sizeof(struct empower_lvap_stats_response));
 
-	for (int i = 0; i < nfo->rates.size(); i++) {
+	for (int i = 0; i < info.rates.size(); i++) {
 		assert (ptr <= end);
 		lvap_stats_entry *entry = (lvap_stats_entry *) ptr;
-		entry->set_rate(nfo->rates[i]);
-		entry->set_prob((uint32_t) nfo->probability[i]);
-		entry->set_cur_prob((uint32_t) nfo->cur_prob[i]);
+		entry->set_rate(info.rates[i].rate);
+		entry->set_prob((uint32_t) info.rates[i].probability);
+		entry->set_cur_prob((uint32_t) info.rates[i].cur_prob);
 		ptr += sizeof(struct lvap_stats_entry);
 	}
 
@@ -911,9 +1084,17 @@ void EmpowerLVAPManager::send_counters_response(EtherAddress sta, uint32_t count
 		return;
 	}
 
+	// snapshot the histograms, they are updated concurrently
+	uint16_t tx_size[LengthHistogram::MAX_SAMPLES];
+	uint32_t tx_count[LengthHistogram::MAX_SAMPLES];
+	uint16_t rx_size[LengthHistogram::MAX_SAMPLES];
+	uint32_t rx_count[LengthHistogram::MAX_SAMPLES];
+	int nb_tx = txp->_counters->_tx.samples(txp->_buckets, tx_size, tx_count);
+	int nb_rx = txp->_counters->_rx.samples(txp->_buckets, rx_size, rx_count);
+
 	int len = sizeof(empower_counters_response);
-	len += txp->_tx.size() * 6; // the tx samples
-	len += txp->_rx.size() * 6; // the rx samples
+	len += nb_tx * sizeof(struct counters_entry); // the tx samples
+	len += nb_rx * sizeof(struct counters_entry); // the rx samples
 
 	WritablePacket *p = Packet::make(len);
 
@@ -934,27 +1115,27 @@ void EmpowerLVAPManager::send_counters_response(EtherAddress sta, uint32_t count
 	counters->set_counters_id(counters_id);
 	counters->set_wtp(_wtp);
 	counters->set_sta(sta);
-	counters->set_nb_tx(txp->_tx.size());
-	counters->set_nb_rx(txp->_rx.size());
+	counters->set_nb_tx(nb_tx);
+	counters->set_nb_rx(nb_rx);
 
 	uint8_t *ptr = (uint8_t *) counters;
 	ptr += sizeof(struct empower_counters_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_counters_response));
 
-	for (CBytesIter iter = txp->_tx.begin(); iter.live(); iter++) {
+	for (int i = 0; i < nb_tx; i++) {
 		assert (ptr <= end);
 		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
+		entry->set_size(tx_size[i]);
+		entry->set_count(tx_count[i]);
 		ptr += sizeof(struct counters_entry);
 	}
 
-	for (CBytesIter iter = txp->_rx.begin(); iter.live(); iter++) {
+	for (int i = 0; i < nb_rx; i++) {
 		assert (ptr <= end);
 		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
+		entry->set_size(rx_size[i]);
+		entry->set_count(rx_count[i]);
 		ptr += sizeof(struct counters_entry);
 	}
 
@@ -1042,7 +1223,7 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 		return;
 	}
 
-	TxPolicyInfo * tx_policy = _rcs[iface_id]->tx_policies()->tx_table()->find(mcast);
+	TxPolicyInfo * tx_policy = _ifaces[iface_id]._rc->tx_policies()->supported(mcast);
 
 	if (!tx_policy) {
 		int len = sizeof(empower_txp_counters_response);
@@ -1067,8 +1248,13 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 		return;
 	}
 
+	// snapshot the histogram, it is updated concurrently
+	uint16_t tx_size[LengthHistogram::MAX_SAMPLES];
+	uint32_t tx_count[LengthHistogram::MAX_SAMPLES];
+	int nb_tx = tx_policy->_counters->_tx.samples(tx_policy->_buckets, tx_size, tx_count);
+
 	int len = sizeof(empower_txp_counters_response);
-	len += tx_policy->_tx.size() * 6; // the tx samples
+	len += nb_tx * sizeof(struct counters_entry); // the tx samples
 
 	WritablePacket *p = Packet::make(len);
 
@@ -1088,18 +1274,18 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 	counters->set_seq(get_next_seq());
 	counters->set_counters_id(counters_id);
 	counters->set_wtp(_wtp);
-	counters->set_nb_tx(tx_policy->_tx.size());
+	counters->set_nb_tx(nb_tx);
 
 	uint8_t *ptr = (uint8_t *) counters;
 	ptr += sizeof(struct empower_txp_counters_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_txp_counters_response));
 
-	for (CBytesIter iter = tx_policy->_tx.begin(); iter.live(); iter++) {
+	for (int i = 0; i < nb_tx; i++) {
 		assert (ptr <= end);
 		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
+		entry->set_size(tx_size[i]);
+		entry->set_count(tx_count[i]);
 		ptr += sizeof(struct counters_entry);
 	}
 
@@ -1110,7 +1296,7 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 void EmpowerLVAPManager::send_caps() {
 
 	int len = sizeof(empower_caps);
-	len += _ifaces_to_elements.size() * sizeof(struct resource_elements_entry);
+	len += _ifaces.size() * sizeof(struct resource_elements_entry);
 	len += _ports.size() * sizeof(struct port_elements_entry);
 
 	WritablePacket *p = Packet::make(len);
@@ -1131,7 +1317,7 @@ void EmpowerLVAPManager::send_caps() {
 	caps->set_seq(get_next_seq());
 	caps->set_wtp(_wtp);
 	caps->set_dpid(_dpid);
-	caps->set_nb_resources_elements(_ifaces_to_elements.size());
+	caps->set_nb_resources_elements(_ifaces.size());
 	caps->set_nb_ports_elements(_ports.size());
 
 	uint8_t *ptr = (uint8_t *) caps;
@@ -1139,13 +1325,13 @@ void EmpowerLVAPManager::send_caps() {
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_caps));
 
-	for (REIter iter = _ifaces_to_elements.begin(); iter.live(); iter++) {
+	for (int i = 0; i < _ifaces.size(); i++) {
 		assert (ptr <= end);
-		ResourceElement *elm = iter.value();
+		const ResourceElement &elm = _ifaces[i]._element;
 		resource_elements_entry *entry = (resource_elements_entry *) ptr;
-		entry->set_hwaddr(elm->_hwaddr);
-		entry->set_channel(elm->_channel);
-		entry->set_band(elm->_band);
+		entry->set_hwaddr(elm._hwaddr);
+		entry->set_channel(elm._channel);
+		entry->set_band(elm._band);
 		ptr += sizeof(struct resource_elements_entry);
 	}
 
@@ -1170,7 +1356,8 @@ int EmpowerLVAPManager::handle_caps_request(Packet *, uint32_t) {
 
 int EmpowerLVAPManager::handle_lvap_status_request(Packet *, uint32_t) {
 	// send LVAP status update messages
-	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+	const StationIndex *stations = &_stations;
+	for (LVAPIndexIter it = stations->_lvaps.begin(); it.live(); it++) {
 		send_status_lvap(it.key());
 	}
 	return 0;
@@ -1178,7 +1365,8 @@ int EmpowerLVAPManager::handle_lvap_status_request(Packet *, uint32_t) {
 
 int EmpowerLVAPManager::handle_vap_status_request(Packet *, uint32_t) {
 	// send VAP status update messages
-	for (VAPIter it = _vaps.begin(); it.live(); it++) {
+	const StationIndex *stations = &_stations;
+	for (VAPIndexIter it = stations->_vaps.begin(); it.live(); it++) {
 		send_status_vap(it.key());
 	}
 	return 0;
@@ -1206,6 +1394,8 @@ int EmpowerLVAPManager::handle_add_vap(Packet *p, uint32_t offset) {
 		   return 0;
 	}
 
+	_lock.acquire_write();
+
 	if (_vaps.find(bssid) == _vaps.end()) {
 
 		EmpowerVAPState state;
@@ -1217,19 +1407,28 @@ int EmpowerLVAPManager::handle_add_vap(Packet *p, uint32_t offset) {
 		state._iface_id = iface;
 		_vaps.set(bssid, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Add this VAP's BSSID to the mask */
+		_bssid_masks[iface].add(bssid);
+		write_bssid_mask(iface);
+
+		publish_vap(bssid);
+
+		_lock.release_write();
+
+		_ebs->update_beacons();
 
 		/* create default slice */
 		if (ssid != "") {
 			// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
-			_eqms[iface]->set_slice(ssid, 0, 12000, false);
+			_ifaces[iface]._eqm->set_slice(ssid, 0, 12000, false);
 		}
 
 		return 0;
 
 	}
 
+	_lock.release_write();
+
 	return 0;
 
 }
@@ -1239,9 +1438,12 @@ int EmpowerLVAPManager::handle_del_vap(Packet *p, uint32_t offset) {
 	struct empower_del_vap *q = (struct empower_del_vap *) (p->data() + offset);
 	EtherAddress bssid = q->bssid();
 
+	_lock.acquire_write();
+
 	// First make sure that this VAP isn't here already, in which
 	// case we'll just ignore the request
 	if (_vaps.find(bssid) == _vaps.end()) {
+		_lock.release_write();
 		click_chatter("%{element} :: %s :: Ignoring VAP delete request because the agent isn't hosting the VAP",
 				      this,
 				      __func__);
@@ -1249,10 +1451,20 @@ int EmpowerLVAPManager::handle_del_vap(Packet *p, uint32_t offset) {
 		return -1;
 	}
 
+	// Remove this VAP's BSSID from the mask
+	int iface = _vaps.get(bssid)._iface_id;
+	_bssid_masks[iface].remove(bssid);
+
 	_vaps.erase(_vaps.find(bssid));
 
-	// Remove this VAP's BSSID from the mask
-	compute_bssid_mask();
+	write_bssid_mask(iface);
+
+	publish_vap(bssid);
+
+	_lock.release_write();
+
+	_ebs->invalidate_templates(bssid, iface);
+	_ebs->update_beacons();
 
 	return 0;
 
@@ -1344,8 +1556,13 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 		_lvaps.set(sta, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Add this LVAP's BSSIDs to the mask */
+		update_lvap_mask(_lvaps.get_pointer(sta), true);
+		write_bssid_mask(iface);
+
+		publish_lvap(sta);
+
+		_ebs->update_beacons();
 
 		/* send add lvap response message */
 		send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, state._sta, module_id, 0);
@@ -1355,7 +1572,7 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 		/* create default slice */
 		if (ssid != "") {
 			// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
-			_eqms[iface]->set_default_slice(ssid);
+			_ifaces[iface]._eqm->set_default_slice(ssid);
 		}
 
 		return 0;
@@ -1364,6 +1581,14 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
 
+	// Networks and mask flag may change, swap this LVAP's contribution
+	update_lvap_mask(ess, false);
+
+	// the templates of the networks being replaced are not used anymore
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		_ebs->invalidate_templates(ess->_networks[i]._bssid, ess->_iface_id);
+	}
+
 	ess->_bssid = bssid;
 	ess->_ssid = ssid;
 	ess->_networks = networks;
@@ -1373,6 +1598,13 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	ess->_supported_band = supported_band;
 	ess->_set_mask = set_mask;
 
+	update_lvap_mask(ess, true);
+	write_bssid_mask(ess->_iface_id);
+
+	publish_lvap(sta);
+
+	_ebs->update_beacons();
+
 	/* send add lvap response message */
 	send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, ess->_sta, module_id, 0);
 
@@ -1381,7 +1613,7 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	/* create default slice */
 	if (ssid != "") {
 		// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
-		_eqms[iface]->set_default_slice(ssid);
+		_ifaces[iface]._eqm->set_default_slice(ssid);
 	}
 
 	return 0;
@@ -1464,14 +1696,16 @@ int EmpowerLVAPManager::handle_set_port(Packet *p, uint32_t offset) {
 		   return 0;
 	}
 
-	_rcs[iface]->tx_policies()->insert(addr, mcs, ht_mcs, no_ack, tx_mcast, ur, rts_cts);
-	_rcs[iface]->forget_station(addr);
+	_ifaces[iface]._rc->tx_policies()->insert(addr, mcs, ht_mcs, no_ack, tx_mcast, ur, rts_cts);
+	_ifaces[iface]._rc->forget_station(addr);
+
+	// beacons advertise the rates of the policy matching their bssid
+	_ebs->invalidate_templates(addr, iface);
 
-	MinstrelDstInfo *nfo = _rcs.at(iface)->neighbors()->findp(addr);
+	TxPolicyInfo * txp = _ifaces[iface]._rc->tx_policies()->supported(addr);
 
-	if (!nfo || !nfo->rates.size()) {
-		TxPolicyInfo * txp = _rcs[iface]->tx_policies()->tx_table()->find(addr);
-		nfo = _rcs.at(iface)->insert_neighbor(addr, txp);
+	if (txp) {
+		_ifaces[iface]._rc->insert_neighbor(addr, txp);
 	}
 
 	send_status_port(addr, iface);
@@ -1501,8 +1735,10 @@ int EmpowerLVAPManager::handle_del_port(Packet *p, uint32_t offset) {
 		   return 0;
 	}
 
-	_rcs[iface]->tx_policies()->remove(addr);
-	_rcs[iface]->forget_station(addr);
+	_ifaces[iface]._rc->tx_policies()->remove(addr);
+	_ifaces[iface]._rc->forget_station(addr);
+
+	_ebs->invalidate_templates(addr, iface);
 
 	return 0;
 
@@ -1545,18 +1781,19 @@ int EmpowerLVAPManager::handle_del_lvap(Packet *p, uint32_t offset) {
 
 	// First make sure that this LVAP isn't here already, in which
 	// case we'll just ignore the request
-	if (_lvaps.find(sta) == _lvaps.end()) {
+	const EmpowerStationState *ess = get_ess(sta);
+
+	if (!ess) {
 		return -1;
 	}
 
-	EmpowerStationState *ess = _lvaps.get_pointer(sta);
-
 	// if this is an uplink only LVAP the CSA is not needed
 	if (!ess->_set_mask) {
 		// remove lvap
-		remove_lvap(ess->_sta);
+		remove_lvap(sta);
+		_ebs->update_beacons();
 		// send del lvap response message
-		send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, ess->_sta, module_id, 0);
+		send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, sta, module_id, 0);
 		return 0;
 	}
 
@@ -1566,35 +1803,144 @@ int EmpowerLVAPManager::handle_del_lvap(Packet *p, uint32_t offset) {
 		click_chatter("%{element} :: %s :: sta %s channel %u is different from current channel %u, starting csa",
 				      this,
 				      __func__,
-					  ess->_sta.unparse().c_str(),
+					  sta.unparse().c_str(),
 					  q->csa_switch_channel(),
 					  ess->_channel);
 
-		ess->_csa_active = true;
-		ess->_csa_switch_count = q->csa_switch_count();
-		ess->_csa_switch_mode = q->csa_switch_mode();
-		ess->_csa_switch_channel = q->csa_switch_channel();
-		ess->_module_id = module_id;
+		_lock.acquire_write();
+
+		EmpowerStationState *state = _lvaps.get_pointer(sta);
+		state->_csa_active = true;
+		state->_csa_switch_count = q->csa_switch_count();
+		state->_csa_switch_mode = q->csa_switch_mode();
+		state->_csa_switch_channel = q->csa_switch_channel();
+		state->_module_id = module_id;
+
+		publish_lvap(sta);
+
+		_lock.release_write();
+
+		_ebs->update_beacons();
 
 		return 0;
 
 	}
 
 	// remove lvap
-	remove_lvap(ess->_sta);
+	remove_lvap(sta);
+	_ebs->update_beacons();
 
 	// send del lvap response message
-	send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, ess->_sta, module_id, 0);
+	send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, sta, module_id, 0);
+
+	return 0;
+
+}
+
+int EmpowerLVAPManager::remove_lvap(EtherAddress sta) {
+
+	_lock.acquire_write();
+
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+
+	if (!ess) {
+		_lock.release_write();
+		return -1;
+	}
+
+	// Forget station
+	_ifaces[ess->_iface_id]._rc->tx_policies()->remove(ess->_sta);
+	_ifaces[ess->_iface_id]._rc->forget_station(ess->_sta);
+
+	// Remove this LVAP's BSSIDs from the mask
+	int iface_id = ess->_iface_id;
+	update_lvap_mask(ess, false);
+
+	// Drop the beacon templates of this LVAP's networks
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		_ebs->invalidate_templates(ess->_networks[i]._bssid, iface_id);
+	}
+
+	// Erase lvap
+	_lvaps.erase(_lvaps.find(sta));
+
+	write_bssid_mask(iface_id);
+
+	publish_lvap(sta);
+
+	_lock.release_write();
 
 	return 0;
 
 }
 
+void EmpowerLVAPManager::disassociate_lvap(EtherAddress sta) {
+	_lock.acquire_write();
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	if (ess) {
+		ess->_association_status = false;
+		ess->_ssid = "";
+		publish_lvap(sta);
+	}
+	_lock.release_write();
+}
+
+void EmpowerLVAPManager::deauthenticate_lvap(EtherAddress sta) {
+	_lock.acquire_write();
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	if (ess) {
+		ess->_association_status = false;
+		ess->_authentication_status = false;
+		ess->_ssid = "";
+		ess->_bssid = EtherAddress();
+		publish_lvap(sta);
+	}
+	_lock.release_write();
+}
+
+int EmpowerLVAPManager::decrement_csa_count(EtherAddress sta) {
+	int count = -1;
+	_lock.acquire_write();
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	if (ess) {
+		count = --ess->_csa_switch_count;
+		publish_lvap(sta);
+	}
+	_lock.release_write();
+	return count;
+}
+
+// called with the write lock held, after the master record of sta changed
+void EmpowerLVAPManager::publish_lvap(EtherAddress sta) {
+	const EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	EmpowerStationState *old;
+	if (ess) {
+		old = _stations._lvaps.set(new EmpowerStationState(*ess));
+	} else {
+		old = _stations._lvaps.erase(sta);
+	}
+	_stations._version++;
+	_reclaimer.retire(old);
+}
+
+// called with the write lock held, after the master record of bssid changed
+void EmpowerLVAPManager::publish_vap(EtherAddress bssid) {
+	const EmpowerVAPState *evs = _vaps.get_pointer(bssid);
+	EmpowerVAPState *old;
+	if (evs) {
+		old = _stations._vaps.set(new EmpowerVAPState(*evs));
+	} else {
+		old = _stations._vaps.erase(bssid);
+	}
+	_stations._version++;
+	_reclaimer.retire(old);
+}
+
 int EmpowerLVAPManager::handle_probe_response(Packet *p, uint32_t offset) {
 	struct empower_probe_response *q = (struct empower_probe_response *) (p->data() + offset);
 	EtherAddress sta = q->sta();
 	String ssid = q->ssid();
-	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	const EmpowerStationState *ess = get_ess(sta);
 	_ebs->send_probe_response(ess, ssid);
 	return 0;
 }
@@ -1644,7 +1990,8 @@ int EmpowerLVAPManager::handle_uimg_request(Packet *p, uint32_t offset) {
 	EtherAddress hwaddr = q->hwaddr();
 	empower_bands_types band = (empower_bands_types) q->band();
 	uint8_t channel = q->channel();
-	send_img_response(EMPOWER_PT_UCQM_RESPONSE, q->graph_id(), hwaddr, channel, band);
+	bool delta = q->type() == EMPOWER_PT_UCQM_DELTA_REQUEST;
+	send_img_response(EMPOWER_PT_UCQM_RESPONSE, q->graph_id(), hwaddr, channel, band, delta);
 	return 0;
 }
 
@@ -1660,7 +2007,8 @@ int EmpowerLVAPManager::handle_nimg_request(Packet *p, uint32_t offset) {
 	EtherAddress hwaddr = q->hwaddr();
 	empower_bands_types band = (empower_bands_types) q->band();
 	uint8_t channel = q->channel();
-	send_img_response(EMPOWER_PT_NCQM_RESPONSE, q->graph_id(), hwaddr, channel, band);
+	bool delta = q->type() == EMPOWER_PT_NCQM_DELTA_REQUEST;
+	send_img_response(EMPOWER_PT_NCQM_RESPONSE, q->graph_id(), hwaddr, channel, band, delta);
 	return 0;
 }
 
@@ -1674,12 +2022,22 @@ int EmpowerLVAPManager::handle_set_slice(Packet *p, uint32_t offset) {
 
 	int iface_id = element_to_iface(hwaddr, channel, band);
 
+	if (iface_id == -1) {
+		click_chatter("%{element} :: %s :: invalid resource element (%s, %u, %u)!",
+					  this,
+					  __func__,
+					  hwaddr.unparse().c_str(),
+					  channel,
+					  band);
+		return 0;
+	}
+
 	int dscp = add_slice->dscp();
 	String ssid = add_slice->ssid();
 	uint32_t quantum = add_slice->quantum();
 	bool amsdu_aggregation = add_slice->flags(EMPOWER_AMSDU_AGGREGATION);
 
-	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation);
+	_ifaces[iface_id]._eqm->set_slice(ssid, dscp, quantum, amsdu_aggregation);
 
 	return 0;
 
@@ -1695,10 +2053,20 @@ int EmpowerLVAPManager::handle_del_slice(Packet *p, uint32_t offset) {
 
 	int iface_id = element_to_iface(hwaddr, channel, band);
 
+	if (iface_id == -1) {
+		click_chatter("%{element} :: %s :: invalid resource element (%s, %u, %u)!",
+					  this,
+					  __func__,
+					  hwaddr.unparse().c_str(),
+					  channel,
+					  band);
+		return 0;
+	}
+
 	int dscp = del_slice->dscp();
 	String ssid = del_slice->ssid();
 
-	_eqms[iface_id]->del_slice(ssid, dscp);
+	_ifaces[iface_id]._eqm->del_slice(ssid, dscp);
 
 	return 0;
 
@@ -1765,9 +2133,11 @@ void EmpowerLVAPManager::push(int, Packet *p) {
 			handle_del_summary_trigger(p, offset);
 			break;
 		case EMPOWER_PT_UCQM_REQUEST:
+		case EMPOWER_PT_UCQM_DELTA_REQUEST:
 			handle_uimg_request(p, offset);
 			break;
 		case EMPOWER_PT_NCQM_REQUEST:
+		case EMPOWER_PT_NCQM_DELTA_REQUEST:
 			handle_nimg_request(p, offset);
 			break;
 		case EMPOWER_PT_SET_PORT:
@@ -1836,88 +2206,60 @@ Vector<EtherAddress>::iterator find(Vector<EtherAddress>::iterator begin, Vector
  * using all the BSSIDs of the VAPs, and sets the
  * hardware register accordingly.
  */
-void EmpowerLVAPManager::compute_bssid_mask() {
+void EmpowerLVAPManager::update_lvap_mask(EmpowerStationState *ess, bool add) {
 
-	// clear _masks vector
-	_masks.clear();
-
-	for (unsigned j = 0; j < _ifaces_to_elements.size(); j++) {
+	// only DL+UL LVAPs contribute to the mask
+	if (!ess->_set_mask) {
+		return;
+	}
 
-		// start building mask
-		uint8_t bssid_mask[6];
-		int i;
+	BssidMask &mask = _bssid_masks[ess->_iface_id];
 
-		// Start with a mask of ff:ff:ff:ff:ff:ff
-		for (i = 0; i < 6; i++) {
-			bssid_mask[i] = 0xff;
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		if (add) {
+			mask.add(ess->_networks[i]._bssid);
+		} else {
+			mask.remove(ess->_networks[i]._bssid);
 		}
+	}
 
-		// For each LVAP, update the bssid mask to include
-		// the common bits of all LVAPs.
-		for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// check if lvap is DL+UL
-			if (!it.value()._set_mask) {
-				continue;
-			}
-			// add each bssid in the networks
-			const uint8_t *hw = (const uint8_t *) _ifaces_to_elements[iface_id]->_hwaddr.data();
-			for (int k = 0; k < it.value()._networks.size(); k ++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._networks[k]._bssid.data();
-				for (i = 0; i < 6; i++) {
-					bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-				}
-			}
-		}
+}
 
-		// For each VAP, update the bssid mask to include
-		// the common bits of all VAPs.
-		for (VAPIter it = _vaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// add to mask
-			const uint8_t *hw = (const uint8_t *) _ifaces_to_elements[iface_id]->_hwaddr.data();
-			for (i = 0; i < 6; i++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._bssid.data();
-				bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-			}
-		}
+void EmpowerLVAPManager::write_bssid_mask(int iface, bool force) {
 
-		_masks.push_back(EtherAddress(bssid_mask));
+	EtherAddress mask = _bssid_masks[iface].mask();
 
+	// Skip the debugfs write if the register already holds this value
+	if (!force && mask == _masks[iface]) {
+		_mask_skipped[iface]++;
+		return;
 	}
 
-	// Update bssid masks register through debugfs
-	for (int i = 0; i < _masks.size(); i++) {
-
-		FILE *debugfs_file = fopen(_debugfs_strings[i].c_str(), "w");
+	_masks[iface] = mask;
 
-		if (debugfs_file != NULL) {
-			if (_debug) {
-				click_chatter("%{element} :: %s :: %s",
-							  this,
-							  __func__,
-							  _masks[i].unparse_colon().c_str());
-			}
-			fprintf(debugfs_file, "%s\n", _masks[i].unparse_colon().c_str());
-			fclose(debugfs_file);
-			continue;
-		}
+	if (_debugfs_fds[iface] < 0) {
+		return;
+	}
 
-		click_chatter("%{element} :: %s :: unable to open debugfs file %s",
+	if (_debug) {
+		click_chatter("%{element} :: %s :: %s",
 					  this,
 					  __func__,
-					  _debugfs_strings[i].c_str());
+					  mask.unparse_colon().c_str());
+	}
 
+	String line = mask.unparse_colon() + "\n";
+
+	if (pwrite(_debugfs_fds[iface], line.data(), line.length(), 0) < 0) {
+		click_chatter("%{element} :: %s :: unable to write debugfs file %s",
+					  this,
+					  __func__,
+					  _debugfs_strings[iface].c_str());
+		return;
 	}
 
+	_mask_writes[iface]++;
+
 }
 
 enum {
@@ -1931,6 +2273,11 @@ enum {
 	H_DEL_LVAP,
 	H_RECONNECT,
 	H_INTERFACES,
+	H_MASK_WRITES,
+	H_FLUSH_DEADLINE,
+	H_COALESCED,
+	H_SNAPSHOT,
+	H_CQM,
 };
 
 String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
@@ -1953,9 +2300,44 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 	    }
 		return sa.take_string();
 	}
+	case H_MASK_WRITES: {
+	    StringAccum sa;
+	    for (int i = 0; i < td->_mask_writes.size(); i++) {
+	    	sa << i << ": writes " << td->_mask_writes[i] << " skipped " << td->_mask_skipped[i] << "\n";
+	    }
+		return sa.take_string();
+	}
+	case H_FLUSH_DEADLINE:
+		return String(td->_flush_deadline) + "\n";
+	case H_COALESCED: {
+		StringAccum sa;
+		sa << "messages " << td->_sent_messages << "\n";
+		sa << "packets " << td->_sent_packets << "\n";
+		return sa.take_string();
+	}
+	case H_SNAPSHOT: {
+		StringAccum sa;
+		const StationIndex *stations = td->stations();
+		td->_lock.acquire_read();
+		sa << "version " << stations->_version << "\n";
+		sa << "lvaps " << stations->_lvaps.size() << "\n";
+		sa << "vaps " << stations->_vaps.size() << "\n";
+		sa << "retired " << td->_reclaimer.pending() << "\n";
+		td->_lock.release_read();
+		return sa.take_string();
+	}
+	case H_CQM: {
+		StringAccum sa;
+		sa << "responses " << td->_cqm_responses << "\n";
+		sa << "entries " << td->_cqm_entries << "\n";
+		sa << "suppressed " << td->_cqm_suppressed << "\n";
+		sa << "bytes " << td->_cqm_bytes << "\n";
+		return sa.take_string();
+	}
 	case H_LVAPS: {
 	    StringAccum sa;
-		for (LVAPIter it = td->lvaps()->begin(); it.live(); it++) {
+		td->_lock.acquire_read();
+		for (LVAPIter it = td->_lvaps.begin(); it.live(); it++) {
 		    sa << "sta ";
 		    sa << it.key().unparse();
 		    if (it.value()._set_mask) {
@@ -1996,18 +2378,20 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 			sa << it.value()._supported_band;
 			sa << "\n";
 		}
+		td->_lock.release_read();
 		return sa.take_string();
 	}
 	case H_INTERFACES: {
 		StringAccum sa;
-		for (REIter iter = td->_ifaces_to_elements.begin(); iter.live(); iter++) {
-			sa << iter.key() << " -> " << iter.value()->unparse()  << "\n";
+		for (int i = 0; i < td->_ifaces.size(); i++) {
+			sa << i << " -> " << td->_ifaces[i]._element.unparse()  << "\n";
 		}
 		return sa.take_string();
 	}
 	case H_VAPS: {
 	    StringAccum sa;
-		for (VAPIter it = td->vaps()->begin(); it.live(); it++) {
+		td->_lock.acquire_read();
+		for (VAPIter it = td->_vaps.begin(); it.live(); it++) {
 			sa << "bssid ";
 			sa << it.key().unparse();
 			sa << " ssid ";
@@ -2022,34 +2406,26 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 			sa << it.value()._band;
 			sa << "\n";
 		}
+		td->_lock.release_read();
 		return sa.take_string();
 	}
 	case H_BYTES: {
 		StringAccum sa;
-		for (LVAPIter it = td->lvaps()->begin(); it.live(); it++) {
+		const StationIndex *stations = td->stations();
+		for (LVAPIndexIter it = stations->_lvaps.begin(); it.live(); it++) {
 			TxPolicyInfo *txp = td->get_txp(it.key());
 			sa << "!" << it.key().unparse() << "\n";
+			uint16_t size[LengthHistogram::MAX_SAMPLES];
+			uint32_t count[LengthHistogram::MAX_SAMPLES];
 			sa << "!TX\n";
-			CBytes tx = txp->_tx;
-			Vector<int> lens_tx;
-			for (CBytesIter iter = tx.begin(); iter.live(); iter++) {
-				lens_tx.push_back(iter.key());
-			}
-			click_qsort(lens_tx.begin(), lens_tx.size());
-			for (int i = 0; i < lens_tx.size(); i++) {
-				CBytesIter itr = tx.find(lens_tx[i]);
-				sa << itr.key() << " " << itr.value() << "\n";
+			int n = txp->_counters->_tx.samples(txp->_buckets, size, count);
+			for (int i = 0; i < n; i++) {
+				sa << size[i] << " " << count[i] << "\n";
 			}
 			sa << "!RX\n";
-			CBytes rx = txp->_rx;
-			Vector<int> lens_rx;
-			for (CBytesIter iter = rx.begin(); iter.live(); iter++) {
-				lens_rx.push_back(iter.key());
-			}
-			click_qsort(lens_rx.begin(), lens_rx.size());
-			for (int i = 0; i < lens_rx.size(); i++) {
-				CBytesIter itr = rx.find(lens_rx[i]);
-				sa << itr.key() << " " << itr.value() << "\n";
+			n = txp->_counters->_rx.samples(txp->_buckets, size, count);
+			for (int i = 0; i < n; i++) {
+				sa << size[i] << " " << count[i] << "\n";
 			}
 		}
 		return sa.take_string();
@@ -2110,6 +2486,13 @@ int EmpowerLVAPManager::write_handler(const String &in_s, Element *e,
 		break;
 
 	}
+	case H_FLUSH_DEADLINE: {
+		uint32_t flush_deadline;
+		if (!IntArg().parse(s, flush_deadline))
+			return errh->error("flush_deadline parameter must be unsigned");
+		f->_flush_deadline = flush_deadline;
+		break;
+	}
 	case H_RECONNECT: {
 		// clear triggers
 		f->_ers->clear_triggers();
@@ -2127,6 +2510,12 @@ void EmpowerLVAPManager::add_handlers() {
 	add_read_handler("lvaps", read_handler, (void *) H_LVAPS);
 	add_read_handler("vaps", read_handler, (void *) H_VAPS);
 	add_read_handler("masks", read_handler, (void *) H_MASKS);
+	add_read_handler("mask_writes", read_handler, (void *) H_MASK_WRITES);
+	add_read_handler("flush_deadline", read_handler, (void *) H_FLUSH_DEADLINE);
+	add_read_handler("coalesced", read_handler, (void *) H_COALESCED);
+	add_read_handler("snapshot", read_handler, (void *) H_SNAPSHOT);
+	add_read_handler("cqm", read_handler, (void *) H_CQM);
+	add_write_handler("flush_deadline", write_handler, (void *) H_FLUSH_DEADLINE);
 	add_read_handler("bytes", read_handler, (void *) H_BYTES);
 	add_read_handler("interfaces", read_handler, (void *) H_INTERFACES);
 	add_write_handler("reconnect", write_handler, (void *) H_RECONNECT);
@@ -9,6 +9,8 @@
 #include <clicknet/wifi.h>
 #include <click/sync.hh>
 #include <elements/wifi/minstrel.hh>
+#include <elements/wifi/reclaimer.hh>
+#include "pointerindex.hh"
 #include "empowerrxstats.hh"
 #include "empowerpacket.hh"
 #include "igmppacket.hh"
@@ -43,7 +45,8 @@ An EmpowerOpenAuthResponder element
 An EmpowerAssociationResponder element
 
 =item DEBUGFS
-The path to the bssid_extra file
+The path to the bssid_extra file. Files are opened once at initialization
+and the mask is written only when its value changes.
 
 =item EPSB
 An EmpowerPowerSaveBuffer element
@@ -51,17 +54,62 @@ An EmpowerPowerSaveBuffer element
 =item PERIOD
 Interval between hello messages to the Access Controller (in msec), default is 5000
 
+=item COALESCE_SIZE
+Messages to the Access Controller are packed in one packet up to this many
+bytes before being pushed to the socket, 0 disables coalescing. Default is 1460
+
+=item FLUSH_DEADLINE
+Maximum time a message waits in the output buffer (in usec), default is 1000
+
 =item EDEAUTHR
 An EmpowerDeAuthResponder element
 
 =item EDISASSOR
 An EmpowerDisassocResponder element
 
+=item CQM_RSSI_DELTA
+Unsigned (in dB). Send a neighbor in a UCQM/NCQM delta response only if its
+last or moving average RSSI moved by at least this much since it was last
+sent for the same graph. 0 disables the criterion. Default is 0
+
+=item CQM_PACKETS_DELTA
+Unsigned. Send a neighbor in a UCQM/NCQM delta response only if the number
+of frames it sent in the last window changed by at least this much since it
+was last sent for the same graph. 0 disables the criterion. Default is 0
+
+=item CQM_REFRESH
+Unsigned. Every CQM_REFRESH-th delta response of a graph carries every
+neighbor, 0 means only the first one. Default is 10
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+The datapath reads LVAPs and VAPs from lock-free indexes of immutable
+records. Every change made by the control path (or by the management frame
+responders) is applied to the master tables under a lock and then published
+by linking a copy of the changed record in place of the old one, which is
+retired along with any outgrown index table until no thread can still hold
+it (see Reclaimer). get_ess(), get_vap() and stations() therefore take no
+lock, but the pointers they return must not be kept across pushes or timer
+runs.
+
+=h snapshot read-only
+Version and size of the station indexes, and the number of retired records
+and tables waiting to be freed.
+
+Delta responses are only sent to a controller asking for them with a
+UCQM_DELTA_REQUEST or NCQM_DELTA_REQUEST, UCQM_REQUEST and NCQM_REQUEST are
+always answered with every neighbor. A delta response has the FULL flag set
+when it carries every neighbor, the controller then replaces its map of the
+graph and drops the neighbors that are gone. Otherwise it updates the
+neighbors in the response and keeps the others.
+
+=h cqm read-only
+Number of UCQM/NCQM responses sent, of entries sent and of entries left out
+because they did not change, and the bytes sent.
+
 =a EmpowerLVAPManager
 */
 
@@ -69,6 +117,10 @@ enum empower_port_flags {
     EMPOWER_STATUS_PORT_NOACK = (1<<0),
 };
 
+enum empower_cqm_flags {
+    EMPOWER_CQM_FULL = (1<<0),
+};
+
 enum empower_lvap_flags {
     EMPOWER_STATUS_LVAP_AUTHENTICATED = (1<<0),
     EMPOWER_STATUS_LVAP_ASSOCIATED = (1<<1),
@@ -90,9 +142,6 @@ enum empower_regmon_types {
 	EMPOWER_REGMON_ED = 0x2,
 };
 
-typedef HashTable<uint16_t, uint32_t> CBytes;
-typedef CBytes::iterator CBytesIter;
-
 class Minstrel;
 class EmpowerQOSManager;
 class EmpowerRegmon;
@@ -137,7 +186,7 @@ public:
 	EmpowerNetwork(EtherAddress bssid, String ssid) :
 			_bssid(bssid), _ssid(ssid) {
 	}
-	String unparse() {
+	String unparse() const {
 		StringAccum sa;
 		sa << '<' << _bssid.unparse() << ", " << _ssid << '>';
 		return sa.take_string();
@@ -169,7 +218,7 @@ public:
 	int _csa_switch_channel;
 	// ADD/DEL LVAP response entries
 	uint32_t _module_id;
-	bool is_valid(int iface_id) {
+	bool is_valid(int iface_id) const {
 		if (_iface_id != iface_id) {
 			return false;
 		}
@@ -186,6 +235,52 @@ public:
 	}
 };
 
+// Reference counted BSSID mask of a single interface. For each of the
+// 48 address bits it counts the hosted BSSIDs that differ from the
+// interface address in that bit, the bit stays set while the count is 0.
+class BssidMask {
+public:
+	EtherAddress _hwaddr;
+	uint32_t _refs[48];
+	BssidMask() : _hwaddr(EtherAddress()) {
+		memset(_refs, 0, sizeof(_refs));
+	}
+	BssidMask(EtherAddress hwaddr) : _hwaddr(hwaddr) {
+		memset(_refs, 0, sizeof(_refs));
+	}
+	void add(EtherAddress bssid) {
+		update(bssid, 1);
+	}
+	void remove(EtherAddress bssid) {
+		update(bssid, -1);
+	}
+	EtherAddress mask() const {
+		uint8_t mask[6];
+		for (int i = 0; i < 6; i++) {
+			mask[i] = 0;
+			for (int j = 0; j < 8; j++) {
+				if (!_refs[i * 8 + j]) {
+					mask[i] |= (1 << j);
+				}
+			}
+		}
+		return EtherAddress(mask);
+	}
+private:
+	void update(EtherAddress bssid, int delta) {
+		const uint8_t *hw = _hwaddr.data();
+		const uint8_t *b = bssid.data();
+		for (int i = 0; i < 6; i++) {
+			uint8_t diff = hw[i] ^ b[i];
+			for (int j = 0; diff; j++, diff >>= 1) {
+				if (diff & 1) {
+					_refs[i * 8 + j] += delta;
+				}
+			}
+		}
+	}
+};
+
 // Cross structure mapping bssids to list of associated
 // station and to the interface id
 class InfoBssid {
@@ -199,10 +294,34 @@ typedef HashTable<EtherAddress, InfoBssid> InfoBssids;
 typedef InfoBssids::iterator IBIter;
 
 typedef HashTable<EtherAddress, EmpowerVAPState> VAP;
-typedef VAP::iterator VAPIter;
+typedef VAP::const_iterator VAPIter;
 
 typedef HashTable<EtherAddress, EmpowerStationState> LVAP;
-typedef LVAP::iterator LVAPIter;
+typedef LVAP::const_iterator LVAPIter;
+
+typedef PointerIndex<EmpowerStationState, EtherAddress, &EmpowerStationState::_sta> LVAPIndex;
+typedef LVAPIndex::const_iterator LVAPIndexIter;
+
+typedef PointerIndex<EmpowerVAPState, EtherAddress, &EmpowerVAPState::_bssid> VAPIndex;
+typedef VAPIndex::const_iterator VAPIndexIter;
+
+// LVAPs and VAPs as seen by the datapath. The records are immutable: a
+// change links a copy of the record it modifies in place of the old one.
+class StationIndex {
+public:
+	uint32_t _version;
+	LVAPIndex _lvaps;
+	VAPIndex _vaps;
+	StationIndex(Reclaimer *reclaimer) :
+		_version(0), _lvaps(reclaimer), _vaps(reclaimer) {
+	}
+	const EmpowerStationState *lvap(EtherAddress sta) const {
+		return _lvaps.get(sta);
+	}
+	const EmpowerVAPState *vap(EtherAddress bssid) const {
+		return _vaps.get(bssid);
+	}
+};
 
 typedef HashTable<int, NetworkPort> Ports;
 typedef Ports::iterator PortsIter;
@@ -223,7 +342,7 @@ public:
 	}
 
 	inline size_t hashcode() const {
-		return _hwaddr.hashcode();
+		return _hwaddr.hashcode() ^ (_channel << 8) ^ _band;
 	}
 
 	inline String unparse() const {
@@ -251,8 +370,80 @@ inline bool operator==(const ResourceElement &a, const ResourceElement &b) {
 	return a._hwaddr == b._hwaddr && a._channel == b._channel && a._band == b._band;
 }
 
-typedef HashTable<int, ResourceElement *> RETable;
-typedef RETable::const_iterator REIter;
+// Resources of one interface, resolved once at configure time
+class EmpowerIface {
+public:
+
+	ResourceElement _element;
+	Minstrel *_rc;
+	EmpowerQOSManager *_eqm;
+	EmpowerRegmon *_regmon;
+
+	EmpowerIface() : _rc(0), _eqm(0), _regmon(0) {
+	}
+
+};
+
+typedef HashTable<ResourceElement, int> REIndex;
+
+// Statistics of a neighbor as last sent to the controller
+class CQMSample {
+public:
+
+	int _last_rssi;
+	int _mov_rssi;
+	int _last_packets;
+
+	CQMSample() : _last_rssi(0), _mov_rssi(0), _last_packets(0) {
+	}
+
+	CQMSample(const DstInfo &nfo) :
+			_last_rssi(nfo.last_rssi()), _mov_rssi(nfo.sma_rssi()),
+			_last_packets(nfo.last_packets()) {
+	}
+
+};
+
+typedef HashTable<EtherAddress, CQMSample> CQMSamples;
+
+// Channel quality map of one graph as known by the controller
+class CQMImage {
+public:
+
+	int _type;
+	int _iface_id;
+	uint32_t _responses;
+	Timestamp _last_request;
+	CQMSamples _samples;
+
+	CQMImage() : _type(-1), _iface_id(-1), _responses(0) {
+	}
+
+	CQMImage(int type, int iface_id) :
+			_type(type), _iface_id(iface_id), _responses(0) {
+	}
+
+	// Whether the neighbor must be sent, records it if so
+	bool update(const DstInfo &nfo, int rssi_delta, int packets_delta) {
+		CQMSample *sample = _samples.get_pointer(nfo._eth);
+		if (sample) {
+			bool rssi = rssi_delta
+					&& (abs(nfo.last_rssi() - sample->_last_rssi) >= rssi_delta
+						|| abs(nfo.sma_rssi() - sample->_mov_rssi) >= rssi_delta);
+			bool packets = packets_delta
+					&& abs(nfo.last_packets() - sample->_last_packets) >= packets_delta;
+			if (!rssi && !packets) {
+				return false;
+			}
+		}
+		_samples.set(nfo._eth, CQMSample(nfo));
+		return true;
+	}
+
+};
+
+typedef HashTable<uint32_t, CQMImage> CQMImages;
+typedef CQMImages::iterator CQMIter;
 
 class EmpowerLVAPManager: public Element {
 public:
@@ -266,6 +457,7 @@ public:
 
 	int initialize(ErrorHandler *);
 	int configure(Vector<String> &, ErrorHandler *);
+	void cleanup(CleanupStage);
 	void add_handlers();
 	void run_timer(Timer *);
 	void reset();
@@ -311,7 +503,7 @@ public:
 	void send_status_slice(String, int, int);
 	void send_counters_response(EtherAddress, uint32_t);
 	void send_txp_counters_response(uint32_t, EtherAddress, uint8_t, empower_bands_types, EtherAddress);
-	void send_img_response(int, uint32_t, EtherAddress, uint8_t, empower_bands_types);
+	void send_img_response(int, uint32_t, EtherAddress, uint8_t, empower_bands_types, bool);
 	void send_wifi_stats_response(uint32_t, EtherAddress, uint8_t, empower_bands_types);
 	void send_caps();
 	void send_rssi_trigger(uint32_t, uint32_t, uint8_t);
@@ -322,77 +514,71 @@ public:
 	void send_add_del_lvap_response(uint8_t, EtherAddress, uint32_t, uint32_t);
 	void send_slice_queue_counters_response(uint32_t, EtherAddress, uint8_t, empower_bands_types, String, int);
 
-	ReadWriteLock* lock() { return &_lock; }
-	LVAP* lvaps() { return &_lvaps; }
-	VAP* vaps() { return &_vaps; }
+	const StationIndex *stations() const { return &_stations; }
 	EtherAddress wtp() { return _wtp; }
 
 	uint32_t get_next_seq() { return ++_seq; }
 
-	int remove_lvap(EtherAddress sta) {
-
-		EmpowerStationState *ess = _lvaps.get_pointer(sta);
-
-		// Forget station
-		_rcs[ess->_iface_id]->tx_policies()->tx_table()->erase(ess->_sta);
-		_rcs[ess->_iface_id]->forget_station(ess->_sta);
-
-		// Erase lvap
-		_lvaps.erase(_lvaps.find(ess->_sta));
+	int remove_lvap(EtherAddress);
+	void disassociate_lvap(EtherAddress);
+	void deauthenticate_lvap(EtherAddress);
+	int decrement_csa_count(EtherAddress);
 
-		// Remove this VAP's BSSID from the mask
-		compute_bssid_mask();
-
-		return 0;
+	int element_to_iface(EtherAddress hwaddr, uint8_t channel, empower_bands_types band) const {
+		return _elements_to_ifaces.get(ResourceElement(hwaddr, channel, band));
+	}
 
+	const EmpowerIface * iface(int iface_id) const {
+		if (iface_id < 0 || iface_id >= _ifaces.size()) {
+			return 0;
+		}
+		return &_ifaces[iface_id];
 	}
 
-	int element_to_iface(EtherAddress hwaddr, uint8_t channel, empower_bands_types band) {
-		for (REIter iter = _ifaces_to_elements.begin(); iter.live(); iter++) {
-			if (iter.value()->_hwaddr == hwaddr && iter.value()->_channel == channel && iter.value()->_band == band) {
-				return iter.key();
-			}
+	ResourceElement* iface_to_element(int iface_id) {
+		if (iface_id < 0 || iface_id >= _ifaces.size()) {
+			return 0;
 		}
-		return -1;
+		return &_ifaces[iface_id]._element;
 	}
 
-	ResourceElement* iface_to_element(int iface) {
-		return _ifaces_to_elements.get(iface);
+	int num_ifaces() const {
+		return _ifaces.size();
 	}
 
-	int num_ifaces() {
-		return _rcs.size();
+	const EmpowerStationState * get_ess(EtherAddress sta) const {
+		return _stations.lvap(sta);
 	}
 
-	EmpowerStationState * get_ess(EtherAddress sta) {
-		return _lvaps.get_pointer(sta);
+	const EmpowerVAPState * get_vap(EtherAddress bssid) const {
+		return _stations.vap(bssid);
 	}
 
 	TxPolicyInfo * get_txp(EtherAddress sta) {
-		EmpowerStationState *ess = _lvaps.get_pointer(sta);
+		const EmpowerStationState *ess = get_ess(sta);
 		if (!ess) {
 			return 0;
 		}
-		Minstrel * rc = _rcs[ess->_iface_id];
+		Minstrel * rc = _ifaces[ess->_iface_id]._rc;
 		TxPolicyInfo * txp = rc->tx_policies()->lookup(ess->_sta);
 		return txp;
 	}
 
 	TransmissionPolicies * get_tx_policies(int iface_id) {
-		return _rcs[iface_id]->tx_policies();
+		return _ifaces[iface_id]._rc->tx_policies();
 	}
 
-	Vector<EtherAddress> * get_mcast_receivers(EtherAddress sta) {
+	const Vector<EtherAddress> * get_mcast_receivers(EtherAddress sta) {
 		return _mtbl->get_receivers(sta);
 	}
 
-	bool is_unique_lvap(EtherAddress sta) {
-		EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	bool is_unique_lvap(EtherAddress sta) const {
+		const StationIndex *stations = &_stations;
+		const EmpowerStationState *ess = stations->lvap(sta);
 		if (!ess) {
 			return false;
 		}
-		EmpowerVAPState *vap = _vaps.get_pointer(ess->_bssid);
-		if (vap) {
+		if (stations->vap(ess->_bssid)) {
 			return false;
 		}
 		return true;
@@ -400,12 +586,27 @@ public:
 
 private:
 
+	enum { CQM_IMAGE_TIMEOUT = 60 }; // seconds
+
+	// serializes the writers of the master LVAP and VAP tables
 	ReadWriteLock _lock;
 
-	RETable _ifaces_to_elements;
+	// frees the records and index tables replaced in _stations
+	Reclaimer _reclaimer;
+	StationIndex _stations;
 
-	void compute_bssid_mask();
+	// interfaces by id and their ids by resource element, both fixed
+	// after configure
+	Vector<EmpowerIface> _ifaces;
+	REIndex _elements_to_ifaces;
+
+	void publish_lvap(EtherAddress);
+	void publish_vap(EtherAddress);
+	void update_lvap_mask(EmpowerStationState *, bool);
+	void write_bssid_mask(int, bool = false);
 	void send_message(Packet *);
+	void flush_messages();
+	void push_pending();
 
 	class Empower11k *_e11k;
 	class EmpowerBeaconSource *_ebs;
@@ -419,9 +620,10 @@ private:
 	Ports _ports;
 	VAP _vaps;
 	Vector<EtherAddress> _masks;
-	Vector<Minstrel *> _rcs;
-	Vector<EmpowerRegmon *> _regmons;
-	Vector<EmpowerQOSManager *> _eqms;
+	Vector<BssidMask> _bssid_masks;
+	Vector<int> _debugfs_fds;
+	Vector<uint32_t> _mask_writes;
+	Vector<uint32_t> _mask_skipped;
 	Vector<String> _debugfs_strings;
 	Timer _timer;
 	uint32_t _seq;
@@ -430,6 +632,28 @@ private:
 	unsigned int _period; // msecs
 	bool _debug;
 
+	// output coalescing
+	Timer _flush_timer;
+	Spinlock _send_lock;
+	WritablePacket *_pending;
+	uint32_t _pending_messages;
+	uint32_t _coalesce_size; // bytes
+	uint32_t _flush_deadline; // usecs
+	uint32_t _sent_messages;
+	uint32_t _sent_packets;
+
+	// delta channel quality maps
+	CQMImages _cqm_images;
+	int _cqm_rssi_delta;
+	int _cqm_packets_delta;
+	uint32_t _cqm_refresh;
+	uint32_t _cqm_responses;
+	uint32_t _cqm_entries;
+	uint32_t _cqm_suppressed;
+	uint64_t _cqm_bytes;
+
+	void reclaim_cqm_images();
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
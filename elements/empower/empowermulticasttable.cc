@@ -30,10 +30,14 @@
 CLICK_DECLS
 
 EmpowerMulticastTable::EmpowerMulticastTable() :
-	_debug(false) {
+	_index(&_reclaimer), _version(0), _debug(false) {
 }
 
 EmpowerMulticastTable::~EmpowerMulticastTable() {
+	for (MulticastIndex::const_iterator it = _index.begin(); it.live(); it++) {
+		delete it.value()->_receivers;
+		delete it.value();
+	}
 }
 
 int EmpowerMulticastTable::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -44,6 +48,40 @@ int EmpowerMulticastTable::configure(Vector<String> &conf, ErrorHandler *errh) {
 
 }
 
+int EmpowerMulticastTable::initialize(ErrorHandler *) {
+	_reclaimer.initialize(this);
+	return 0;
+}
+
+void EmpowerMulticastTable::update_receivers(MulticastSlot *slot) {
+
+	MulticastReceivers *receivers = new MulticastReceivers(++_version);
+
+	if (slot->_groups.size() == 1) {
+		EmpowerMulticastGroup *g = _groups.get_pointer(slot->_groups[0]);
+		for (MMIter it = g->receivers.begin(); it != g->receivers.end(); it++) {
+			receivers->_stas.push_back(it.key());
+		}
+	} else {
+		// IP groups sharing a MAC group may have receivers in common
+		MulticastMembers seen;
+		for (int i = 0; i < slot->_groups.size(); i++) {
+			EmpowerMulticastGroup *g = _groups.get_pointer(slot->_groups[i]);
+			for (MMIter it = g->receivers.begin(); it != g->receivers.end(); it++) {
+				if (seen.set(it.key(), 0)) {
+					receivers->_stas.push_back(it.key());
+				}
+			}
+		}
+	}
+
+	MulticastReceivers *old = slot->_receivers;
+	click_fence();
+	slot->_receivers = receivers;
+	_reclaimer.retire(old);
+
+}
+
 bool EmpowerMulticastTable::add_group(IPAddress group) {
 
 	if (_debug) {
@@ -53,135 +91,127 @@ bool EmpowerMulticastTable::add_group(IPAddress group) {
 					  group.unparse().c_str());
 	}
 
-    Vector<EmpowerMulticastGroup>::iterator i;
-    for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-        if (i->group == group) {
-            return false;
-        }
-    }
+	if (_groups.find(group) != _groups.end()) {
+		return false;
+	}
+
+	EmpowerMulticastGroup &newgroup = _groups[group];
 
-    EmpowerMulticastGroup newgroup;
+	newgroup.group = group;
+	newgroup.mac_group = ip_mcast_addr_to_mac(group);
 
-    newgroup.group = group;
-    newgroup.mac_group = ip_mcast_addr_to_mac(group);
+	MulticastSlot *slot = _index.get(newgroup.mac_group);
+	if (slot) {
+		slot->_groups.push_back(group);
+		return true;
+	}
 
-    multicastgroups.push_back(newgroup);
+	slot = new MulticastSlot(newgroup.mac_group);
+	slot->_groups.push_back(group);
+	slot->_receivers = new MulticastReceivers(++_version);
 
-    return true;
+	_index.set(slot);
+
+	return true;
 
 }
 
 bool EmpowerMulticastTable::join_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					return false;
-				}
-			}
-			i->receivers.push_back(sta);
-			if (_debug) {
-				click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  group.unparse().c_str());
-			}
-			return true;
+	EmpowerMulticastGroup *g = _groups.get_pointer(group);
+
+	if (!g) {
+		return false;
+	}
+
+	if (!g->receivers.set(sta, 0)) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
+						  this,
+						  __func__,
+						  sta.unparse().c_str(),
+						  group.unparse().c_str());
 		}
+		return false;
+	}
+
+	update_receivers(_index.get(g->mac_group));
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  group.unparse().c_str());
 	}
 
-	return false;
+	return true;
 
 }
 
 bool EmpowerMulticastTable::leave_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					i->receivers.erase(a);
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					// The group is deleted if no more receivers belong to it
-					if (i->receivers.begin() == i->receivers.end()) {
-						multicastgroups.erase(i);
-						if (_debug) {
-							click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-										  this,
-										  __func__,
-										  group.unparse().c_str());
-						}
-					}
-					return true;
-				}
-			}
-		}
-	}
+	EmpowerMulticastGroup *g = _groups.get_pointer(group);
 
-	return false;
+	if (!g || !g->receivers.erase(sta)) {
+		return false;
+	}
 
-}
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  group.unparse().c_str());
+	}
 
-bool EmpowerMulticastTable::leave_all_groups(EtherAddress sta) {
+	MulticastSlot *slot = _index.get(g->mac_group);
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		Vector<EtherAddress>::iterator a;
-		for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-			if (*a == sta) {
-				i->receivers.erase(a);
-				click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  i->group.unparse().c_str());
-				// The group is deleted if no more receivers belong to it
-				if (i->receivers.begin() == i->receivers.end()) {
-					multicastgroups.erase(i);
-					click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-								  this,
-								  __func__,
-								  i->group.unparse().c_str());
-				}
+	// The group is deleted if no more receivers belong to it
+	if (g->receivers.empty()) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
+						  this,
+						  __func__,
+						  group.unparse().c_str());
+		}
+		_groups.erase(group);
+		for (int i = 0; i < slot->_groups.size(); i++) {
+			if (slot->_groups[i] == group) {
+				slot->_groups.erase(slot->_groups.begin() + i);
+				break;
 			}
 		}
+		if (slot->_groups.empty()) {
+			_index.erase(slot->_mac_group);
+			_reclaimer.retire(slot->_receivers);
+			_reclaimer.retire(slot);
+			return true;
+		}
 	}
 
+	update_receivers(slot);
+
 	return true;
 
 }
 
-Vector<EtherAddress>* EmpowerMulticastTable::get_receivers(EtherAddress group) {
+bool EmpowerMulticastTable::leave_all_groups(EtherAddress sta) {
 
-	for (MGIter i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->mac_group == group) {
-			return &(i->receivers);
+	Vector<IPAddress> groups;
+	for (MGIter i = _groups.begin(); i != _groups.end(); i++) {
+		if (i.value().receivers.count(sta)) {
+			groups.push_back(i.key());
 		}
 	}
 
-	return 0;
+	for (int i = 0; i < groups.size(); i++) {
+		leave_group(sta, groups[i]);
+	}
 
-}
+	return true;
 
+}
 
 enum {
 	H_DEBUG, H_MULTICAST_TABLE
@@ -194,17 +224,17 @@ String EmpowerMulticastTable::read_handler(Element *e, void *thunk) {
 		return String(td->_debug) + "\n";
 	case H_MULTICAST_TABLE: {
 		StringAccum sa;
-		Vector<EmpowerMulticastGroup>::iterator i;
-		for (i = td->multicastgroups.begin(); i != td->multicastgroups.end(); i++) {
-			sa << i->group.unparse() << " " << i->mac_group.unparse();
-			Vector<EtherAddress>::iterator a;
+		for (MGIter i = td->_groups.begin(); i != td->_groups.end(); i++) {
+			const MulticastReceivers *r = td->receivers(i.value().mac_group);
+			sa << i.value().group.unparse() << " " << i.value().mac_group.unparse();
+			sa << " version " << r->_version;
 			sa << " receivers [ ";
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				sa << a->unparse();
-				if (a != i->receivers.end())
+			for (MMIter a = i.value().receivers.begin(); a != i.value().receivers.end(); a++) {
+				if (a != i.value().receivers.begin())
 					sa << ", ";
+				sa << a.key().unparse();
 			}
-			sa << "]\n";
+			sa << " ]\n";
 		}
 		return sa.take_string();
 	}
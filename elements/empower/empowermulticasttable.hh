@@ -4,6 +4,10 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/etheraddress.hh>
+#include <click/ipaddress.hh>
+#include <click/hashtable.hh>
+#include <elements/wifi/reclaimer.hh>
+#include "pointerindex.hh"
 CLICK_DECLS
 
 /*
@@ -32,19 +36,65 @@ Turn debug on/off
 
 =back 8
 
+Groups are indexed by IP address for IGMP processing and by MAC group for
+the datapath. The receiver lists of the MAC index are immutable snapshots:
+joins and leaves publish new ones and retire the old ones. New MAC groups
+are linked into the index in place (see PointerIndex), so adding a group
+costs O(1) amortized. get_receivers() therefore never blocks and costs one
+hash lookup.
+
+=h multicast_table read-only
+Groups, their MAC address, version and receivers.
+
 =a EmpowerLVAPManager
 */
 
+/*
+ * Receivers of a MAC group as seen by the datapath. A list is never
+ * modified once published: every join or leave builds a new one, with a
+ * new version, and swaps it in. Replaced lists are retired to a Reclaimer,
+ * so readers can use a list without taking any lock.
+ */
+class MulticastReceivers {
+  public:
+
+	uint32_t _version;
+	Vector<EtherAddress> _stas;
+
+	MulticastReceivers(uint32_t version) : _version(version) {
+	}
+
+};
+
+// One per MAC group, several IP groups can map to the same MAC group
+class MulticastSlot {
+  public:
+
+	EtherAddress _mac_group;
+	Vector<IPAddress> _groups;
+	MulticastReceivers * volatile _receivers;
+
+	MulticastSlot(EtherAddress mac_group) : _mac_group(mac_group), _receivers(0) {
+	}
+
+};
+
+// MAC group to slot map read without locks by the datapath, only the
+// control thread changes it
+typedef PointerIndex<MulticastSlot, EtherAddress, &MulticastSlot::_mac_group> MulticastIndex;
+
+typedef HashTable<EtherAddress, int> MulticastMembers;
+typedef MulticastMembers::iterator MMIter;
+
 struct EmpowerMulticastGroup {
 	IPAddress group; // group address
 	EtherAddress mac_group;
-	Vector<EtherAddress> receivers;
+	MulticastMembers receivers;
 };
 
-typedef Vector<EmpowerMulticastGroup> MulticastGroups;
+typedef HashTable<IPAddress, EmpowerMulticastGroup> MulticastGroups;
 typedef MulticastGroups::iterator MGIter;
 
-
 class EmpowerMulticastTable: public Element {
 public:
 
@@ -55,10 +105,9 @@ public:
 	const char *port_count() const { return PORTS_0_0; }
 
 	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
 	void add_handlers();
 
-	MulticastGroups multicastgroups;
-
 	EtherAddress ip_mcast_addr_to_mac(IPAddress ip) {
 
 		unsigned long ip_addr = ntohl(ip.addr());
@@ -78,12 +127,29 @@ public:
 	bool join_group(EtherAddress, IPAddress);
 	bool leave_group(EtherAddress, IPAddress);
 	bool leave_all_groups(EtherAddress);
-	Vector<EtherAddress> *get_receivers(EtherAddress);
+
+	const MulticastReceivers *receivers(EtherAddress mac_group) const {
+		const MulticastSlot *slot = _index.get(mac_group);
+		return slot ? slot->_receivers : 0;
+	}
+
+	const Vector<EtherAddress> *get_receivers(EtherAddress mac_group) const {
+		const MulticastReceivers *r = receivers(mac_group);
+		return r ? &r->_stas : 0;
+	}
 
 private:
 
+	MulticastGroups _groups;
+	// frees the receiver lists, slots and index tables replaced in _index
+	Reclaimer _reclaimer;
+	MulticastIndex _index;
+	uint32_t _version;
+
 	bool _debug;
 
+	void update_receivers(MulticastSlot *);
+
 	// Read/Write handlers
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
@@ -96,7 +96,7 @@ void EmpowerOpenAuthResponder::push(int, Packet *p) {
 
 	EtherAddress src = EtherAddress(w->i_addr2);
 
-    EmpowerStationState *ess = _el->get_ess(src);
+    const EmpowerStationState *ess = _el->get_ess(src);
 
     // If we're not aware of this LVAP, ignore
 	if (!ess) {
@@ -174,7 +174,7 @@ void EmpowerOpenAuthResponder::push(int, Packet *p) {
 
 void EmpowerOpenAuthResponder::send_auth_response(EtherAddress dst) {
 
-    EmpowerStationState *ess = _el->get_ess(dst);
+    const EmpowerStationState *ess = _el->get_ess(dst);
 	EtherAddress bssid = ess->_bssid;
 	int iface_id = ess->_iface_id;
 	uint16_t seq = 2;
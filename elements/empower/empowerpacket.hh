@@ -76,6 +76,10 @@ enum empower_packet_types {
     EMPOWER_PT_UCQM_RESPONSE = 0x27,                // wtp -> ac
     EMPOWER_PT_NCQM_REQUEST = 0x28,                 // ac -> wtp
     EMPOWER_PT_NCQM_RESPONSE = 0x29,                // wtp -> ac
+    EMPOWER_PT_UCQM_DELTA_REQUEST = 0x63,           // ac -> wtp
+    EMPOWER_PT_UCQM_DELTA_RESPONSE = 0x64,          // wtp -> ac
+    EMPOWER_PT_NCQM_DELTA_REQUEST = 0x65,           // ac -> wtp
+    EMPOWER_PT_NCQM_DELTA_RESPONSE = 0x66,          // wtp -> ac
 
     // wifi stats
     EMPOWER_PT_WIFI_STATS_REQUEST = 0x37,           // ac -> wtp
@@ -328,6 +332,10 @@ public:
     uint8_t channel()     { return _channel; }
     uint8_t band()        { return _band; }
     EtherAddress hwaddr() { return EtherAddress(_hwaddr); }
+    void set_graph_id(uint32_t graph_id) { _graph_id = htonl(graph_id); }
+    void set_channel(uint8_t channel)    { _channel = channel; }
+    void set_band(uint8_t band)          { _band = band; }
+    void set_hwaddr(EtherAddress hwaddr) { memcpy(_hwaddr, hwaddr.data(), 6); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* channel quality map entry format */
@@ -340,6 +348,7 @@ struct cqm_entry {
       uint32_t _hist_packets;   /* Total number of frames (int) */
       int8_t   _mov_rssi;       /* Moving RSSI computed across windows in dBm (int) */
   public:
+    EtherAddress sta()                              { return EtherAddress(_addr); }
     void set_sta(EtherAddress addr)                 { memcpy(_addr, addr.data(), 6); }
     void set_last_rssi_std(uint8_t last_rssi_std)   { _last_rssi_std = last_rssi_std; }
     void set_last_rssi_avg(int8_t last_rssi_avg)    { _last_rssi_avg = last_rssi_avg; }
@@ -355,8 +364,27 @@ private:
   uint8_t  _wtp[6];         /* EtherAddress */
   uint16_t _nb_entries;     /* Int */
 public:
+    uint32_t graph_id()                           { return ntohl(_graph_id); }
+    uint16_t nb_entries()                         { return ntohs(_nb_entries); }
+    void set_graph_id(uint32_t graph_id)          { _graph_id = htonl(graph_id); }
+    void set_wtp(EtherAddress wtp)                { memcpy(_wtp, wtp.data(), 6); }
+    void set_nb_entries(uint16_t nb_entries)      { _nb_entries = htons(nb_entries); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* channel quality map delta response packet format */
+struct empower_cqm_delta_response : public empower_header {
+private:
+  uint32_t _graph_id;       /* Module id (int) */
+  uint8_t  _wtp[6];         /* EtherAddress */
+  uint16_t _flags;          /* Flags (empower_cqm_flags) */
+  uint16_t _nb_entries;     /* Int */
+public:
+    uint32_t graph_id()                           { return ntohl(_graph_id); }
+    bool     flag(int f)                          { return ntohs(_flags) & f;  }
+    uint16_t nb_entries()                         { return ntohs(_nb_entries); }
     void set_graph_id(uint32_t graph_id)          { _graph_id = htonl(graph_id); }
     void set_wtp(EtherAddress wtp)                { memcpy(_wtp, wtp.data(), 6); }
+    void set_flag(uint16_t f)                     { _flags = htons(ntohs(_flags) | f); }
     void set_nb_entries(uint16_t nb_entries)      { _nb_entries = htons(nb_entries); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
@@ -368,6 +396,8 @@ private:
 public:
     uint32_t counters_id() { return ntohl(_counters_id); }
     EtherAddress sta()     { return EtherAddress(_sta); }
+    void set_counters_id(uint32_t counters_id) { _counters_id = htonl(counters_id); }
+    void set_sta(EtherAddress sta)             { memcpy(_sta, sta.data(), 6); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* counters response packet format */
@@ -379,6 +409,8 @@ private:
   uint16_t _nb_tx;          /* Int */
   uint16_t _nb_rx;          /* Int */
 public:
+    uint32_t counters_id()                     { return ntohl(_counters_id); }
+    EtherAddress sta()                         { return EtherAddress(_sta); }
     void set_wtp(EtherAddress wtp)             { memcpy(_wtp, wtp.data(), 6); }
     void set_sta(EtherAddress sta)             { memcpy(_sta, sta.data(), 6); }
     void set_nb_tx(uint16_t nb_tx)             { _nb_tx = htons(nb_tx); }
@@ -462,6 +494,17 @@ public:
     EtherAddress encap()            { return EtherAddress(_encap); }
     EtherAddress bssid()        	{ return EtherAddress(_bssid); }
     String       ssid()             { return String((char *) _ssid); }
+    void set_module_id(uint32_t module_id)          { _module_id = htonl(module_id); }
+    void set_flag(uint16_t f)                       { _flags = htons(ntohs(_flags) | f); }
+    void set_assoc_id(uint16_t assoc_id)            { _assoc_id = htons(assoc_id); }
+    void set_hwaddr(EtherAddress hwaddr)            { memcpy(_hwaddr, hwaddr.data(), 6); }
+    void set_channel(uint8_t channel)               { _channel = channel; }
+    void set_band(uint8_t band)                     { _band = band; }
+    void set_supported_band(uint8_t supported_band) { _supported_band = supported_band; }
+    void set_sta(EtherAddress sta)                  { memcpy(_sta, sta.data(), 6); }
+    void set_encap(EtherAddress encap)              { memcpy(_encap, encap.data(), 6); }
+    void set_bssid(EtherAddress bssid)              { memcpy(_bssid, bssid.data(), 6); }
+    void set_ssid(String ssid)                      { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length()); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* del lvap packet format */
@@ -478,6 +521,8 @@ struct empower_del_lvap : public empower_header {
     uint8_t csa_switch_mode()       { return _csa_switch_mode; }
     uint8_t csa_switch_count()      { return _csa_switch_count; }
     uint8_t csa_switch_channel()    { return _csa_switch_channel; }
+    void set_module_id(uint32_t module_id)  { _module_id = htonl(module_id); }
+    void set_sta(EtherAddress sta)          { memcpy(_sta, sta.data(), 6); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* lvap add/del response packet format */
@@ -488,6 +533,9 @@ private:
     uint32_t _module_id;        /* Transaction id */
     uint32_t _status;           /* Status code */
 public:
+    EtherAddress sta()                      { return EtherAddress(_sta); }
+    uint32_t module_id()                    { return ntohl(_module_id); }
+    uint32_t status()                       { return ntohl(_status); }
     void set_sta(EtherAddress sta)          { memcpy(_sta, sta.data(), 6); }
     void set_module_id(uint32_t module_id)  { _module_id = htonl(module_id); }
     void set_status(uint32_t status)        { _status = htonl(status); }
@@ -791,6 +839,13 @@ struct empower_set_slice : public empower_header {
     bool            flags(int f)    { return ntohs(_flags) & f; }
     uint8_t         dscp()          { return _dscp; }
     String 			ssid()          { return String((char *) _ssid); }
+    void set_flags(uint16_t f)              { _flags = htons(ntohs(_flags) | f); }
+    void set_hwaddr(EtherAddress hwaddr)    { memcpy(_hwaddr, hwaddr.data(), 6); }
+    void set_channel(uint8_t channel)       { _channel = channel; }
+    void set_band(uint8_t band)             { _band = band; }
+    void set_quantum(uint32_t quantum)      { _quantum = htonl(quantum); }
+    void set_dscp(uint8_t dscp)             { _dscp = dscp; }
+    void set_ssid(String ssid)              { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length()); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 struct empower_del_slice : public empower_header {
@@ -820,6 +875,8 @@ struct empower_status_slice : public empower_header {
     uint8_t     _dscp;              /* Traffic DSCP (int) */
     char        _ssid[WIFI_NWID_MAXSIZE+1];    /* Null terminated SSID */
   public:
+    uint8_t dscp()                          { return _dscp; }
+    String ssid()                           { return String((char *) _ssid); }
     void set_band(uint8_t band)             { _band = band; }
     void set_channel(uint8_t channel)       { _channel = channel; }
     void set_hwaddr(EtherAddress hwaddr)    { memcpy(_hwaddr, hwaddr.data(), 6); }
@@ -25,16 +25,22 @@
 #include <click/glue.hh>
 #include <clicknet/wifi.h>
 #include <click/packet_anno.hh>
+#include <click/router.hh>
+#include <click/routervisitor.hh>
 #include <clicknet/llc.h>
+#include <clicknet/ip.h>
 #include <elements/wifi/wirelessinfo.hh>
 #include <elements/wifi/transmissionpolicy.hh>
 #include <elements/wifi/minstrel.hh>
 #include <elements/wifi/bitrate.hh>
+#include <elements/userlevel/kerneltun.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
 EmpowerQOSManager::EmpowerQOSManager() :
-		_el(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0), _debug(false) {
+		_el(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0),
+		_encap_reallocs(0), _dup_frames(0), _dup_receivers(0), _payload_copies(0),
+		_payload_bytes(0), _lockfree(false), _debug(false) {
 }
 
 EmpowerQOSManager::~EmpowerQOSManager() {
@@ -48,11 +54,31 @@ int EmpowerQOSManager::configure(Vector<String> &conf,
 			.read_m("RC", ElementCastArg("Minstrel"), _rc)
 			.read_m("IFACE_ID", _iface_id)
 			.read("QUANTUM", _quantum)
+			.read("LOCKFREE", _lockfree)
 			.read("DEBUG", _debug)
 			.complete();
 
 }
 
+int EmpowerQOSManager::initialize(ErrorHandler *errh) {
+
+	// taps feeding this element must leave room for in place encapsulation
+	ElementCastTracker tracker(router(), "KernelTun");
+	router()->visit_upstream(this, 0, &tracker);
+
+	for (int i = 0; i < tracker.elements().size(); i++) {
+		KernelTun *tap = (KernelTun *) tracker.elements()[i]->cast("KernelTun");
+		if (tap->headroom() < SliceQueue::ENCAP_HEADROOM) {
+			return errh->error("%s HEADROOM %u is too small, at least %u bytes are needed",
+					tap->declaration().c_str(), tap->headroom(),
+					(unsigned) SliceQueue::ENCAP_HEADROOM);
+		}
+	}
+
+	return 0;
+
+}
+
 void * EmpowerQOSManager::cast(const char *n) {
 	if (strcmp(n, "EmpowerQOSManager") == 0)
 		return (EmpowerQOSManager *) this;
@@ -62,6 +88,18 @@ void * EmpowerQOSManager::cast(const char *n) {
 		return Element::cast(n);
 }
 
+// DSCP of an IPv4 frame, read from the Ethernet payload so that the
+// element needs no MarkIPHeader in front of it
+static int
+frame_dscp(const Packet *p) {
+	const click_ether *eh = (const click_ether *) p->data();
+	if (ntohs(eh->ether_type) != 0x0800 || p->length() < sizeof(click_ether) + sizeof(click_ip)) {
+		return 0;
+	}
+	const click_ip *ip = (const click_ip *) (p->data() + sizeof(click_ether));
+	return ip->ip_tos >> 2;
+}
+
 void
 EmpowerQOSManager::push(int, Packet *p) {
 
@@ -78,33 +116,26 @@ EmpowerQOSManager::push(int, Packet *p) {
 	Timestamp now = Timestamp::now();
 	p->set_timestamp_anno(now);
 
-	int dscp = 0;
-	uint8_t iface_id = PAINT_ANNO(p);
+	int dscp = frame_dscp(p);
+	int iface_id = _iface_id;
 
 	click_ether *eh = (click_ether *) p->data();
 
-	if (ntohs(eh->ether_type) == 0x0800) {
-		const click_ip *ip = p->ip_header();
-		dscp = ip->ip_tos >> 2;
-	}
-
 	EtherAddress dst = EtherAddress(eh->ether_dhost);
 
 	// If traffic is unicast we need to check if the lvap is active
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
+		const EmpowerStationState *ess = _el->get_ess(dst);
 		if (!ess) {
 			p->kill();
 			return;
 		}
-		_el->lock()->acquire_read();
 		if (!ess->is_valid(iface_id)){
 			p->kill();
 		} else {
 	        _el->get_txp(ess->_sta)->update_tx(p->length());
 	        store(ess->_ssid, dscp, p, dst, ess->_bssid);
 		}
-		_el->lock()->release_read();
 		return;
 	}
 
@@ -115,32 +146,26 @@ EmpowerQOSManager::push(int, Packet *p) {
 		 * and use unicast destination addresses.
 		 */
 
-		Vector<EtherAddress> *mcast_receivers = _el->get_mcast_receivers(dst);
+		const Vector<EtherAddress> *mcast_receivers = _el->get_mcast_receivers(dst);
 
 		if (!mcast_receivers) {
 			p->kill();
 			return;
 		}
 
-		Vector<EtherAddress>::iterator itr;
+		DupReceiver last;
+		const StationIndex *stations = _el->stations();
+
+		Vector<EtherAddress>::const_iterator itr;
 		for (itr = mcast_receivers->begin(); itr != mcast_receivers->end(); itr++) {
-			EmpowerStationState * ess = _el->lvaps()->get_pointer(*itr);
-			if (!ess) {
-				continue;
+			const EmpowerStationState *ess = stations->lvap(*itr);
+			if (ess && ess->is_valid(iface_id)) {
+				duplicate(p, dscp, last, ess->_ssid, *itr, ess->_bssid);
 			}
-			_el->lock()->acquire_read();
-			if (!ess->is_valid(iface_id)){
-				continue;
-			} else {
-				Packet *q = p->clone();
-				if (!q) {
-					continue;
-				}
-				store(ess->_ssid, dscp, q, *itr, ess->_bssid);
-			}
-			_el->lock()->release_read();
 		}
 
+		duplicate_last(p, dscp, last);
+
 	} else {
 
 		/*
@@ -172,7 +197,7 @@ EmpowerQOSManager::push(int, Packet *p) {
 			 * multicast receptors that subscribed that multicast group.
 			 */
 
-			Vector<EtherAddress> *mcast_receivers = _el->get_mcast_receivers(dst);
+			const Vector<EtherAddress> *mcast_receivers = _el->get_mcast_receivers(dst);
 
 			if (!mcast_receivers) {
 				p->kill();
@@ -185,15 +210,14 @@ EmpowerQOSManager::push(int, Packet *p) {
 			}
 
 			EtherAddress sta = mcast_receivers->front();
-			EmpowerStationState *first = _el->lvaps()->get_pointer(sta);
+			const EmpowerStationState *first = _el->get_ess(sta);
 
 			if (!first) {
 				p->kill();
 				return;
 			}
 
-			Packet *q = p->clone();
-			store(first->_ssid, dscp, q, dst, first->_bssid);
+			store(first->_ssid, dscp, p, dst, first->_bssid);
 
 		} else {
 
@@ -201,42 +225,155 @@ EmpowerQOSManager::push(int, Packet *p) {
 			 * destination, all of the lvaps and vaps have to receive it.
 			 */
 
-			// handle unique LVAPs
-			_el->lock()->acquire_read();
-			for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
-				if (!it.value().is_valid(iface_id)) {
-					continue;
-				}
-				if (!_el->is_unique_lvap(it.value()._sta)) {
+			DupReceiver last;
+			const StationIndex *stations = _el->stations();
+
+			// handle unique LVAPs, the shared ones are served by their VAP
+			for (LVAPIndexIter it = stations->_lvaps.begin(); it.live(); it++) {
+				const EmpowerStationState *ess = it.value();
+				if (!ess->is_valid(iface_id)) {
 					continue;
 				}
-				Packet *q = p->clone();
-				if (!q) {
+				if (stations->vap(ess->_bssid)) {
 					continue;
 				}
-				store(it.value()._ssid, dscp, q, it.value()._sta, it.value()._bssid);
+				duplicate(p, dscp, last, ess->_ssid, ess->_sta, ess->_bssid);
 			}
-			_el->lock()->release_read();
 
 			// handle VAPs
-			for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-				if (it.value()._iface_id != iface_id) {
+			for (VAPIndexIter it = stations->_vaps.begin(); it.live(); it++) {
+				const EmpowerVAPState *evs = it.value();
+				if (evs->_iface_id != iface_id) {
 					continue;
 				}
-				Packet *q = p->clone();
-				store(it.value()._ssid, dscp, q, dst, it.value()._bssid);
+				duplicate(p, dscp, last, evs->_ssid, dst, evs->_bssid);
 			}
+
+			duplicate_last(p, dscp, last);
 		}
 	}
 
-	p->kill();
-	return;
+}
+
+void EmpowerQOSManager::push_batch(Packet *head) {
+
+	Timestamp now = Timestamp::now();
+	Packet *group_head = 0, *group_tail = 0;
+
+	EtherAddress last_dst;
+	const EmpowerStationState *ess = 0;
+	TxPolicyInfo *txp = 0;
+
+	const StationIndex *stations = _el->stations();
+
+	lock_queues();
+
+	while (Packet *p = head) {
+
+		head = p->next();
+		p->set_next(0);
+
+		if (p->length() < sizeof(struct click_ether)) {
+			click_chatter("%{element} :: %s :: packet too small: %d vs %d",
+					      this,
+					      __func__,
+					      p->length(),
+					      sizeof(struct click_ether));
+			p->kill();
+			continue;
+		}
+
+		p->set_timestamp_anno(now);
+
+		int dscp = frame_dscp(p);
+		click_ether *eh = (click_ether *) p->data();
+
+		EtherAddress dst = EtherAddress(eh->ether_dhost);
+
+		// group addressed frames take the per packet path below
+		if (dst.is_broadcast() || dst.is_group()) {
+			if (group_head) {
+				group_tail->set_next(p);
+			} else {
+				group_head = p;
+			}
+			group_tail = p;
+			continue;
+		}
+
+		if (!ess || dst != last_dst) {
+			ess = stations->lvap(dst);
+			txp = ess ? _el->get_txp(ess->_sta) : 0;
+			last_dst = dst;
+		}
+
+		if (!ess || !ess->is_valid(_iface_id)) {
+			p->kill();
+			continue;
+		}
+
+		txp->update_tx(p->length());
+		enqueue(ess->_ssid, dscp, p, dst, ess->_bssid);
+
+	}
+
+	unlock_queues();
+
+	while (Packet *p = group_head) {
+		group_head = p->next();
+		p->set_next(0);
+		push(0, p);
+	}
+
+}
+
+void EmpowerQOSManager::duplicate(Packet *p, int dscp, DupReceiver &last, String ssid, EtherAddress ra, EtherAddress ta) {
+	// the previous receiver is not the last one, queue a clone for it
+	if (last._valid) {
+		Packet *q = p->clone();
+		if (q) {
+			last._clones++;
+			store(last._ssid, dscp, q, last._ra, last._ta);
+		}
+	}
+	last._ssid = ssid;
+	last._ra = ra;
+	last._ta = ta;
+	last._valid = true;
+}
 
+void EmpowerQOSManager::duplicate_last(Packet *p, int dscp, DupReceiver &last) {
+	// the last receiver gets the original, which is no longer shared once
+	// the clones queued before it have been sent
+	if (!last._valid) {
+		p->kill();
+		return;
+	}
+	// a frame with a single receiver was never duplicated
+	if (last._clones) {
+		_dup_frames++;
+		_dup_receivers += last._clones + 1;
+	}
+	store(last._ssid, dscp, p, last._ra, last._ta);
 }
 
 void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
+	lock_queues();
+	enqueue(ssid, dscp, q, ra, ta);
+	unlock_queues();
+}
 
-	_lock.acquire_write();
+const AirtimeTable *EmpowerQOSManager::airtime(AggregationQueue *queue) {
+	// the cached table cannot be freed before the generation moves on
+	uint32_t generation = _rc->airtime_generation();
+	if (!queue->_airtime || queue->_airtime_generation != generation) {
+		queue->_airtime = _rc->airtime(queue->pair()._ra);
+		queue->_airtime_generation = generation;
+	}
+	return queue->_airtime;
+}
+
+void EmpowerQOSManager::enqueue(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
 
 	Slice slice = Slice(ssid, dscp);
 	SliceQueue *sliceq = 0;
@@ -247,10 +384,40 @@ void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra,
 	}
 
 	sliceq = _slices.get(slice);
+	AggregationQueue *queue = _lockfree ? sliceq->find(ra, ta) : sliceq->queue(ra, ta);
+
+	if (!queue) {
+		// lockfree mode: the lock is only held for reading, adding the
+		// queue of a new station needs it for writing
+		_lock.release_read();
+		_lock.acquire_write();
+		if ((sliceq = _slices.get(slice))) {
+			sliceq->queue(ra, ta);
+		}
+		_lock.release_write();
+		_lock.acquire_read();
+		// the slice may have been deleted meanwhile
+		sliceq = _slices.get(slice);
+		queue = sliceq ? sliceq->find(ra, ta) : 0;
+		if (!queue) {
+			q->kill();
+			return;
+		}
+	}
+
+	// cost the frame once, as it will leave the queue after encapsulation
+	SET_AIRTIME_ANNO(q, airtime(queue)->usecs(q->length() + SliceQueue::ENCAP_HEADROOM));
 
-	if (sliceq->enqueue(q, ra, ta)) {
-		// check if queue was empty and no packet in buffer
-		if (sliceq->size() == 1 && _head_table.find(slice).value() == 0) {
+	if (sliceq->enqueue(q, queue)) {
+		if (_lockfree) {
+			// hand the queue over to pull() if it was idle
+			if (queue->schedule()) {
+				_pending_lock.acquire();
+				_pending.push_back(queue);
+				_pending_lock.release();
+			}
+		} else if (sliceq->size() == 1 && _head_table.find(slice).value() == 0) {
+			// check if queue was empty and no packet in buffer
 			sliceq->_deficit = 0;
 			_active_list.push_back(slice);
 		}
@@ -262,20 +429,30 @@ void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra,
 		q->kill();
 	}
 
-	_lock.release_write();
-
 }
 
-Packet * EmpowerQOSManager::pull(int) {
+void EmpowerQOSManager::schedule_pending() {
+
+	_pending_lock.acquire();
+	_pending.swap(_scheduling);
+	_pending_lock.release();
 
-	if (_active_list.empty()) {
-		if (++_sleepiness == SLEEPINESS_TRIGGER) {
-			_empty_note.sleep();
+	for (int i = 0; i < _scheduling.size(); i++) {
+		AggregationQueue *queue = _scheduling[i];
+		SliceQueue *sliceq = queue->_slice_queue;
+		// an idle slice joins the round as in enqueue()
+		if (!sliceq->backlogged() && _head_table.get(sliceq->_slice) == 0) {
+			sliceq->_deficit = 0;
+			_active_list.push_back(sliceq->_slice);
 		}
-		return 0;
+		sliceq->_active_list.push_back(queue);
 	}
 
-	_lock.acquire_write();
+	_scheduling.clear();
+
+}
+
+Packet * EmpowerQOSManager::next_frame() {
 
 	Slice slice = _active_list[0];
 	_active_list.pop_front();
@@ -294,16 +471,15 @@ Packet * EmpowerQOSManager::pull(int) {
 
 	if (!p) {
 		queue->_deficit = 0;
-	} else if (_rc->estimate_usecs_wifi_packet(p) <= queue->_deficit) {
-		uint32_t deficit = _rc->estimate_usecs_wifi_packet(p);
+	} else if (AIRTIME_ANNO(p) <= queue->_deficit) {
+		uint32_t deficit = AIRTIME_ANNO(p);
 		queue->_deficit -= deficit;
 		queue->_deficit_used += deficit;
 		queue->_tx_bytes += p->length();
 		queue->_tx_packets++;
-		if (queue->size() > 0) {
+		if (queue->backlogged()) {
 			_active_list.push_front(slice);
 		}
-		_lock.release_write();
 		return p;
 	} else {
 		_head_table.set(slice, p);
@@ -311,9 +487,40 @@ Packet * EmpowerQOSManager::pull(int) {
 		queue->_deficit += queue->_quantum;
 	}
 
-	_lock.release_write();
-
 	return 0;
+
+}
+
+Packet * EmpowerQOSManager::pull(int) {
+
+	lock_queues();
+
+	if (_lockfree) {
+		schedule_pending();
+	}
+
+	bool idle = _active_list.empty();
+	Packet *p = idle ? 0 : next_frame();
+
+	unlock_queues();
+
+	if (idle && ++_sleepiness == SLEEPINESS_TRIGGER) {
+		_empty_note.sleep();
+#if HAVE_MULTITHREAD
+		// a station queue handed over after the check above may have
+		// been woken up for already, undo the sleep
+		if (_lockfree) {
+			_pending_lock.acquire();
+			if (!_pending.empty()) {
+				_empty_note.wake();
+			}
+			_pending_lock.release();
+		}
+#endif
+	}
+
+	return p;
+
 }
 
 void EmpowerQOSManager::set_default_slice(String ssid) {
@@ -334,7 +541,7 @@ void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool
 						  amsdu_aggregation ? "yes." : "no");
 		}
 		uint32_t tr_quantum = (quantum == 0) ? _quantum : quantum;
-		SliceQueue *queue = new SliceQueue(slice, _capacity, tr_quantum, amsdu_aggregation);
+		SliceQueue *queue = new SliceQueue(slice, _capacity, tr_quantum, amsdu_aggregation, _lockfree);
 		_slices.set(slice, queue);
 		_head_table.set(slice, 0);
 		_el->send_status_slice(ssid, dscp, _iface_id);
@@ -372,6 +579,22 @@ void EmpowerQOSManager::del_slice(String ssid, int dscp) {
 		return;
 	}
 	SliceQueue *sliceq = itr.value();
+
+	// forget the station queues handed over to pull() but not scheduled yet
+	_pending_lock.acquire();
+	for (int i = 0; i < _pending.size(); ) {
+		if (_pending[i]->_slice_queue == sliceq) {
+			_pending[i] = _pending.back();
+			_pending.pop_back();
+		} else {
+			i++;
+		}
+	}
+	_pending_lock.release();
+
+	_encap_reallocs += sliceq->_encap_reallocs;
+	_payload_copies += sliceq->_payload_copies;
+	_payload_bytes += sliceq->_payload_bytes;
 	delete sliceq;
 	_slices.erase(itr);
 
@@ -399,7 +622,7 @@ String EmpowerQOSManager::list_slices() {
 }
 
 enum {
-	H_DEBUG, H_SLICES
+	H_DEBUG, H_SLICES, H_LOCKFREE, H_ENCAP_REALLOCS, H_DUPLICATION
 };
 
 String EmpowerQOSManager::read_handler(Element *e, void *thunk) {
@@ -409,6 +632,39 @@ String EmpowerQOSManager::read_handler(Element *e, void *thunk) {
 		return (td->list_slices());
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_LOCKFREE:
+		return String(td->_lockfree) + "\n";
+	case H_ENCAP_REALLOCS: {
+		uint32_t reallocs = td->_encap_reallocs;
+		td->_lock.acquire_read();
+		for (SIter it = td->_slices.begin(); it != td->_slices.end(); it++) {
+			reallocs += it.value()->_encap_reallocs;
+		}
+		td->_lock.release_read();
+		return String(reallocs) + "\n";
+	}
+	case H_DUPLICATION: {
+		uint32_t copies = td->_payload_copies;
+		uint64_t bytes = td->_payload_bytes;
+		td->_lock.acquire_read();
+		for (SIter it = td->_slices.begin(); it != td->_slices.end(); it++) {
+			copies += it.value()->_payload_copies;
+			bytes += it.value()->_payload_bytes;
+		}
+		td->_lock.release_read();
+		// a clone per receiver would have copied the frame for every
+		// receiver but the first, shared payloads are only copied when
+		// still shared at dequeue
+		uint32_t clones = td->_dup_receivers - td->_dup_frames;
+		uint32_t avoided = clones > copies ? clones - copies : 0;
+		StringAccum sa;
+		sa << "frames " << td->_dup_frames
+		   << " receivers " << td->_dup_receivers
+		   << " payload_copies " << copies
+		   << " copies_avoided " << avoided
+		   << " bytes_copied " << bytes << "\n";
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -432,6 +688,9 @@ int EmpowerQOSManager::write_handler(const String &in_s, Element *e, void *vpara
 void EmpowerQOSManager::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
 	add_read_handler("slices", read_handler, (void *) H_SLICES);
+	add_read_handler("lockfree", read_handler, (void *) H_LOCKFREE);
+	add_read_handler("encap_reallocs", read_handler, (void *) H_ENCAP_REALLOCS);
+	add_read_handler("duplication", read_handler, (void *) H_DUPLICATION);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
@@ -10,6 +10,8 @@
 #include <click/hashmap.hh>
 #include <click/hashtable.hh>
 #include <click/straccum.hh>
+#include <click/list.hh>
+#include <click/standard/storage.hh>
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
 #include <elements/standard/simplequeue.hh>
@@ -18,7 +20,7 @@ CLICK_DECLS
 /*
 =c
 
-EmpowerQOSManager(EL, DEBUG)
+EmpowerQOSManager(EL, RC, IFACE_ID[, I<KEYWORDS>])
 
 =s EmPOWER
 
@@ -37,11 +39,72 @@ Arguments are:
 =item EL
 An EmpowerLVAPManager element
 
+=item RC
+A Minstrel element
+
+=item IFACE_ID
+The interface id
+
+=item QUANTUM
+Default DRR quantum (in usec), default is 1470
+
+=item LOCKFREE
+Use single-producer/single-consumer rings for the per-station
+aggregation queues instead of locking them, default is false
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+Frames are encapsulated in place: the 802.11 and LLC headers overwrite the
+Ethernet header and take 18 more bytes from the packet headroom. At
+initialization the element checks the HEADROOM of every KernelTap upstream of
+it and refuses to start if it is smaller than that. Frames without enough
+headroom are reallocated; the I<encap_reallocs> handler reports how many
+times this happened.
+
+Group addressed frames duplicated for several receivers (DMS, or broadcast
+to LVAPs and VAPs) are queued as clones sharing one payload buffer, the last
+receiver gets the original packet. A frame that is still shared when it is
+dequeued gets a fresh buffer holding its own 802.11 header followed by a copy
+of the payload only; the last user of the buffer is encapsulated in place.
+Usually every clone is dequeued while the buffer is still shared, so a frame
+for N receivers still costs N-1 payload copies, as many as a clone per
+receiver would: the savings are then limited to the headroom and tailroom,
+which are not copied. The I<duplication> handler reports the frames queued
+for more than one receiver, the receivers they were queued for, the payload
+copies made, the copies avoided and the payload bytes copied. A copy is
+avoided for every receiver beyond the first whose frame no longer shared its
+payload when dequeued, which a clone per receiver would have copied.
+
+The DRR deficit is charged with the airtime of each frame at the current
+max throughput rate of its receiver. The cost is looked up in the Minstrel
+airtime table when the frame is queued and kept in the AIRTIME annotation,
+so dequeueing involves no rate computation. Every station queue keeps a
+pointer to the airtime table of its receiver and fetches it again from the
+Minstrel element only after the tables have changed, so queueing a frame
+does not take the Minstrel lock.
+
+Bursts handed over by EmpowerTee through push_batch() are processed with a
+single acquisition of the LVAP and slice locks. Unicast frames for the same
+station reuse one LVAP lookup; group addressed frames fall back to the per
+packet path. The DSCP is read from the IP header that follows the Ethernet
+header and the interface is IFACE_ID, so the element needs no MarkIPHeader or
+Paint in front of it.
+
+With LOCKFREE a single thread may push frames and a single thread may pull
+them. Neither holds the element lock for writing: both take it for reading,
+which only keeps slices and station queues from being deleted under them, and
+the station queues need no lock of their own. Station queues and the DRR
+state belong to the thread calling pull(). A station queue that receives a
+frame while idle is handed over to it through a short list guarded by a
+spinlock, so the producer never touches the active lists. Creating the queue
+of a new station and changing the slices still take the lock for writing.
+
+=h lockfree read-only
+Whether the station queues are single-producer/single-consumer rings.
+
 =a EmpowerWifiDecap
 */
 
@@ -80,34 +143,55 @@ class EtherPair {
 
 };
 
-class AggregationQueue {
+class AirtimeTable;
+class SliceQueue;
+
+class AggregationQueue : public Storage {
 
 public:
 
-	AggregationQueue(uint32_t capacity, EtherPair pair) {
-		_q = new Packet*[capacity];
-		_capacity = capacity;
+	List_member<AggregationQueue> _active_link;
+
+	// slice the queue belongs to, and in lockfree mode whether the
+	// consumer has the queue in its active list or is about to
+	SliceQueue *_slice_queue;
+	atomic_uint32_t _scheduled;
+
+	// airtime table of the receiver, valid for as long as the Minstrel
+	// airtime generation it was fetched at is current
+	const AirtimeTable *_airtime;
+	uint32_t _airtime_generation;
+
+	AggregationQueue(uint32_t capacity, EtherPair pair, SliceQueue *slice_queue, bool lockfree) {
+		_q = new Packet*[capacity + 1];
+		set_capacity(capacity);
 		_pair = pair;
-		_nb_pkts = 0;
 		_drops = 0;
-		_head = 0;
-		_tail = 0;
-		for (unsigned i = 0; i < _capacity; i++) {
+		_lockfree = lockfree;
+		_slice_queue = slice_queue;
+		_scheduled = 0;
+		_airtime = 0;
+		_airtime_generation = 0;
+		for (unsigned i = 0; i <= capacity; i++) {
 			_q[i] = 0;
 		}
 	}
 
 	String unparse() {
 		StringAccum result;
-		_queue_lock.acquire_read();
-		result << _pair.unparse() << " -> status: " << _nb_pkts << "/" << _capacity << "\n";
-		_queue_lock.release_read();
+		if (!_lockfree) {
+			_queue_lock.acquire_read();
+		}
+		result << _pair.unparse() << " -> status: " << nb_pkts() << "/" << capacity() << "\n";
+		if (!_lockfree) {
+			_queue_lock.release_read();
+		}
 		return result.take_string();
 	}
 
 	~AggregationQueue() {
 		_queue_lock.acquire_write();
-		for (uint32_t i = 0; i < _capacity; i++) {
+		for (int i = 0; i <= capacity(); i++) {
 			if (_q[i]) {
 				_q[i]->kill();
 			}
@@ -116,71 +200,103 @@ public:
 		_queue_lock.release_write();
 	}
 
+	// In lockfree mode the queue is a single-producer/single-consumer
+	// ring: only push() moves the tail and only pull() moves the head,
+	// the Storage barriers order the slot accesses.
 	Packet* pull() {
 		Packet* p = 0;
-		_queue_lock.acquire_write();
-		if (_nb_pkts > 0) {
-			p = _q[_head];
-			_q[_head] = 0;
-			_head++;
-			_head %= _capacity;
-			_nb_pkts--;
+		if (!_lockfree) {
+			_queue_lock.acquire_write();
+		}
+		Storage::index_type h = head();
+		if (h != tail()) {
+			p = _q[h];
+			_q[h] = 0;
+			set_head(next_i(h));
+		}
+		if (!_lockfree) {
+			_queue_lock.release_write();
 		}
-		_queue_lock.release_write();
 		return p;
 	}
 
 	bool push(Packet* p) {
 		bool result = false;
-		_queue_lock.acquire_write();
-		if (_nb_pkts == _capacity) {
+		if (!_lockfree) {
+			_queue_lock.acquire_write();
+		}
+		Storage::index_type t = tail(), nt = next_i(t);
+		if (nt == head()) {
 			_drops++;
 			result = false;
 		} else {
-			_q[_tail] = p;
-			_tail++;
-			_tail %= _capacity;
-			_nb_pkts++;
+			_q[t] = p;
+			set_tail(nt);
 			result = true;
 		}
-		_queue_lock.release_write();
+		if (!_lockfree) {
+			_queue_lock.release_write();
+		}
 		return result;
 	}
 
-    const Packet* top() {
-      Packet* p = 0;
-      _queue_lock.acquire_write();
-      if(_head != _tail) {
-        p = _q[(_head+1) % _capacity];
-      }
-      _queue_lock.release_write();
-      return p;
-    }
+	const Packet* top() {
+		Packet* p = 0;
+		if (!_lockfree) {
+			_queue_lock.acquire_read();
+		}
+		Storage::index_type h = head();
+		if (h != tail()) {
+			p = _q[h];
+		}
+		if (!_lockfree) {
+			_queue_lock.release_read();
+		}
+		return p;
+	}
+
+	// Lockfree mode, producer side: returns true if the queue was idle and
+	// has to be handed over to the consumer.
+	bool schedule() {
+		return _scheduled.compare_swap(0, 1) == 0;
+	}
+
+	// Lockfree mode, consumer side: gives up a drained queue. A frame
+	// pushed in the meantime found the queue still scheduled, so the ring
+	// is checked again once the flag is clear; returns true if the queue
+	// has to stay in the active list.
+	bool unschedule() {
+		_scheduled = 0;
+		click_fence();
+		return nb_pkts() > 0 && schedule();
+	}
 
 	uint32_t top_length() {
-		return top()->length();
+		const Packet *p = top();
+		return p ? p->length() : 0;
 	}
 
-    uint32_t nb_pkts() { return _nb_pkts; }
-    EtherPair pair() { return _pair; }
+	uint32_t nb_pkts() { return size(); }
+	uint32_t drops() { return _drops; }
+	bool lockfree() { return _lockfree; }
+	EtherPair pair() { return _pair; }
 
 private:
 
 	ReadWriteLock _queue_lock;
-	Packet** _q;
+	Packet* volatile * _q;
 
-	uint32_t _capacity;
 	EtherPair _pair;
-	uint32_t _nb_pkts;
 	uint32_t _drops;
-	uint32_t _head;
-	uint32_t _tail;
+	bool _lockfree;
 
 };
 
 typedef HashTable<EtherPair, AggregationQueue*> AggregationQueues;
 typedef AggregationQueues::iterator AQIter;
 
+typedef List<AggregationQueue, &AggregationQueue::_active_link> ActiveQueues;
+
 class Slice {
   public:
 
@@ -213,12 +329,27 @@ class Slice {
 
 };
 
+// A receiver of a duplicated group addressed frame whose copy is not queued yet
+class DupReceiver {
+public:
+	String _ssid;
+	EtherAddress _ra;
+	EtherAddress _ta;
+	bool _valid;
+	uint32_t _clones;
+	DupReceiver() : _valid(false), _clones(0) {
+	}
+};
+
 class SliceQueue {
 
 public:
 
+	// bytes the 802.11 and LLC headers need on top of the Ethernet header
+	enum { ENCAP_HEADROOM = sizeof(click_wifi) + sizeof(click_llc) - sizeof(click_ether) };
+
     AggregationQueues _queues;
-	Vector<EtherPair> _active_list;
+	ActiveQueues _active_list;
 
 	Slice _slice;
     uint32_t _capacity;
@@ -232,14 +363,20 @@ public:
     uint32_t _max_queue_length;
     uint32_t _tx_packets;
     uint32_t _tx_bytes;
+    uint32_t _encap_reallocs;
+    uint32_t _payload_copies;
+    uint64_t _payload_bytes;
+    bool _lockfree;
 
-    SliceQueue(Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation) :
+    SliceQueue(Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, bool lockfree) :
 			_slice(slice), _capacity(capacity), _size(0), _drops(0), _deficit(0),
 			_quantum(quantum), _amsdu_aggregation(amsdu_aggregation), _max_aggr_length(7935),
-			_deficit_used(0), _max_queue_length(0), _tx_packets(0), _tx_bytes(0) {
+			_deficit_used(0), _max_queue_length(0), _tx_packets(0), _tx_bytes(0),
+			_encap_reallocs(0), _payload_copies(0), _payload_bytes(0), _lockfree(lockfree) {
 	}
 
 	~SliceQueue() {
+		_active_list.clear();
 		AQIter itr = _queues.begin();
 		while (itr != _queues.end()) {
 			AggregationQueue *aq = itr.value();
@@ -251,37 +388,64 @@ public:
 
 	uint32_t size() { return _size; }
 
-    Packet * wifi_encap(Packet *p, EtherAddress ra, EtherAddress sa, EtherAddress ta) {
+	// whether a station queue of the slice holds a frame, in lockfree mode
+	// the frame counter is not kept and the consumer asks its active list
+	bool backlogged() { return _lockfree ? !_active_list.empty() : _size > 0; }
 
-        WritablePacket *q = p->uniqueify();
+    WritablePacket * wifi_encap_copy(Packet *p) {
 
-		if (!q) {
-			return 0;
+		// ethertype and payload, the Ethernet addresses are dropped
+		uint32_t len = p->length() - 2 * sizeof(EtherAddress);
+		// leave the room an in place encapsulation would have left
+		uint32_t headroom = Packet::default_headroom;
+		if (p->headroom() > headroom + ENCAP_HEADROOM) {
+			headroom = p->headroom() - ENCAP_HEADROOM;
 		}
 
-		uint8_t mode = WIFI_FC1_DIR_FROMDS;
-		uint16_t ethtype;
+		WritablePacket *q = Packet::make(headroom, 0, sizeof(click_wifi) + WIFI_LLC_HEADER_LEN + len, 0);
 
-		memcpy(&ethtype, q->data() + 12, 2);
+		if (q) {
+			q->copy_annotations(p);
+			memcpy(q->data() + sizeof(click_wifi) + WIFI_LLC_HEADER_LEN, p->data() + 2 * sizeof(EtherAddress), len);
+			_payload_copies++;
+			_payload_bytes += len;
+		}
 
-		q->pull(sizeof(struct click_ether));
-		q = q->push(sizeof(struct click_llc));
+		p->kill();
+		return q;
 
-		if (!q) {
-			q->kill();
-			return 0;
-		}
+	}
 
-		memcpy(q->data(), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
-		memcpy(q->data() + 6, &ethtype, 2);
+    Packet * wifi_encap(Packet *p, EtherAddress ra, EtherAddress sa, EtherAddress ta) {
 
-		q = q->push(sizeof(struct click_wifi));
+		WritablePacket *q;
+
+		if (p->shared()) {
+			// Duplicated group frame: the payload buffer is shared with the
+			// copies queued for the other receivers. Give this receiver a
+			// private header area and copy only the payload behind it,
+			// instead of letting push() copy the whole buffer with its
+			// headroom and tailroom. The payload is still copied once per
+			// receiver whose frame leaves before the last one.
+			q = wifi_encap_copy(p);
+		} else {
+			// Fast path: the 802.11 and LLC headers are written in place over
+			// the Ethernet header. The ethertype already sits where the LLC
+			// header expects it, so no payload byte is moved.
+			if (p->headroom() < ENCAP_HEADROOM) {
+				_encap_reallocs++;
+			}
+			q = p->push(ENCAP_HEADROOM);
+		}
 
 		if (!q) {
-			q->kill();
 			return 0;
 		}
 
+		uint8_t mode = WIFI_FC1_DIR_FROMDS;
+
+		memcpy(q->data() + sizeof(struct click_wifi), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
+
 		struct click_wifi *w = (struct click_wifi *) q->data();
 
 		memset(q->data(), 0, sizeof(click_wifi));
@@ -298,25 +462,42 @@ public:
 
     }
 
-    bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
+    AggregationQueue *find(EtherAddress ra, EtherAddress ta) {
+		return _queues.get(EtherPair(ra, ta));
+    }
+
+    AggregationQueue *queue(EtherAddress ra, EtherAddress ta) {
 
     	EtherPair pair = EtherPair(ra, ta);
+		AggregationQueue *queue = _queues.get(pair);
 
-		if (_queues.find(pair) == _queues.end()) {
-			AggregationQueue *queue = new AggregationQueue(_capacity, pair);
+		if (!queue) {
+			queue = new AggregationQueue(_capacity, pair, this, _lockfree);
 			_queues.set(pair, queue);
-			_active_list.push_back(pair);
 		}
 
-		AggregationQueue *queue = _queues.get(pair);
+		return queue;
+
+    }
+
+    bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
+		return enqueue(p, queue(ra, ta));
+    }
+
+    bool enqueue(Packet *p, AggregationQueue *queue) {
 
 		if (queue->push(p)) {
-			// check if ra is in active list
-			if (find(_active_list.begin(), _active_list.end(), pair) == _active_list.end()) {
-				_active_list.push_back(pair);
-			}
 			if (queue->nb_pkts() > _max_queue_length) {
 				_max_queue_length = queue->nb_pkts();
+			}
+			// in lockfree mode the active list belongs to the consumer,
+			// which gets the queue from EmpowerQOSManager::schedule_pending()
+			if (_lockfree) {
+				return true;
+			}
+			// the station becomes active with its first queued frame
+			if (_active_list.isolated(queue)) {
+				_active_list.push_back(queue);
 			}
 			 _size++;
 			return true;
@@ -329,30 +510,36 @@ public:
 
     Packet *dequeue() {
 
-		if (_active_list.empty()) {
-			return 0;
-		}
+		while (!_active_list.empty()) {
 
-		EtherPair pair = _active_list[0];
-		_active_list.pop_front();
+			AggregationQueue* queue = _active_list.front();
+			_active_list.pop_front();
 
-		AQIter active = _queues.find(pair);
-		AggregationQueue* queue = active.value();
-		Packet *p = queue->pull();
+			Packet *p = queue->pull();
 
-		if (!p) {
-			return dequeue();
-		}
+			// drained queues leave the active list until the next enqueue
+			if (!p) {
+				if (_lockfree && queue->unschedule()) {
+					_active_list.push_back(queue);
+				}
+				continue;
+			}
 
-		_size--;
+			if (!_lockfree) {
+				_size--;
+			}
 
-		click_ether *eh = (click_ether *) p->data();
-		EtherAddress src = EtherAddress(eh->ether_shost);
-		p = wifi_encap(p, queue->pair()._ra, src, queue->pair()._ta);
+			if (queue->nb_pkts() > 0 || (_lockfree && queue->unschedule())) {
+				_active_list.push_back(queue);
+			}
 
-		_active_list.push_back(pair);
+			click_ether *eh = (click_ether *) p->data();
+			EtherAddress src = EtherAddress(eh->ether_shost);
+			return wifi_encap(p, queue->pair()._ra, src, queue->pair()._ta);
 
-		return p;
+		}
+
+		return 0;
 
     }
 
@@ -389,8 +576,10 @@ public:
     void *cast(const char *);
 
 	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
 
 	void push(int, Packet *);
+	void push_batch(Packet *);
 	Packet *pull(int);
 
 	void add_handlers();
@@ -404,6 +593,11 @@ private:
 
 	ReadWriteLock _lock;
 
+	// lockfree mode, station queues handed over by the producer
+	Spinlock _pending_lock;
+	Vector<AggregationQueue *> _pending;
+	Vector<AggregationQueue *> _scheduling;
+
     enum { SLEEPINESS_TRIGGER = 9 };
 
     ActiveNotifier _empty_note;
@@ -420,9 +614,40 @@ private:
 
     int _iface_id;
 
+    uint32_t _encap_reallocs;
+
+    uint32_t _dup_frames;
+    uint32_t _dup_receivers;
+    uint32_t _payload_copies;
+    uint64_t _payload_bytes;
+
+    bool _lockfree;
     bool _debug;
 
+	// the element lock is only read locked by the datapath in lockfree mode
+	void lock_queues() {
+		if (_lockfree) {
+			_lock.acquire_read();
+		} else {
+			_lock.acquire_write();
+		}
+	}
+
+	void unlock_queues() {
+		if (_lockfree) {
+			_lock.release_read();
+		} else {
+			_lock.release_write();
+		}
+	}
+
+	void duplicate(Packet *, int, DupReceiver &, String, EtherAddress, EtherAddress);
+	void duplicate_last(Packet *, int, DupReceiver &);
 	void store(String, int, Packet *, EtherAddress, EtherAddress);
+	void enqueue(String, int, Packet *, EtherAddress, EtherAddress);
+	void schedule_pending();
+	Packet *next_frame();
+	const AirtimeTable *airtime(AggregationQueue *);
 	String list_slices();
 
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <fcntl.h>
 #include <click/config.h>
 #include "empowerregmon.hh"
 #include <click/args.hh>
@@ -27,7 +28,8 @@ CLICK_DECLS
 
 EmpowerRegmon::EmpowerRegmon() :
 		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000),
-		_timer(this), _debug(false), _register_log_file(0), _last_mac_ticks(0) {
+		_timer(this), _debug(false), _register_log_fd(-1), _buffered(0),
+		_nb_samples(100) {
 }
 
 EmpowerRegmon::~EmpowerRegmon() {
@@ -36,17 +38,15 @@ EmpowerRegmon::~EmpowerRegmon() {
 
 int EmpowerRegmon::initialize(ErrorHandler *) {
 
-	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, 100);
+	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, _nb_samples);
 	_registers.push_back(reg_tx);
 
-	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, 100);
+	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, _nb_samples);
 	_registers.push_back(reg_rx);
 
-	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, 100);
+	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, _nb_samples);
 	_registers.push_back(reg_ed);
 
-	_last_mac_ticks = 0;
-
 	// set sampling interval
 	String period_file_path = _debugfs + "/sampling_interval";
 	FILE *period_file = fopen(period_file_path.c_str(), "w");
@@ -61,17 +61,22 @@ int EmpowerRegmon::initialize(ErrorHandler *) {
 					  period_file_path.c_str());
 	}
 
-	// flush measurements register and keep the file open
-	// due to bugs in the driver patch, the fread can return more data than the one available in the buffer
-	// it is also likely that the read handler reports lines instead of bytes
+	// open the measurements register once and keep it open, every read
+	// returns the samples logged since the previous one
 	String register_log_file_path = _debugfs + "/register_log";
-	_register_log_file = fopen(register_log_file_path.c_str(), "r");
-	char* buffer[8192];
-	int nread;
+	_register_log_fd = open(register_log_file_path.c_str(), O_RDONLY | O_NONBLOCK);
 
-	do {
-		nread = fread(&buffer, 1, sizeof buffer, _register_log_file);
-	} while (nread > 0); // fixme, read operation could be slower than kernel measurements writing
+	if (_register_log_fd < 0) {
+		click_chatter("%{element} :: %s :: unable to open file %s",
+					  this,
+					  __func__,
+					  register_log_file_path.c_str());
+	} else {
+		// flush the measurements register
+		// fixme, read operation could be slower than kernel measurements writing
+		while (read(_register_log_fd, _buffer, BUFFER_SIZE) > 0)
+			/* nada */;
+	}
 
 	_timer.initialize(this);
 	_timer.schedule_now();
@@ -86,6 +91,17 @@ int EmpowerRegmon::initialize(ErrorHandler *) {
 	return 0;
 }
 
+void EmpowerRegmon::cleanup(CleanupStage) {
+	if (_register_log_fd >= 0) {
+		close(_register_log_fd);
+		_register_log_fd = -1;
+	}
+	for (RegistersIter iter = _registers.begin(); iter != _registers.end(); iter++) {
+		iter->release();
+	}
+	_registers.clear();
+}
+
 int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
 
 	int ret = Args(conf, this, errh)
@@ -93,78 +109,168 @@ int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
 			  .read_m("IFACE_ID", _iface_id)
 			  .read("ELEM_PERIOD", _elem_period)
 			  .read("REG_PERIOD", _reg_period)
+			  .read("SAMPLES", _nb_samples)
 			  .read_m("DEBUGFS", _debugfs)
 			  .read("DEBUG", _debug).complete();
 
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (_nb_samples == 0) {
+		return errh->error("SAMPLES must be positive");
+	}
+
 	return ret;
 
 }
 
-void EmpowerRegmon::run_timer(Timer *) {
-
-	Timestamp start = Timestamp::now();
+static inline bool parse_field(const char *&p, const char *end, int base, uint32_t &value) {
 
-	FILE * fp;
-	char * line = NULL;
-	size_t len = 0;
-	ssize_t read;
+	value = 0;
 
-	String register_log_file_path = _debugfs + "/register_log";
-	fp = fopen(register_log_file_path.c_str(), "r");
+	if (base == 16 && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		p += 2;
+	}
 
-	if (fp == NULL) {
-		click_chatter("%{element} :: %s :: unable to open file %s",
-					  this,
-					  __func__,
-					  register_log_file_path.c_str());
-		_timer.schedule_after_msec(_elem_period);
-		return;
+	const char *start = p;
+
+	for (; p != end; p++) {
+		unsigned c = (unsigned char) *p;
+		unsigned digit;
+		if (c >= '0' && c <= '9') {
+			digit = c - '0';
+		} else if (base == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+			digit = (c | 0x20) - 'a' + 10;
+		} else {
+			break;
+		}
+		value = value * base + digit;
 	}
 
-	while ((read = getline(&line, &len, fp)) != -1) {
-		Vector<String> values;
-		char* token = strtok(line, ",");
-		while (token != NULL) {
-			values.push_back(String(token));
-			token = strtok(NULL, ",");
+	return p != start;
+
+}
+
+int RegmonParser::parse(const char *begin, const char *end, Registers &registers) {
+
+	const char *line = begin;
+
+	while (line != end) {
+
+		const char *eol = (const char *) memchr(line, '\n', end - line);
+
+		if (!eol) {
+			break;
+		}
+
+		if (eol == line) {
+			line++;
+			continue;
 		}
-		uint32_t sec = strtoul(values[0].c_str(), NULL, 10);
-		uint32_t nsec = strtoul(values[1].c_str(), NULL, 10);
-		uint32_t mac_ticks = strtoul(values[3].c_str(), NULL, 16);
-		uint32_t tx = strtoul(values[4].c_str(), NULL, 16);
-		uint32_t rx = strtoul(values[5].c_str(), NULL, 16);
-		uint32_t ed = strtoul(values[6].c_str(), NULL, 16);
 
+		// sec, nsec, unused, mac_ticks, tx, rx, ed
+		uint32_t values[7];
+		const char *p = line;
+		int field = 0;
+
+		for (; field < 7; field++) {
+			if (field == 2) {
+				values[field] = 0;
+				while (p != eol && *p != ',') {
+					p++;
+				}
+			} else if (!parse_field(p, eol, field < 2 ? 10 : 16, values[field])) {
+				break;
+			}
+			if (field < 6) {
+				if (p == eol || *p != ',') {
+					break;
+				}
+				p++;
+			}
+		}
+
+		line = eol + 1;
+
+		if (field < 7) {
+			_errors++;
+			continue;
+		}
+
+		_lines++;
+
+		uint32_t mac_ticks = values[3];
 		bool valid;
 		uint32_t mac_ticks_delta = 0;
 
 		if (mac_ticks < _last_mac_ticks) {
-
 			_last_mac_ticks = mac_ticks;
 			valid = false;
 		}
 		else {
-
 			mac_ticks_delta = mac_ticks - _last_mac_ticks;
 			_last_mac_ticks = mac_ticks;
 			valid = true;
 		}
 
-		Timestamp timestamp = Timestamp(sec, nsec);
-		_registers[EMPOWER_REGMON_TX].add_sample(timestamp.usecval(), tx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_RX].add_sample(timestamp.usecval(), rx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_ED].add_sample(timestamp.usecval(), ed, mac_ticks_delta, valid);
+		uint32_t timestamp = Timestamp(values[0], values[1]).usecval();
+		registers[EMPOWER_REGMON_TX].add_sample(timestamp, values[4], mac_ticks_delta, valid);
+		registers[EMPOWER_REGMON_RX].add_sample(timestamp, values[5], mac_ticks_delta, valid);
+		registers[EMPOWER_REGMON_ED].add_sample(timestamp, values[6], mac_ticks_delta, valid);
+
 	}
 
-	fclose(fp);
+	return line - begin;
+
+}
+
+void EmpowerRegmon::read_register_log() {
+
+	while (true) {
+
+		ssize_t nread = read(_register_log_fd, _buffer + _buffered, BUFFER_SIZE - _buffered);
+
+		if (nread <= 0) {
+			break;
+		}
 
-	Timestamp delta = Timestamp::now() -start;
+		_buffered += nread;
+
+		int used = _parser.parse(_buffer, _buffer + _buffered, _registers);
+
+		if (used > 0) {
+			memmove(_buffer, _buffer + used, _buffered - used);
+			_buffered -= used;
+		} else if (_buffered == BUFFER_SIZE) {
+			// no line terminator in a full buffer, drop it
+			_parser._errors++;
+			_buffered = 0;
+		}
+
+	}
+
+}
+
+void EmpowerRegmon::run_timer(Timer *) {
+
+	Timestamp start = Timestamp::now();
+
+	if (_register_log_fd >= 0) {
+		read_register_log();
+	}
+
+	Timestamp delta = Timestamp::now() - start;
+	_last_run = delta;
+	_busy += delta;
 
 	if (delta.msec() > _elem_period) {
 		click_chatter("%{element} :: %s :: processing samples took too much time %s",
 				      this,
 					  __func__,
 					  delta.unparse().c_str());
+		_timer.schedule_now();
+		return;
 	}
 
 	_timer.schedule_after_msec(_elem_period - delta.msec());
@@ -175,6 +281,7 @@ void EmpowerRegmon::run_timer(Timer *) {
 enum {
 	H_STATUS,
 	H_FULL,
+	H_PARSER,
 };
 
 String EmpowerRegmon::read_handler(Element *e, void *thunk) {
@@ -190,12 +297,19 @@ String EmpowerRegmon::read_handler(Element *e, void *thunk) {
 	case H_FULL: {
 		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
 			sa << iter->unparse() << "\n";
-			for (int i = 0; i < 100; i++) {
+			for (int i = 0; i < iter->_size; i++) {
 				sa << iter->_timestamps[i] << " " << iter->_samples[i] << '\n';
 			}
 		}
 		return sa.take_string();
 	}
+	case H_PARSER: {
+		sa << "lines " << eg->_parser._lines << "\n";
+		sa << "errors " << eg->_parser._errors << "\n";
+		sa << "last_run " << eg->_last_run << "\n";
+		sa << "busy " << eg->_busy << "\n";
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -204,6 +318,7 @@ String EmpowerRegmon::read_handler(Element *e, void *thunk) {
 void EmpowerRegmon::add_handlers() {
 	add_read_handler("status", read_handler, (void *) H_STATUS);
 	add_read_handler("full", read_handler, (void *) H_FULL);
+	add_read_handler("parser", read_handler, (void *) H_PARSER);
 }
 
 CLICK_ENDDECLS
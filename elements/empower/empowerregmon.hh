@@ -25,7 +25,13 @@ public:
 		_min_value = 0xffffffff;
 		_max_value = 0;
 		_first_run = true;
-		memset(_samples, 0, _size);
+	}
+
+	void release() {
+		delete[] _samples;
+		delete[] _timestamps;
+		_samples = 0;
+		_timestamps = 0;
 	}
 
 	void add_sample(uint32_t timestamp, uint32_t value, uint32_t mac_ticks_delta, bool valid) {
@@ -101,6 +107,26 @@ public:
 typedef Vector<RegmonRegister> Registers;
 typedef Registers::iterator RegistersIter;
 
+// Parser for the register_log lines exported by the ath9k regmon patch:
+// "sec,nsec,<unused>,mac_ticks,tx,rx,ed", the last four in hex. It works
+// in place on the caller's buffer and does not allocate.
+class RegmonParser {
+public:
+
+	RegmonParser() : _last_mac_ticks(0), _lines(0), _errors(0) {
+	}
+
+	// Parse the complete lines in [begin, end) into the registers and
+	// return the number of bytes consumed, a trailing partial line is left
+	// for the next call.
+	int parse(const char *begin, const char *end, Registers &registers);
+
+	uint32_t _last_mac_ticks;
+	uint32_t _lines;
+	uint32_t _errors;
+
+};
+
 class EmpowerRegmon: public Element {
 public:
 
@@ -112,6 +138,7 @@ public:
 	int configure(Vector<String> &, ErrorHandler *);
 	void add_handlers();
 	int initialize(ErrorHandler *);
+	void cleanup(CleanupStage);
 	void run_timer(Timer *);
 	RegmonRegister * registers(int i) { return &_registers.at(i); }
 
@@ -128,11 +155,20 @@ private:
 
 	String _debugfs;
 
-	FILE *_register_log_file;
-	uint32_t _last_mac_ticks;
+	enum { BUFFER_SIZE = 8192 };
+
+	int _register_log_fd;
+	char _buffer[BUFFER_SIZE];
+	int _buffered;
+	uint32_t _nb_samples;
+	Timestamp _last_run;
+	Timestamp _busy; // spent reading the log since initialization
 
+	RegmonParser _parser;
 	Registers _registers;
 
+	void read_register_log();
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
@@ -19,11 +19,13 @@
 #include <click/error.hh>
 #include <click/glue.hh>
 #include <click/packet_anno.hh>
+#include <click/master.hh>
 #include <click/straccum.hh>
 #include <clicknet/ether.h>
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
 #include <elements/wifi/bitrate.hh>
+#include <elements/wifi/wifirxdesc.hh>
 #include "empowerlvapmanager.hh"
 #include "empowerrxstats.hh"
 CLICK_DECLS
@@ -31,10 +33,8 @@ CLICK_DECLS
 void send_summary_trigger_callback(Timer *timer, void *data) {
 	// send summary
 	SummaryTrigger *summary = (SummaryTrigger *) data;
-	summary->_ers->lock.acquire_write();
 	summary->_el->send_summary_trigger(summary);
 	summary->_sent++;
-	summary->_ers->lock.release_write();
 	if (summary->_limit > 0 && summary->_sent >= (unsigned) summary->_limit) {
 		summary->_ers->del_summary_trigger(summary->_trigger_id);
 		return;
@@ -55,7 +55,7 @@ void send_rssi_trigger_callback(Timer *timer, void *data) {
 		}
 		// check if condition matches
 		if (rssi->matches(nfo) && !rssi->_dispatched) {
-			rssi->_el->send_rssi_trigger(rssi->_trigger_id, nfo->_iface_id, nfo->_sma_rssi->avg());
+			rssi->_el->send_rssi_trigger(rssi->_trigger_id, nfo->_iface_id, nfo->sma_rssi());
 			rssi->_dispatched = true;
 		} else if (!rssi->matches(nfo) && rssi->_dispatched) {
 			rssi->_dispatched = false;
@@ -68,7 +68,8 @@ void send_rssi_trigger_callback(Timer *timer, void *data) {
 
 EmpowerRXStats::EmpowerRXStats() :
 		_el(0), _timer(this), _signal_offset(0), _period(500),
-		_sma_period(13), _max_silent_window_count(10), _debug(false) {
+		_sma_period(13), _max_silent_window_count(10), _sharded(true),
+		_shards(0), _nshards(0), _summary_frames(1024), _debug(false) {
 
 }
 
@@ -76,6 +77,13 @@ EmpowerRXStats::~EmpowerRXStats() {
 }
 
 int EmpowerRXStats::initialize(ErrorHandler *) {
+	if (_sharded) {
+		_nshards = master()->nthreads();
+		if (_nshards < 1) {
+			_nshards = 1;
+		}
+		_shards = new RXShard[_nshards];
+	}
 	_timer.initialize(this);
 	_timer.schedule_now();
 	return 0;
@@ -88,22 +96,73 @@ int EmpowerRXStats::configure(Vector<String> &conf, ErrorHandler *errh) {
 			.read("SMA_PERIOD", _sma_period)
 			.read("SIGNAL_OFFSET", _signal_offset)
 			.read("PERIOD", _period)
+			.read("SHARDED", _sharded)
+			.read("SUMMARY_FRAMES", _summary_frames)
 			.read("DEBUG", _debug)
 			.complete();
 
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (_sma_period < 1) {
+		return errh->error("SMA_PERIOD must be positive");
+	}
+
+	// the frame count of a summary message is 16 bits wide
+	if (_summary_frames < 1 || _summary_frames > 65535) {
+		return errh->error("SUMMARY_FRAMES must be between 1 and 65535");
+	}
+
+	_sta_stats.set_period(_sma_period);
+	_ap_stats.set_period(_sma_period);
+
 	return ret;
 
 }
 
+void EmpowerRXStats::cleanup(CleanupStage) {
+	delete[] _shards;
+	_shards = 0;
+	_nshards = 0;
+}
+
+void EmpowerRXStats::merge_shard(RXSampleTable &samples, bool station) {
+	for (RXSIter iter = samples.begin(); iter.live();) {
+		RXSample *sample = &iter.value();
+		// Transmitter silent for a whole period, drop it from the shard
+		if (sample->_packets == 0) {
+			iter = samples.erase(iter);
+			continue;
+		}
+		DstInfo *nfo = get_neighbor(iter.key(), station, sample->_iface_id);
+		nfo->add_samples(sample->_packets, sample->_accum_rssi, sample->_squares_rssi, sample->_last_received);
+		sample->_packets = 0;
+		sample->_accum_rssi = 0;
+		sample->_squares_rssi = 0;
+		++iter;
+	}
+}
+
 void EmpowerRXStats::run_timer(Timer *) {
-	// process stations
 	lock.acquire_write();
+	// merge the samples collected on the RX path
+	for (unsigned i = 0; i < _nshards; i++) {
+		RXShard *shard = &_shards[i];
+		shard->_lock.acquire();
+		merge_shard(shard->_stas, true);
+		merge_shard(shard->_aps, false);
+		shard->_lock.release();
+	}
+	// close the window for all neighbors at once
+	_sta_stats.update();
+	_ap_stats.update();
+	// process stations
 	for (NTIter iter = stas.begin(); iter.live();) {
-		// Update stats
 		DstInfo *nfo = &iter.value();
-		nfo->update();
 		// Delete stale entries
-		if (nfo->_silent_window_count > _max_silent_window_count) {
+		if (nfo->silent_window_count() > _max_silent_window_count) {
+			_sta_stats.release(nfo->_slot);
 			iter = stas.erase(iter);
 		} else {
 			++iter;
@@ -111,11 +170,10 @@ void EmpowerRXStats::run_timer(Timer *) {
 	}
 	// process access points
 	for (NTIter iter = aps.begin(); iter.live();) {
-		// Update aps
 		DstInfo *nfo = &iter.value();
-		nfo->update();
 		// Delete stale entries
-		if (nfo->_silent_window_count > _max_silent_window_count) {
+		if (nfo->silent_window_count() > _max_silent_window_count) {
+			_ap_stats.release(nfo->_slot);
 			iter = aps.erase(iter);
 		} else {
 			++iter;
@@ -131,86 +189,53 @@ void EmpowerRXStats::run_timer(Timer *) {
 Packet *
 EmpowerRXStats::simple_action(Packet *p) {
 
-	struct click_wifi *w = (struct click_wifi *) p->data();
-
-	unsigned wifi_header_size = sizeof(struct click_wifi);
-
-	if ((w->i_fc[1] & WIFI_FC1_DIR_MASK) == WIFI_FC1_DIR_DSTODS)
-		wifi_header_size += WIFI_ADDR_LEN;
-
-	if (WIFI_QOS_HAS_SEQ(w))
-		wifi_header_size += sizeof(uint16_t);
-
-	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
-
-	if ((ceh->magic == WIFI_EXTRA_MAGIC) && ceh->pad && (wifi_header_size & 3))
-		wifi_header_size += 4 - (wifi_header_size & 3);
+	const click_wifi_rx_desc *d = WifiRXDesc::get(p);
 
-	if (p->length() < wifi_header_size) {
+	if (d->flags & WIFI_RX_DESC_SHORT) {
 		return p;
 	}
 
-	int dir = w->i_fc[1] & WIFI_FC1_DIR_MASK;
-	int type = w->i_fc[0] & WIFI_FC0_TYPE_MASK;
-	int subtype = w->i_fc[0] & WIFI_FC0_SUBTYPE_MASK;
-	int retry = w->i_fc[1] & WIFI_FC1_RETRY;
-	bool station = false;
-
-	// Discard frames that do not have sequence numbers
-	if (type == WIFI_FC0_TYPE_CTL) {
+	// Discard control frames and frames whose sender cannot be classified
+	if (!(d->flags & (WIFI_RX_DESC_STA | WIFI_RX_DESC_AP))) {
 		return p;
 	}
 
-	switch (dir) {
-	case WIFI_FC1_DIR_TODS:
-		// TODS bit not set when TA is an access point, but only when TA is a station
-		station = true;
-		break;
-	case WIFI_FC1_DIR_NODS:
-		if (type == WIFI_FC0_TYPE_DATA) {
-			// NODS never set for data frames unless in ad-hoc mode
-			station = true;
-			break;
-		} else if (type == WIFI_FC0_TYPE_MGT) {
-			if (subtype == WIFI_FC0_SUBTYPE_BEACON
-					|| subtype == WIFI_FC0_SUBTYPE_PROBE_RESP) {
-				// NODS set for beacon frames and probe response from access points
-				station = false;
-				break;
-			} else if (subtype == WIFI_FC0_SUBTYPE_PROBE_REQ
-					|| subtype == WIFI_FC0_SUBTYPE_REASSOC_REQ
-					|| subtype == WIFI_FC0_SUBTYPE_ASSOC_REQ
-					|| subtype == WIFI_FC0_SUBTYPE_AUTH
-					|| subtype == WIFI_FC0_SUBTYPE_DISASSOC
-					|| subtype == WIFI_FC0_SUBTYPE_DEAUTH) {
-				// NODS set for beacon frames and probe response from access points
-				station = true;
-				break;
-			}
-		}
-		// no idea, ignore packet
-		return p;
-	case WIFI_FC1_DIR_FROMDS:
-		// FROMDS bit not set when TA is an station, but only when TA is an access point
-		station = false;
-		break;
-	case WIFI_FC1_DIR_DSTODS:
-		// DSTODS bit never set
-		station = false;
-		break;
-	}
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+
+	int type = WifiRXDesc::type(d);
+	int subtype = WifiRXDesc::subtype(d);
+	bool station = d->flags & WIFI_RX_DESC_STA;
 
-	EtherAddress ra = EtherAddress(w->i_addr1);
-	EtherAddress ta = EtherAddress(w->i_addr2);
+	EtherAddress ra = EtherAddress(WifiRXDesc::ra(p));
+	EtherAddress ta = EtherAddress(WifiRXDesc::ta(p));
 
-	int8_t rssi;
-	memcpy(&rssi, &ceh->rssi, 1);
+	int8_t rssi = d->rssi;
 
 	uint8_t iface_id = PAINT_ANNO(p);
 
-	lock.acquire_write();
+	if (_sharded) {
+		RXShard *shard = &_shards[click_current_cpu_id() % _nshards];
+		shard->_lock.acquire();
+		RXSample *sample = station ? &shard->_stas[ta] : &shard->_aps[ta];
+		if (sample->_iface_id < 0) {
+			sample->_iface_id = iface_id;
+		}
+		sample->add_sample(rssi);
+		shard->_lock.release();
+		// no summary to fill, skip the table lock
+		if (_summary_triggers.empty()) {
+			return p;
+		}
+	}
 
-	update_neighbor(ta, station, iface_id, rssi);
+	// the triggers fill their own buffers, the list itself is only read
+	if (_sharded) {
+		lock.acquire_read();
+	} else {
+		lock.acquire_write();
+		update_neighbor(ta, station, iface_id, rssi);
+	}
 
 	// check if frame meta-data should be saved
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
@@ -218,18 +243,21 @@ EmpowerRXStats::simple_action(Packet *p) {
 			continue;
 		}
 		if ((*qi)->_eth == ta || (*qi)->_eth.is_broadcast()) {
-			Frame frame = Frame(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length(), retry, station, iface_id);
-			(*qi)->_frames.push_back(frame);
+			(*qi)->capture(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length());
 		}
 	}
 
-	lock.release_write();
+	if (_sharded) {
+		lock.release_read();
+	} else {
+		lock.release_write();
+	}
 
 	return p;
 
 }
 
-void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi) {
+DstInfo *EmpowerRXStats::get_neighbor(EtherAddress ta, bool station, uint8_t iface_id) {
 
 	DstInfo *nfo;
 
@@ -243,18 +271,28 @@ void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t ifac
 		if (station) {
 			stas[ta] = DstInfo();
 			nfo = stas.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
+			nfo->_stats = &_sta_stats;
+			nfo->_slot = _sta_stats.alloc();
 			nfo->_iface_id = iface_id;
 			nfo->_eth = ta;
 		} else {
 			aps[ta] = DstInfo();
 			nfo = aps.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
+			nfo->_stats = &_ap_stats;
+			nfo->_slot = _ap_stats.alloc();
 			nfo->_iface_id = iface_id;
 			nfo->_eth = ta;
 		}
 	}
 
+	return nfo;
+
+}
+
+void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi) {
+
+	DstInfo *nfo = get_neighbor(ta, station, iface_id);
+
 	// Add sample
 	nfo->add_sample(rssi);
 
@@ -295,36 +333,44 @@ void EmpowerRXStats::clear_triggers() {
 	}
 	_rssi_triggers.clear();
 	// clear summary triggers
+	lock.acquire_write();
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		(*qi)->_trigger_timer->clear();
 		delete *qi;
 	}
 	_summary_triggers.clear();
+	lock.release_write();
 }
 
 void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t summary_id, int16_t limit, uint16_t period) {
-	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _el, this);
+	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _summary_frames, _el, this);
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if (*summary == **qi) {
 			click_chatter("%{element} :: %s :: summary already defined (%s), ignoring",
 						  this,
 						  __func__,
 						  summary->unparse().c_str());
+			delete summary;
 			return;
 		}
 	}
 	summary->_trigger_timer->assign(&send_summary_trigger_callback, (void *) summary);
 	summary->_trigger_timer->initialize(this);
 	summary->_trigger_timer->schedule_now();
+	lock.acquire_write();
 	_summary_triggers.push_back(summary);
+	lock.release_write();
 }
 
 void EmpowerRXStats::del_summary_trigger(uint32_t summary_id) {
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if ((*qi)->_trigger_id == summary_id) {
-			(*qi)->_trigger_timer->clear();
+			SummaryTrigger *summary = *qi;
+			summary->_trigger_timer->clear();
+			lock.acquire_write();
 			_summary_triggers.erase(qi);
-			delete *qi;
+			lock.release_write();
+			delete summary;
 			break;
 		}
 	}
@@ -337,7 +383,8 @@ enum {
 	H_SIGNAL_OFFSET,
 	H_RSSI_MATCHES,
 	H_RSSI_TRIGGERS,
-	H_SUMMARY_TRIGGERS
+	H_SUMMARY_TRIGGERS,
+	H_SHARDS
 };
 
 String EmpowerRXStats::read_handler(Element *e, void *thunk) {
@@ -354,7 +401,7 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 					continue;
 				if ((*qi)->matches(nfo)) {
 					sa << (*qi)->unparse();
-					sa << " current " << nfo->_sma_rssi->avg();
+					sa << " current " << nfo->sma_rssi();
 					sa << "\n";
 				}
 			}
@@ -387,6 +434,16 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 		}
 		return sa.take_string();
 	}
+	case H_SHARDS: {
+		StringAccum sa;
+		for (unsigned i = 0; i < td->_nshards; i++) {
+			RXShard *shard = &td->_shards[i];
+			shard->_lock.acquire();
+			sa << "shard " << i << " stas " << shard->_stas.size() << " aps " << shard->_aps.size() << "\n";
+			shard->_lock.release();
+		}
+		return sa.take_string();
+	}
 	case H_SIGNAL_OFFSET:
 		return String(td->_signal_offset) + "\n";
 	case H_DEBUG:
@@ -406,6 +463,8 @@ int EmpowerRXStats::write_handler(const String &in_s, Element *e, void *vparam,
 	case H_RESET: {
 		f->stas.clear();
 		f->aps.clear();
+		f->_sta_stats.clear();
+		f->_ap_stats.clear();
 		break;
 	}
 	case H_SIGNAL_OFFSET: {
@@ -431,6 +490,7 @@ void EmpowerRXStats::add_handlers() {
 	add_read_handler("summary_triggers", read_handler, (void *) H_SUMMARY_TRIGGERS);
 	add_read_handler("rssi_matches", read_handler, (void *) H_RSSI_MATCHES);
 	add_read_handler("rssi_triggers", read_handler, (void *) H_RSSI_TRIGGERS);
+	add_read_handler("shards", read_handler, (void *) H_SHARDS);
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
 	add_read_handler("signal_offset", read_handler, (void *) H_SIGNAL_OFFSET);
 	add_write_handler("signal_offset", write_handler, (void *) H_SIGNAL_OFFSET);
@@ -438,5 +498,5 @@ void EmpowerRXStats::add_handlers() {
 }
 
 EXPORT_ELEMENT(EmpowerRXStats)
-ELEMENT_REQUIRES(bitrate DstInfo Trigger SummaryTrigger RssiTrigger)
+ELEMENT_REQUIRES(bitrate DstInfo NeighborStats Trigger SummaryTrigger RssiTrigger WifiRXDesc)
 CLICK_ENDDECLS
@@ -33,6 +33,18 @@ CLICK_DECLS
  =item EL
  An EmpowerLVAPManager element
 
+ =item SHARDED
+ Accumulate RX samples in per-thread shards that are merged into the
+ neighbor tables every PERIOD, so that the RX path does not take the
+ table lock. Neighbors show up at the next merge. Default is true.
+
+ =item SUMMARY_FRAMES
+ Maximum number of frames reported by one summary trigger message.
+ Each summary trigger preallocates two messages of this size, the RX
+ path writes matching frames into one while the other is sent. Frames
+ over the budget are dropped and reported by the summary_triggers
+ handler. Default is 1024.
+
  =item DEBUG
  Turn debug on/off
 
@@ -41,6 +53,37 @@ CLICK_DECLS
  =a EmpowerLVAPManager
  */
 
+// RX samples of a transmitter collected between two timer ticks
+class RXSample {
+public:
+	int _packets;
+	int _accum_rssi;
+	int _squares_rssi;
+	int _iface_id;
+	Timestamp _last_received;
+
+	RXSample() : _packets(0), _accum_rssi(0), _squares_rssi(0), _iface_id(-1) {
+	}
+
+	void add_sample(uint8_t rssi) {
+		_packets++;
+		_accum_rssi += rssi;
+		_squares_rssi += rssi * rssi;
+		_last_received.assign_now();
+	}
+};
+
+typedef HashTable<EtherAddress, RXSample> RXSampleTable;
+typedef RXSampleTable::iterator RXSIter;
+
+// One shard per thread, its lock is only contended during the merge
+class RXShard {
+public:
+	SimpleSpinlock _lock;
+	RXSampleTable _stas;
+	RXSampleTable _aps;
+} CLICK_ALIGNED(CLICK_CACHE_LINE_SIZE);
+
 typedef HashTable<EtherAddress, DstInfo> NeighborTable;
 typedef NeighborTable::iterator NTIter;
 
@@ -65,6 +108,7 @@ public:
 
 	int initialize(ErrorHandler *);
 	int configure(Vector<String> &, ErrorHandler *);
+	void cleanup(CleanupStage);
 	void run_timer(Timer *);
 
 	Packet *simple_action(Packet *);
@@ -84,6 +128,9 @@ public:
 	NeighborTable aps;
 	NeighborTable stas;
 
+	NeighborStats _ap_stats;
+	NeighborStats _sta_stats;
+
 private:
 
 	EmpowerLVAPManager *_el;
@@ -97,12 +144,20 @@ private:
 	unsigned _sma_period;
 	unsigned _max_silent_window_count; // in number of windows
 
+	bool _sharded;
+	RXShard *_shards;
+	unsigned _nshards;
+
+	uint32_t _summary_frames;
+
 	bool _debug;
 
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
+	DstInfo *get_neighbor(EtherAddress, bool, uint8_t);
 	void update_neighbor(EtherAddress, bool, uint8_t, uint8_t);
+	void merge_shard(RXSampleTable &, bool);
 
 };
 
@@ -21,10 +21,13 @@
 #include <click/error.hh>
 #include <clicknet/ether.h>
 #include <click/etheraddress.hh>
+#include <click/standard/scheduleinfo.hh>
 #include "empowerlvapmanager.hh"
+#include "empowerqosmanager.hh"
 CLICK_DECLS
 
-EmpowerTee::EmpowerTee() : _el(0) {
+EmpowerTee::EmpowerTee() : _el(0), _task(this), _batch(0), _batch_size(0),
+		_batch_head(0), _batch_tail(0), _batches(0) {
 }
 
 int EmpowerTee::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -34,6 +37,7 @@ int EmpowerTee::configure(Vector<String> &conf, ErrorHandler *errh) {
 	int res = Args(conf, this, errh)
 					.read_p("N", n)
 					.read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
+					.read("BATCH", _batch)
 					.complete();
 
 	if (res < 0)
@@ -46,8 +50,49 @@ int EmpowerTee::configure(Vector<String> &conf, ErrorHandler *errh) {
 
 }
 
+int EmpowerTee::initialize(ErrorHandler *errh) {
+
+	// outputs feeding an EmpowerQOSManager directly take whole bursts
+	for (int i = 0; i < noutputs(); i++) {
+		_batch_eqms.push_back((EmpowerQOSManager *) output(i).element()->cast("EmpowerQOSManager"));
+	}
+
+	if (_batch) {
+		ScheduleInfo::initialize_task(this, &_task, false, errh);
+	}
+
+	return 0;
+
+}
+
+void EmpowerTee::cleanup(CleanupStage) {
+	while (Packet *p = _batch_head) {
+		_batch_head = p->next();
+		p->kill();
+	}
+}
+
 void EmpowerTee::push(int, Packet *p) {
 
+	if (_batch) {
+		p->set_next(0);
+		_batch_lock.acquire();
+		if (_batch_head) {
+			_batch_tail->set_next(p);
+		} else {
+			_batch_head = p;
+		}
+		_batch_tail = p;
+		Packet *head = (++_batch_size >= _batch) ? take_batch() : 0;
+		_batch_lock.release();
+		if (head) {
+			flush(head);
+		} else {
+			_task.reschedule();
+		}
+		return;
+	}
+
 	if (p->length() < sizeof(struct click_ether)) {
 		click_chatter("%{element} :: %s :: packet too small: %d vs %d",
 					  this,
@@ -63,7 +108,7 @@ void EmpowerTee::push(int, Packet *p) {
 
 	// frame is unicast then send only to the correct interface
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
+		const EmpowerStationState *ess = _el->get_ess(dst);
 		if (!ess) {
 			p->kill();
 			return;
@@ -83,6 +128,129 @@ void EmpowerTee::push(int, Packet *p) {
 
 }
 
+bool EmpowerTee::run_task(Task *) {
+	_batch_lock.acquire();
+	Packet *head = take_batch();
+	_batch_lock.release();
+	if (!head) {
+		return false;
+	}
+	flush(head);
+	return true;
+}
+
+// called with the batch lock held
+Packet *EmpowerTee::take_batch() {
+	Packet *head = _batch_head;
+	if (head) {
+		_batch_head = _batch_tail = 0;
+		_batch_size = 0;
+		_batches++;
+	}
+	return head;
+}
+
+void EmpowerTee::flush(Packet *p) {
+
+	int n = noutputs();
+	Vector<Packet *> heads(n, 0);
+	Vector<Packet *> tails(n, 0);
+
+	EtherAddress last_dst;
+	int last_iface = -1;
+
+	// classify the whole burst against one snapshot of the LVAPs
+	const StationIndex *stations = _el->stations();
+
+	while (p) {
+
+		Packet *next = p->next();
+		p->set_next(0);
+
+		if (p->length() < sizeof(struct click_ether)) {
+			click_chatter("%{element} :: %s :: packet too small: %d vs %d",
+						  this,
+						  __func__,
+						  p->length(),
+						  sizeof(struct click_ether));
+			p->kill();
+			p = next;
+			continue;
+		}
+
+		click_ether *eh = (click_ether *) p->data();
+		EtherAddress dst = EtherAddress(eh->ether_dhost);
+
+		if (!dst.is_broadcast() && !dst.is_group()) {
+			// consecutive frames to the same station share one lookup
+			if (dst != last_dst || last_iface < 0) {
+				const EmpowerStationState *ess = stations->lvap(dst);
+				last_dst = dst;
+				last_iface = ess ? ess->_iface_id : -1;
+			}
+			if (last_iface < 0 || last_iface >= n) {
+				p->kill();
+			} else {
+				if (heads[last_iface]) {
+					tails[last_iface]->set_next(p);
+				} else {
+					heads[last_iface] = p;
+				}
+				tails[last_iface] = p;
+			}
+			p = next;
+			continue;
+		}
+
+		for (int i = 0; i < n; i++) {
+			Packet *q = (i < n - 1) ? p->clone() : p;
+			if (!q) {
+				continue;
+			}
+			q->set_next(0);
+			if (heads[i]) {
+				tails[i]->set_next(q);
+			} else {
+				heads[i] = q;
+			}
+			tails[i] = q;
+		}
+
+		p = next;
+
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (heads[i]) {
+			output_batch(i, heads[i]);
+		}
+	}
+
+}
+
+void EmpowerTee::output_batch(int port, Packet *head) {
+
+	if (_batch_eqms[port]) {
+		_batch_eqms[port]->push_batch(head);
+		return;
+	}
+
+	// not batch-aware, fall back to one push per packet
+	while (head) {
+		Packet *next = head->next();
+		head->set_next(0);
+		output(port).push(head);
+		head = next;
+	}
+
+}
+
+void EmpowerTee::add_handlers() {
+	add_data_handlers("batch", Handler::OP_READ, &_batch);
+	add_data_handlers("batches", Handler::OP_READ, &_batches);
+	add_task_handlers(&_task);
+}
+
 CLICK_ENDDECLS
 EXPORT_ELEMENT(EmpowerTee)
 ELEMENT_REQUIRES(userlevel)
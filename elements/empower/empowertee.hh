@@ -1,15 +1,35 @@
 #ifndef CLICK_EMPOWERTEE_HH
 #define CLICK_EMPOWERTEE_HH
 #include <click/element.hh>
+#include <click/task.hh>
+#include <click/sync.hh>
 CLICK_DECLS
 
 /*
  * =c
- * EmpowerTee([N])
+ * EmpowerTee([N, EL, I<KEYWORDS>])
  * =s basictransfer
  * duplicates packets
  * =d
  * EmpowerTee sends a copy of each incoming packet out each output.N.
+ *
+ * Keyword arguments are:
+ *
+ * =item EL
+ * An EmpowerLVAPManager element
+ *
+ * =item BATCH
+ * Maximum number of packets per burst, default is 0 (no batching). When
+ * set, incoming packets are held until BATCH packets are available or the
+ * current scheduling round ends, then classified by destination LVAP in one
+ * pass. Bursts are handed to EmpowerQOSManager outputs as a single
+ * EmpowerQOSManager::push_batch() call and pushed one by one to any other
+ * element, so an output only takes bursts when it is connected straight to
+ * the EmpowerQOSManager. Packets may be pushed from several threads, the
+ * pending burst is protected by a lock.
+ *
+ * =e
+ * KernelTap(10.0.0.1/24, BURST 64) -> EmpowerTee(1, EL el, BATCH 64) -> eqm_0;
  */
 
 class EmpowerTee : public Element {
@@ -23,13 +43,30 @@ public:
 	const char *processing() const		{ return PUSH; }
 
 	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+	void cleanup(CleanupStage) CLICK_COLD;
+	void add_handlers() CLICK_COLD;
 
 	void push(int, Packet *);
+	bool run_task(Task *);
 
 private:
 
 	class EmpowerLVAPManager *_el;
 
+	Task _task;
+	Spinlock _batch_lock;
+	unsigned _batch;
+	unsigned _batch_size;
+	Packet *_batch_head;
+	Packet *_batch_tail;
+	Vector<class EmpowerQOSManager *> _batch_eqms;
+	uint32_t _batches;
+
+	Packet *take_batch();
+	void flush(Packet *);
+	void output_batch(int, Packet *);
+
 };
 
 CLICK_ENDDECLS
@@ -26,6 +26,7 @@
 #include <click/packet_anno.hh>
 #include <click/etheraddress.hh>
 #include <elements/wifi/minstrel.hh>
+#include <elements/wifi/wifirxdesc.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
@@ -61,18 +62,7 @@ EmpowerWifiDecap::push(int, Packet *p) {
 
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
-	unsigned wifi_header_size = sizeof(struct click_wifi);
-
-	if ((w->i_fc[1] & WIFI_FC1_DIR_MASK) == WIFI_FC1_DIR_DSTODS)
-		wifi_header_size += WIFI_ADDR_LEN;
-
-	if (WIFI_QOS_HAS_SEQ(w))
-		wifi_header_size += sizeof(uint16_t);
-
-	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
-
-	if ((ceh->magic == WIFI_EXTRA_MAGIC) && ceh->pad && (wifi_header_size & 3))
-		wifi_header_size += 4 - (wifi_header_size & 3);
+	unsigned wifi_header_size = WifiRXDesc::get(p)->hdr_len;
 
 	if (p->length() < wifi_header_size) {
 		if (_debug) {
@@ -127,7 +117,7 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-    EmpowerStationState *ess = _el->get_ess(src);
+    const EmpowerStationState *ess = _el->get_ess(src);
 
     if (!ess) {
 		p->kill();
@@ -265,4 +255,4 @@ void EmpowerWifiDecap::add_handlers() {
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(EmpowerWifiDecap)
-ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(userlevel WifiRXDesc)
@@ -0,0 +1,138 @@
+/*
+ * neighborstats.{cc,hh}
+ *
+ * Copyright (c) 2017 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "neighborstats.hh"
+#include <math.h>
+CLICK_DECLS
+
+int NeighborStats::alloc() {
+
+	int slot;
+
+	if (_free.size()) {
+		slot = _free.back();
+		_free.pop_back();
+	} else {
+		slot = _packets.size();
+		_packets.push_back(0);
+		_accum_rssi.push_back(0);
+		_squares_rssi.push_back(0);
+		_last_rssi.push_back(0);
+		_last_std.push_back(0);
+		_last_packets.push_back(0);
+		_hist_packets.push_back(0);
+		_silent_window_count.push_back(0);
+		_sma_head.push_back(0);
+		_sma_count.push_back(0);
+		_sma_sum.push_back(0);
+		_window.resize(_window.size() + _period, 0);
+	}
+
+	_packets[slot] = 0;
+	_accum_rssi[slot] = 0;
+	_squares_rssi[slot] = 0;
+	_last_rssi[slot] = 0;
+	_last_std[slot] = 0;
+	_last_packets[slot] = 0;
+	_hist_packets[slot] = 0;
+	_silent_window_count[slot] = 0;
+	_sma_head[slot] = 0;
+	_sma_count[slot] = 0;
+	_sma_sum[slot] = 0;
+
+	return slot;
+
+}
+
+void NeighborStats::release(int slot) {
+	_free.push_back(slot);
+}
+
+void NeighborStats::clear() {
+	_packets.clear();
+	_accum_rssi.clear();
+	_squares_rssi.clear();
+	_last_rssi.clear();
+	_last_std.clear();
+	_last_packets.clear();
+	_hist_packets.clear();
+	_silent_window_count.clear();
+	_window.clear();
+	_sma_head.clear();
+	_sma_count.clear();
+	_sma_sum.clear();
+	_free.clear();
+}
+
+void NeighborStats::update() {
+
+	int n = _packets.size();
+
+	int *packets = _packets.data();
+	const int *accum = _accum_rssi.data();
+	const int *squares = _squares_rssi.data();
+	int *last_rssi = _last_rssi.data();
+	int *last_std = _last_std.data();
+	int *last_packets = _last_packets.data();
+	int *hist_packets = _hist_packets.data();
+	unsigned *silent = _silent_window_count.data();
+
+	// Branch-free per-slot statistics, vectorizable
+	for (int i = 0; i < n; i++) {
+		int p = packets[i];
+		double dp = p > 0 ? p : 1;
+		int mean = p > 0 ? (int) (accum[i] / dp) : 0;
+		double var = squares[i] / dp - mean * mean;
+		last_rssi[i] = mean;
+		last_std[i] = p > 0 ? (int) sqrt(var) : 0;
+		last_packets[i] = p;
+		hist_packets[i] += p;
+		silent[i] = p > 0 ? 0 : silent[i] + 1;
+	}
+
+	// Push the window mean in the moving average of the active slots
+	int *window = _window.data();
+	int *head = _sma_head.data();
+	int *count = _sma_count.data();
+	int *sum = _sma_sum.data();
+	int period = _period;
+
+	for (int i = 0; i < n; i++) {
+		if (!packets[i]) {
+			continue;
+		}
+		int *w = window + i * period;
+		if (count[i] == period) {
+			sum[i] -= w[head[i]];
+		} else {
+			count[i]++;
+		}
+		w[head[i]] = last_rssi[i];
+		sum[i] += last_rssi[i];
+		if (++head[i] == period) {
+			head[i] = 0;
+		}
+	}
+
+	memset(packets, 0, n * sizeof(int));
+	memset(_accum_rssi.data(), 0, n * sizeof(int));
+	memset(_squares_rssi.data(), 0, n * sizeof(int));
+
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(NeighborStats)
@@ -0,0 +1,76 @@
+#ifndef CLICK_EMPOWER_NEIGHBORSTATS_HH
+#define CLICK_EMPOWER_NEIGHBORSTATS_HH
+#include <click/glue.hh>
+#include <click/vector.hh>
+CLICK_DECLS
+
+// Struct-of-arrays RSSI statistics for the neighbors of a table. Each
+// neighbor owns a slot in every array and the moving average windows of
+// all slots are stored back to back, so that the periodic update() is a
+// pass over contiguous arrays instead of a walk over heap objects.
+class NeighborStats {
+public:
+
+	NeighborStats(unsigned period = 13) : _period(period) {
+		assert(period >= 1);
+	}
+
+	// Must be called while no slot is allocated
+	void set_period(unsigned period) {
+		assert(period >= 1 && _packets.size() == 0);
+		_period = period;
+	}
+
+	int alloc();
+	void release(int slot);
+	void clear();
+
+	// Close the current window for all slots: compute mean and standard
+	// deviation, push the mean in the moving average of the slots that
+	// received frames and reset the accumulators.
+	void update();
+
+	void add_sample(int slot, uint8_t rssi) {
+		_packets[slot]++;
+		_accum_rssi[slot] += rssi;
+		_squares_rssi[slot] += rssi * rssi;
+	}
+
+	void add_samples(int slot, int packets, int accum_rssi, int squares_rssi) {
+		_packets[slot] += packets;
+		_accum_rssi[slot] += accum_rssi;
+		_squares_rssi[slot] += squares_rssi;
+	}
+
+	int sma_rssi(int slot) const {
+		return _sma_count[slot] ? _sma_sum[slot] / _sma_count[slot] : 0;
+	}
+
+	int size() const { return _packets.size(); }
+	int live() const { return _packets.size() - _free.size(); }
+	unsigned period() const { return _period; }
+
+	Vector<int> _packets;
+	Vector<int> _accum_rssi;
+	Vector<int> _squares_rssi;
+	Vector<int> _last_rssi;
+	Vector<int> _last_std;
+	Vector<int> _last_packets;
+	Vector<int> _hist_packets;
+	Vector<unsigned> _silent_window_count;
+
+	// moving average, _period samples per slot
+	Vector<int> _window;
+	Vector<int> _sma_head;
+	Vector<int> _sma_count;
+	Vector<int> _sma_sum;
+
+private:
+
+	unsigned _period;
+	Vector<int> _free;
+
+};
+
+CLICK_ENDDECLS
+#endif /* CLICK_EMPOWER_NEIGHBORSTATS_HH */
@@ -0,0 +1,184 @@
+#ifndef CLICK_EMPOWER_POINTERINDEX_HH
+#define CLICK_EMPOWER_POINTERINDEX_HH
+#include <elements/wifi/reclaimer.hh>
+CLICK_DECLS
+
+/*
+ * Map of the objects of type V by their member key, read without locks by
+ * the datapath while a single writer at a time changes it. An open
+ * addressing table of object pointers: an object is linked, or replaced by
+ * another one with the same key, with a single pointer store and unlinked
+ * by overwriting the pointer with a tombstone, so a reader sees an object
+ * either whole or not at all. Only when linking a new key would leave less
+ * than a quarter of the entries free is a larger table built, published and
+ * the old one retired to the Reclaimer; every other change costs O(1).
+ *
+ * The objects themselves are owned by the writer: set() and erase() return
+ * the one they unlinked, which has to be retired as well.
+ */
+template <typename V, typename K, K V::*field>
+class PointerIndex {
+
+	class Table {
+	public:
+
+		V * volatile *_slots;
+		int _capacity; // a power of two
+		int _used; // live objects and tombstones
+
+		Table(int capacity) : _capacity(capacity), _used(0) {
+			_slots = new V * volatile[capacity];
+			for (int i = 0; i < capacity; i++) {
+				_slots[i] = 0;
+			}
+		}
+
+		~Table() {
+			delete[] _slots;
+		}
+
+		// entry of k, or the empty entry ending its probe sequence
+		int find(const K &k) const {
+			int mask = _capacity - 1;
+			int i = k.hashcode() & mask;
+			for (V *v; (v = _slots[i]); i = (i + 1) & mask) {
+				if (v != tombstone() && v->*field == k) {
+					break;
+				}
+			}
+			return i;
+		}
+
+		void link(V *v) {
+			int mask = _capacity - 1;
+			int i = (v->*field).hashcode() & mask;
+			while (_slots[i] && _slots[i] != tombstone()) {
+				i = (i + 1) & mask;
+			}
+			if (!_slots[i]) {
+				_used++;
+			}
+			click_fence();
+			_slots[i] = v;
+		}
+
+	};
+
+public:
+
+	class const_iterator {
+	public:
+
+		bool live() const { return _i < _table->_capacity; }
+		void operator++(int) { _i++; skip(); }
+		void operator++() { _i++; skip(); }
+		const K &key() const { return value()->*field; }
+		V *value() const { return _table->_slots[_i]; }
+
+	private:
+
+		const Table *_table;
+		int _i;
+
+		const_iterator(const Table *table) : _table(table), _i(0) {
+			skip();
+		}
+
+		void skip() {
+			for (; _i < _table->_capacity; _i++) {
+				V *v = _table->_slots[_i];
+				if (v && v != tombstone()) {
+					break;
+				}
+			}
+		}
+
+		friend class PointerIndex;
+
+	};
+
+	PointerIndex(Reclaimer *reclaimer) :
+		_table(new Table(16)), _size(0), _reclaimer(reclaimer) {
+	}
+
+	~PointerIndex() {
+		delete _table;
+	}
+
+	V *get(const K &k) const {
+		const Table *table = _table;
+		V *v = table->_slots[table->find(k)];
+		return v;
+	}
+
+	// iterates on the table current when it is called
+	const_iterator begin() const {
+		return const_iterator(_table);
+	}
+
+	int size() const {
+		return _size;
+	}
+
+	// Links v, returns the object it replaced or 0
+	V *set(V *v) {
+		Table *table = _table;
+		int i = table->find(v->*field);
+		V *old = table->_slots[i];
+		if (old) {
+			click_fence();
+			table->_slots[i] = v;
+			return old;
+		}
+		_size++;
+		if ((table->_used + 1) * 4 > table->_capacity * 3) {
+			rebuild();
+		}
+		_table->link(v);
+		return 0;
+	}
+
+	// Unlinks the object of k, returns it or 0
+	V *erase(const K &k) {
+		Table *table = _table;
+		int i = table->find(k);
+		V *old = table->_slots[i];
+		if (old) {
+			table->_slots[i] = tombstone();
+			_size--;
+		}
+		return old;
+	}
+
+private:
+
+	Table * volatile _table;
+	int _size;
+	Reclaimer *_reclaimer;
+
+	static V *tombstone() { return (V *) 1; }
+
+	// Publishes a table holding the same objects, with three quarters of
+	// it free, and retires the current one
+	void rebuild() {
+		int capacity = 16;
+		while (capacity < (_size + 1) * 4) {
+			capacity *= 2;
+		}
+		Table *old = _table;
+		Table *table = new Table(capacity);
+		for (int i = 0; i < old->_capacity; i++) {
+			V *v = old->_slots[i];
+			if (v && v != tombstone()) {
+				table->link(v);
+			}
+		}
+		click_fence();
+		_table = table;
+		_reclaimer->retire(old);
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -19,16 +19,84 @@
 #include "empowerrxstats.hh"
 #include "empowerlvapmanager.hh"
 #include "summary_trigger.hh"
+#include "empowerpacket.hh"
 CLICK_DECLS
 
 SummaryTrigger::SummaryTrigger(int iface, EtherAddress eth, uint32_t trigger_id, int16_t limit,
-		uint16_t period, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
-		Trigger(trigger_id, period, el, ers), _eth(eth), _iface(iface), _sent(0), _limit(limit) {
-
+		uint16_t period, uint32_t max_frames, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
+		Trigger(trigger_id, period, el, ers), _eth(eth), _iface(iface), _sent(0), _limit(limit),
+		_max_frames(max_frames), _dropped(0), _overflows(0), _nframes(0), _period_drops(0) {
+	_active = make_buffer();
+	_spare = make_buffer();
 }
 
 SummaryTrigger::~SummaryTrigger() {
-	_frames.clear();
+	if (_active) {
+		_active->kill();
+	}
+	if (_spare) {
+		_spare->kill();
+	}
+}
+
+WritablePacket *SummaryTrigger::make_buffer() {
+	return Packet::make(sizeof(empower_summary_trigger) + _max_frames * sizeof(summary_entry));
+}
+
+void SummaryTrigger::capture(EtherAddress ra, EtherAddress ta, uint64_t tsft, uint16_t flags, uint16_t seq,
+		int8_t rssi, uint8_t rate, uint8_t type, uint8_t subtype, uint32_t length) {
+	_lock.acquire();
+	if (!_active || _nframes >= _max_frames) {
+		_dropped++;
+		_period_drops++;
+		_lock.release();
+		return;
+	}
+	summary_entry *entry = (summary_entry *) (_active->data() + sizeof(empower_summary_trigger)) + _nframes;
+	entry->set_ra(ra);
+	entry->set_ta(ta);
+	entry->set_tsft(tsft);
+	entry->set_flags(flags);
+	entry->set_seq(seq);
+	entry->set_rssi(rssi);
+	entry->set_rate(rate);
+	entry->set_length(length);
+	entry->set_type(type);
+	entry->set_subtype(subtype);
+	_nframes++;
+	_lock.release();
+}
+
+WritablePacket *SummaryTrigger::swap(uint16_t &nframes) {
+
+	// the allocation of the previous period failed, retry it here rather
+	// than on the RX path
+	if (!_spare) {
+		_spare = make_buffer();
+		if (!_spare) {
+			return 0;
+		}
+	}
+
+	_lock.acquire();
+	WritablePacket *full = _active;
+	nframes = _nframes;
+	if (_period_drops) {
+		_overflows++;
+	}
+	_active = _spare;
+	_nframes = 0;
+	_period_drops = 0;
+	_lock.release();
+
+	_spare = make_buffer();
+
+	if (full) {
+		full->take((_max_frames - nframes) * sizeof(summary_entry));
+	}
+
+	return full;
+
 }
 
 String SummaryTrigger::unparse() {
@@ -41,7 +109,13 @@ String SummaryTrigger::unparse() {
 	sa << " period ";
 	sa << _period;
 	sa << " frames ";
-	sa << _frames.size();
+	sa << _nframes;
+	sa << " max_frames ";
+	sa << _max_frames;
+	sa << " dropped ";
+	sa << _dropped;
+	sa << " overflows ";
+	sa << _overflows;
 	sa << " sent ";
 	sa << _sent;
 	return sa.take_string();
@@ -4,13 +4,19 @@
 #include <click/hashcode.hh>
 #include <click/timer.hh>
 #include <click/vector.hh>
+#include <click/packet.hh>
+#include <click/sync.hh>
 #include "trigger.hh"
-#include "frame.hh"
 CLICK_DECLS
 
-typedef Vector<Frame> FramesList;
-typedef FramesList::iterator FIter;
-
+/*
+ * Frames matching a summary trigger are written by the RX path straight into
+ * a preallocated summary message, in wire format. Two buffers are kept: the
+ * RX path fills the active one while the spare waits; at the end of the
+ * period the control path swaps them under a spinlock held just for the
+ * pointer swap, and sends the filled one. A buffer holds at most _max_frames
+ * entries, frames over the budget are dropped and counted.
+ */
 class SummaryTrigger: public Trigger {
 
 public:
@@ -19,17 +25,34 @@ public:
 	int _iface;
 	uint32_t _sent;
 	int16_t _limit;
-	FramesList _frames;
+	uint32_t _max_frames;
+	uint32_t _dropped;
+	uint32_t _overflows;
 
-	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
+	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, uint32_t, EmpowerLVAPManager *, EmpowerRXStats *);
 	~SummaryTrigger();
 
+	void capture(EtherAddress, EtherAddress, uint64_t, uint16_t, uint16_t, int8_t, uint8_t, uint8_t, uint8_t, uint32_t);
+	WritablePacket *swap(uint16_t &);
+
+	uint32_t frames() const { return _nframes; }
+
 	String unparse();
 
 	inline bool operator==(const SummaryTrigger &b) {
 		return (_iface == b._iface) && (_eth == b._eth);
 	}
 
+private:
+
+	SimpleSpinlock _lock;
+	WritablePacket *_active;
+	WritablePacket *_spare;
+	uint32_t _nframes;
+	uint32_t _period_drops;
+
+	WritablePacket *make_buffer();
+
 };
 
 CLICK_ENDDECLS
@@ -11,16 +11,76 @@
 CLICK_DECLS
 
 ScyllaWifiDupeFilter::ScyllaWifiDupeFilter() :
-		_debug(false), _buffer_size(10) {
+		_debug(false), _scan(false), _buffer_size(10), _timeout(300), _clock(0),
+		_expired(0), _timer(this) {
 }
 
 ScyllaWifiDupeFilter::~ScyllaWifiDupeFilter() {
 }
 
 int ScyllaWifiDupeFilter::configure(Vector<String> &conf, ErrorHandler *errh) {
-	return Args(conf, this, errh).read("BUFFER_SIZE", _buffer_size)
-			                     .read("DEBUG", _debug)
-						         .complete();
+	int buffer_size = _buffer_size;
+	if (Args(conf, this, errh).read("BUFFER_SIZE", buffer_size)
+			                  .read("TIMEOUT", _timeout)
+			                  .read("SCAN", _scan)
+			                  .read("DEBUG", _debug)
+						      .complete() < 0)
+		return -1;
+	if (buffer_size < 1 || buffer_size > SeqWindow::MAX_SIZE)
+		return errh->error("BUFFER_SIZE must be between 1 and %d", SeqWindow::MAX_SIZE);
+	_buffer_size = buffer_size;
+	return 0;
+}
+
+int ScyllaWifiDupeFilter::initialize(ErrorHandler *) {
+	_timer.initialize(this);
+	_timer.schedule_after_sec(1);
+	return 0;
+}
+
+void ScyllaWifiDupeFilter::run_timer(Timer *) {
+	_clock++;
+	expire();
+	_timer.reschedule_after_sec(1);
+}
+
+void ScyllaWifiDupeFilter::expire() {
+	if (!_timeout) {
+		return;
+	}
+	Vector<EtherAddress> expired;
+	for (DupesIter it = _dupes_table.begin(); it.live(); it++) {
+		if (_clock - it.value()._last >= _timeout) {
+			expired.push_back(it.key());
+		}
+	}
+	for (int i = 0; i < expired.size(); i++) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: removing %s",
+					this, __func__, expired[i].unparse().c_str());
+		}
+		_dupes_table.remove(expired[i]);
+	}
+	_expired += expired.size();
+}
+
+bool ScyllaWifiDupeFilter::is_dupe(const EtherAddress &src, uint16_t seq) {
+
+	DupeFilterDstInfo *nfo = _dupes_table.findp(src);
+
+	if (!nfo) {
+		_dupes_table.insert(src, DupeFilterDstInfo(src, _buffer_size, _clock, _scan));
+		nfo = _dupes_table.findp(src);
+	}
+
+	nfo->_last = _clock;
+
+	if (nfo->test_and_set(seq, _scan)) {
+		nfo->_dupes++;
+		return true;
+	}
+
+	return false;
 }
 
 Packet *
@@ -32,38 +92,33 @@ ScyllaWifiDupeFilter::simple_action(Packet *p_in) {
 		return p_in;
 	}
 
-	EtherAddress src = EtherAddress(w->i_addr2);
 	EtherAddress dst = EtherAddress(w->i_addr1);
-	uint16_t seq = le16_to_cpu(w->i_seq) >> WIFI_SEQ_SEQ_SHIFT;
 	uint8_t frag = le16_to_cpu(w->i_seq) & WIFI_SEQ_FRAG_MASK;
 	uint8_t more_frag = w->i_fc[1] & WIFI_FC1_MORE_FRAG;
 
 	bool is_frag = frag || more_frag;
 
-	DupeFilterDstInfo *nfo = _dupes_table.findp(src);
-
 	if ((w->i_fc[0] & WIFI_FC0_TYPE_CTL) || dst.is_group() || is_frag) {
 		return p_in;
 	}
 
-	if (!nfo) {
-		_dupes_table.insert(src, DupeFilterDstInfo(src, _buffer_size));
-		nfo = _dupes_table.findp(src);
-	}
+	EtherAddress src = EtherAddress(w->i_addr2);
+	uint16_t seq = le16_to_cpu(w->i_seq) >> WIFI_SEQ_SEQ_SHIFT;
 
-	if (nfo->_buffer->contains(seq)) {
-		nfo->_dupes++;
+	if (is_dupe(src, seq)) {
 		p_in->kill();
 		return 0;
 	}
 
-	nfo->_buffer->add(seq);
 	return p_in;
 }
 
 enum {
 	H_DEBUG,
-	H_DUPES_TABLE
+	H_DUPES_TABLE,
+	H_STATIONS,
+	H_EXPIRED,
+	H_RESET
 };
 
 String ScyllaWifiDupeFilter::read_handler(Element *e, void *thunk) {
@@ -75,11 +130,15 @@ String ScyllaWifiDupeFilter::read_handler(Element *e, void *thunk) {
 		StringAccum sa;
 		for (DupesIter it = td->dupes_table()->begin(); it.live(); it++) {
 			sa << it.value()._eth.unparse() << ' ' << it.value()._dupes << ' '
-					<< it.value()._buffer_size << it.value()._buffer->unparse()
+					<< it.value()._window.size() << it.value().unparse(td->_scan)
 					<< ' ' << "\n";
 		}
 		return sa.take_string();
 	}
+	case H_STATIONS:
+		return String(td->_dupes_table.size()) + "\n";
+	case H_EXPIRED:
+		return String(td->_expired) + "\n";
 	default:
 		return String();
 	}
@@ -114,17 +173,24 @@ int ScyllaWifiDupeFilter::write_handler(const String &in_s, Element *e,
 		if (!IntArg().parse(tokens[2], buffer_size)) {
 			return errh->error("error param %s: must start with int", tokens[2].c_str());
 		}
-		SeqBuffer * buffer = new SeqBuffer(buffer_size);
+		if (buffer_size < 1 || buffer_size > SeqWindow::MAX_SIZE) {
+			return errh->error("error param %s: window size must be between 1 and %d", tokens[2].c_str(), SeqWindow::MAX_SIZE);
+		}
+		DupeFilterDstInfo nfo(eth, buffer_size, f->_clock, f->_scan);
+		nfo._dupes = dupes;
 		for (int i = 3; i < tokens.size(); i++) {
 			int seq;
 			if (!IntArg().parse(tokens[i], seq)) {
 				return errh->error("error param %s: must start with int", tokens[i].c_str());
 			}
-			buffer->add(seq);
+			nfo.test_and_set(seq, f->_scan);
 		}
-		f->dupes_table()->insert(eth, DupeFilterDstInfo(eth, dupes, buffer_size, buffer));
+		f->dupes_table()->insert(eth, nfo);
 		break;
 	}
+	case H_RESET:
+		f->_dupes_table.clear();
+		break;
 	}
 	return 0;
 
@@ -135,6 +201,9 @@ void ScyllaWifiDupeFilter::add_handlers() {
 	add_read_handler("dupes_table", read_handler, (void *) H_DUPES_TABLE);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 	add_write_handler("dupes_table", write_handler, (void *) H_DUPES_TABLE);
+	add_read_handler("stations", read_handler, (void *) H_STATIONS);
+	add_read_handler("expired", read_handler, (void *) H_EXPIRED);
+	add_write_handler("reset", write_handler, (void *) H_RESET, Handler::BUTTON);
 }
 
 CLICK_ENDDECLS
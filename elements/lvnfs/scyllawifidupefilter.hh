@@ -3,115 +3,226 @@
 #include <click/element.hh>
 #include <click/string.hh>
 #include <click/hashmap.hh>
+#include <click/straccum.hh>
+#include <click/etheraddress.hh>
+#include <click/timer.hh>
 CLICK_DECLS
 
-class SeqBuffer {
+/*
+=c
+
+ScyllaWifiDupeFilter([I<KEYWORDS>])
+
+=s lvnf
+
+Filters out duplicate 802.11 frames based on their sequence number.
+
+=d
+
+Drops a unicast, unfragmented frame when the sequence number was already
+seen from its transmitter among the last BUFFER_SIZE sequence numbers. The
+window of each transmitter is a bitmap of the whole sequence number space,
+so testing and recording a sequence number takes constant time whatever
+BUFFER_SIZE is. A sequence number older than the window restarts it.
+
+Keyword arguments are:
+
+=over 8
+
+=item BUFFER_SIZE
+
+Size of the window in sequence numbers, between 1 and 2048. Default is 10.
+
+=item TIMEOUT
+
+Seconds after which a silent transmitter is removed, 0 keeps transmitters
+forever. Default is 300.
+
+=item SCAN
+
+Boolean. Keep the last BUFFER_SIZE sequence numbers of each transmitter in
+a ring and scan all of it for every frame instead, as previous versions
+did. Only meant to compare the two, see
+examples/scyllawifidupefilter-replay.click. Default is false.
+
+=item DEBUG
+
+Turn debug on/off
+
+=back 8
+
+=h dupes_table read/write
+One line per transmitter with its address, its number of duplicates, the
+window size and the sequence numbers in the window from the oldest. Writing
+a line in the same format restores a transmitter.
+
+=h stations read-only
+Number of transmitters in the table.
+
+=h expired read-only
+Number of transmitters removed after TIMEOUT.
+
+=h reset write-only
+Clears the table.
+
+*/
+
+// The sequence numbers seen from one transmitter among the last _size
+// ones, with one bit for each of the 4096 802.11 sequence numbers
+class SeqWindow {
 public:
-	SeqBuffer(unsigned int period) :
-		period(period), window(new int[period]), head(NULL), tail(NULL) {
-		assert(period >= 1);
-	}
-	~SeqBuffer() {
-		delete[] window;
-	}
-	// Adds a value to the average, pushing one out if necessary
-	void add(int val) {
-		// Special case: Initialisation
-		if (head == NULL) {
-			head = window;
-			*head = val;
-			tail = head;
-			inc(tail);
-			return;
+
+	enum { SEQ_SPACE = 4096, MAX_SIZE = SEQ_SPACE / 2 };
+
+	SeqWindow(unsigned int size = 10) : _size(size), _top(0), _empty(true) {
+		assert(size >= 1 && size <= MAX_SIZE);
+		memset(_bits, 0, sizeof(_bits));
+	}
+
+	// Marks seq as seen, returns whether it already was
+	bool test_and_set(uint16_t seq) {
+		seq &= SEQ_SPACE - 1;
+		uint16_t ahead = (seq - _top) & (SEQ_SPACE - 1);
+		if (_empty || (ahead >= SEQ_SPACE / 2 && (unsigned) (SEQ_SPACE - ahead) >= _size)) {
+			// first frame, or too old for the window: the transmitter
+			// restarted its sequence numbers
+			reset(seq);
+			return false;
 		}
-		// Were we already full?
-		if (head == tail) {
-			// Make room
-			inc(head);
+		if (ahead && ahead < SEQ_SPACE / 2) {
+			// the oldest min(ahead, _size) sequence numbers leave the window
+			clear(_top - _size + 1, ahead < _size ? ahead : _size);
+			_top = seq;
+			set(seq);
+			return false;
 		}
-		// Write the value in the next spot.
-		*tail = val;
-		inc(tail);
+		if (test(seq))
+			return true;
+		set(seq);
+		return false;
+	}
+
+	void reset(uint16_t seq) {
+		if (!_empty)
+			clear(_top - _size + 1, _size);
+		_empty = false;
+		_top = seq & (SEQ_SPACE - 1);
+		set(_top);
+	}
+
+	unsigned int size() const {
+		return _size;
 	}
 
-	String unparse() {
+	String unparse() const {
 		StringAccum sa;
-		if (!head) {
+		if (_empty) {
 			return sa.take_string();
 		}
-		int * ptr = head;
-		do {
-			sa << ' ' << *ptr;
-			inc(ptr);
-		} while (ptr != head);
+		for (int age = _size - 1; age >= 0; age--) {
+			uint16_t seq = (_top - age) & (SEQ_SPACE - 1);
+			if (test(seq)) {
+				sa << ' ' << seq;
+			}
+		}
 		return sa.take_string();
 	}
 
-	bool contains(int val) {
-		if (!head) {
-			return false;
+private:
+
+	unsigned int _size;
+	uint16_t _top; // Newest sequence number in the window
+	bool _empty;
+	uint64_t _bits[SEQ_SPACE / 64];
+
+	bool test(uint16_t seq) const {
+		return _bits[seq >> 6] & (1ULL << (seq & 63));
+	}
+
+	void set(uint16_t seq) {
+		_bits[seq >> 6] |= 1ULL << (seq & 63);
+	}
+
+	// Clears count bits from seq on, wrapping around the sequence space
+	void clear(uint16_t seq, unsigned int count) {
+		while (count) {
+			seq &= SEQ_SPACE - 1;
+			unsigned int bit = seq & 63;
+			unsigned int n = 64 - bit < count ? 64 - bit : count;
+			uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+			_bits[seq >> 6] &= ~mask;
+			seq += n;
+			count -= n;
 		}
-		int * ptr = head;
-		do {
-			if (val == *ptr) {
-				return true;
-			}
-			inc(ptr);
-		} while (ptr != head);
-		return false;
 	}
 
-private:
+};
 
-	unsigned int period;
-	int * window; // Holds the sequence numbers
+// The last _size sequence numbers seen from one transmitter, scanned in
+// full for every frame (SCAN)
+class SeqBuffer {
+public:
 
-	// Logically, head is before tail
-	int * head; // Points at the oldest element we've stored.
-	int * tail; // Points at the newest element we've stored.
+	SeqBuffer(unsigned int size = 0) : _size(size), _next(0) {
+	}
 
-	// Bumps the given pointer up by one.
-	// Wraps to the start of the array if needed.
-	void inc(int * & p) {
-		if (++p >= window + period) {
-			p = window;
+	bool contains(uint16_t seq) const {
+		for (int i = 0; i < _seqs.size(); i++) {
+			if (_seqs[i] == seq)
+				return true;
 		}
+		return false;
 	}
 
-	// Returns how many sequence numbers
-	ptrdiff_t size() const {
-		if (head == NULL)
-			return 0;
-		if (head == tail)
-			return period;
-		return (period + tail - head) % period;
+	// Adds seq, pushing the oldest one out if the ring is full
+	void add(uint16_t seq) {
+		if ((unsigned) _seqs.size() < _size) {
+			_seqs.push_back(seq);
+			return;
+		}
+		_seqs[_next] = seq;
+		_next = (_next + 1) % _size;
+	}
+
+	String unparse() const {
+		StringAccum sa;
+		for (int i = 0; i < _seqs.size(); i++) {
+			sa << ' ' << _seqs[(_next + i) % _seqs.size()];
+		}
+		return sa.take_string();
 	}
 
+private:
+
+	unsigned int _size;
+	int _next; // Oldest sequence number once the ring is full
+	Vector<uint16_t> _seqs;
+
 };
 
 class DupeFilterDstInfo {
 public:
 	EtherAddress _eth;
 	int _dupes;
-	int _buffer_size;
-	SeqBuffer * _buffer;
-	DupeFilterDstInfo() {
-		_eth = EtherAddress();
-		_dupes = 0;
-		_buffer_size = 5;
-		_buffer = new SeqBuffer(_buffer_size);
-	}
-	DupeFilterDstInfo(EtherAddress eth, int buffer_size) {
-		_eth = eth;
-		_dupes = 0;
-		_buffer_size = buffer_size;
-		_buffer = new SeqBuffer(_buffer_size);
-	}
-	DupeFilterDstInfo(EtherAddress eth, int dupes, int buffer_size, SeqBuffer * buffer) {
-		_eth = eth;
-		_dupes = dupes;
-		_buffer_size = buffer_size;
-		_buffer = buffer;
+	uint32_t _last;
+	SeqWindow _window;
+	SeqBuffer _buffer;
+	DupeFilterDstInfo() : _dupes(0), _last(0) {
+	}
+	DupeFilterDstInfo(EtherAddress eth, int buffer_size, uint32_t now, bool scan) :
+		_eth(eth), _dupes(0), _last(now), _window(buffer_size),
+		_buffer(scan ? buffer_size : 0) {
+	}
+	bool test_and_set(uint16_t seq, bool scan) {
+		if (!scan)
+			return _window.test_and_set(seq);
+		if (_buffer.contains(seq))
+			return true;
+		_buffer.add(seq);
+		return false;
+	}
+	String unparse(bool scan) const {
+		return scan ? _buffer.unparse() : _window.unparse();
 	}
 };
 
@@ -131,9 +242,16 @@ class ScyllaWifiDupeFilter : public Element {
 
   int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
   bool can_live_reconfigure() const	{ return true; }
+  int initialize(ErrorHandler *) CLICK_COLD;
+  void run_timer(Timer *);
 
   Packet *simple_action(Packet *);
 
+  // Records seq for src, returns whether it is a duplicate
+  bool is_dupe(const EtherAddress &src, uint16_t seq);
+  // Removes the transmitters silent for TIMEOUT seconds
+  void expire();
+
   void add_handlers() CLICK_COLD;
 
   DupesTable* dupes_table() { return &_dupes_table; }
@@ -141,7 +259,12 @@ class ScyllaWifiDupeFilter : public Element {
 private:
 
   bool _debug;
+  bool _scan;
   int _buffer_size;
+  uint32_t _timeout;
+  uint32_t _clock;
+  uint32_t _expired;
+  Timer _timer;
 
   DupesTable _dupes_table;
 
@@ -0,0 +1,395 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * minstreltest.{cc,hh} -- regression test and benchmark element for Minstrel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "minstreltest.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <click/straccum.hh>
+#include <clicknet/wifi.h>
+#include <elements/wifi/minstrel.hh>
+CLICK_DECLS
+
+MinstrelTest::MinstrelTest()
+    : _rc(0), _packets(200000)
+{
+    _neighbors.push_back(16);
+    _neighbors.push_back(256);
+    _neighbors.push_back(4096);
+}
+
+int
+MinstrelTest::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String neighbors_s;
+    if (Args(conf, this, errh)
+	.read_mp("RC", ElementCastArg("Minstrel"), _rc)
+	.read("NEIGHBORS", AnyArg(), neighbors_s)
+	.read("PACKETS", _packets)
+	.complete() < 0)
+	return -1;
+    Vector<String> tokens;
+    Vector<int> neighbors;
+    cp_spacevec(cp_unquote(neighbors_s), tokens);
+    for (int i = 0; i < tokens.size(); i++) {
+	int n;
+	if (!IntArg().parse(tokens[i], n) || n < 1 || n > 65535)
+	    return errh->error("NEIGHBORS must be between 1 and 65535");
+	neighbors.push_back(n);
+    }
+    if (neighbors.size())
+	_neighbors = neighbors;
+    if (!_packets)
+	return errh->error("PACKETS must be positive");
+    return 0;
+}
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test %<%s%> failed", __FILE__, __LINE__, #x);
+
+namespace {
+
+// The statistics of a neighbor before the contiguous layout: one vector
+// per field, and a scan of the rates for every result.
+class LegacyDstInfo { public:
+
+    Vector<int> rates;
+    Vector<int> successes;
+    Vector<int> attempts;
+    Vector<int> last_successes;
+    Vector<int> last_attempts;
+    Vector<int> hist_successes;
+    Vector<int> hist_attempts;
+    Vector<int> cur_prob;
+    Vector<int> cur_tp;
+    Vector<int> probability;
+    Vector<int> sample_limit;
+    int max_tp_rate;
+    int max_tp_rate2;
+    int max_prob_rate;
+    bool ht;
+
+    LegacyDstInfo(const Vector<int> &supported, bool ht_rates)
+	: rates(supported), successes(supported.size(), 0), attempts(supported.size(), 0),
+	  last_successes(supported.size(), 0), last_attempts(supported.size(), 0),
+	  hist_successes(supported.size(), 0), hist_attempts(supported.size(), 0),
+	  cur_prob(supported.size(), 0), cur_tp(supported.size(), 0),
+	  probability(supported.size(), 0), sample_limit(supported.size(), -1),
+	  max_tp_rate(0), max_tp_rate2(0), max_prob_rate(0), ht(ht_rates) {
+    }
+
+    int rate_index(int rate) {
+	for (int x = 0; x < rates.size(); x++)
+	    if (rate == rates[x])
+		return x;
+	return -1;
+    }
+
+    void add_result(int rate, int tries, int success) {
+	int ndx = rate_index(rate);
+	if (ndx >= 0) {
+	    successes[ndx] += success;
+	    attempts[ndx] += tries;
+	}
+    }
+
+    void update(unsigned ewma_level) {
+	int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
+	int max_prob = 0, index_max_prob = 0;
+	int i;
+	uint32_t p, usecs;
+	for (i = 0; i < rates.size(); i++) {
+	    if (ht)
+		usecs = calc_usecs_wifi_packet_ht(1500, rates[i], 0);
+	    else
+		usecs = calc_usecs_wifi_packet(1500, rates[i], 0);
+	    if (!usecs)
+		usecs = 1000000;
+	    if (attempts[i]) {
+		p = (successes[i] * 18000) / attempts[i];
+		hist_successes[i] += successes[i];
+		hist_attempts[i] += attempts[i];
+		cur_prob[i] = p;
+		p = ((p * (100 - ewma_level)) + (probability[i] * ewma_level)) / 100;
+		probability[i] = p;
+		cur_tp[i] = p * (1000000 / usecs);
+	    }
+	    last_successes[i] = successes[i];
+	    last_attempts[i] = attempts[i];
+	    successes[i] = 0;
+	    attempts[i] = 0;
+	    if ((probability[i] > 17100) || (probability[i] < 1800))
+		sample_limit[i] = 4;
+	    else
+		sample_limit[i] = -1;
+	}
+	for (i = 0; i < rates.size(); i++) {
+	    if (max_tp < cur_tp[i]) {
+		index_max_tp = i;
+		max_tp = cur_tp[i];
+	    }
+	    if (max_prob < probability[i]) {
+		index_max_prob = i;
+		max_prob = probability[i];
+	    }
+	}
+	max_tp = 0;
+	for (i = 0; i < rates.size(); i++) {
+	    if (i == index_max_tp)
+		continue;
+	    if (max_tp < cur_tp[i]) {
+		index_max_tp2 = i;
+		max_tp = cur_tp[i];
+	    }
+	}
+	max_tp_rate = index_max_tp;
+	max_tp_rate2 = index_max_tp2;
+	max_prob_rate = index_max_prob;
+    }
+
+};
+
+bool
+same_stats(const MinstrelDstInfo &nfo, const LegacyDstInfo &legacy)
+{
+    if (nfo.rates.size() != legacy.rates.size()
+	|| nfo.max_tp_rate != legacy.max_tp_rate
+	|| nfo.max_tp_rate2 != legacy.max_tp_rate2
+	|| nfo.max_prob_rate != legacy.max_prob_rate)
+	return false;
+    if (nfo.chain[0] != legacy.rates[legacy.max_tp_rate]
+	|| nfo.chain[1] != legacy.rates[legacy.max_tp_rate2]
+	|| nfo.chain[2] != legacy.rates[legacy.max_prob_rate]
+	|| nfo.chain[3] != legacy.rates[0])
+	return false;
+    for (int i = 0; i < nfo.rates.size(); i++) {
+	const MinstrelRateStats &r = nfo.rates[i];
+	if (r.rate != legacy.rates[i]
+	    || r.successes != legacy.successes[i]
+	    || r.attempts != legacy.attempts[i]
+	    || r.last_successes != legacy.last_successes[i]
+	    || r.last_attempts != legacy.last_attempts[i]
+	    || r.hist_successes != legacy.hist_successes[i]
+	    || r.hist_attempts != legacy.hist_attempts[i]
+	    || r.cur_prob != legacy.cur_prob[i]
+	    || r.cur_tp != legacy.cur_tp[i]
+	    || r.probability != legacy.probability[i]
+	    || r.sample_limit != legacy.sample_limit[i])
+	    return false;
+    }
+    return true;
+}
+
+// random results, mostly for the rates of the set, the faster the rate the
+// more likely the failure
+bool
+same_results(const Vector<int> &supported, bool ht, int periods)
+{
+    MinstrelDstInfo nfo(EtherAddress(), supported, ht);
+    LegacyDstInfo legacy(supported, ht);
+    uint32_t x = 1;
+    for (int period = 0; period < periods; period++) {
+	for (int k = 0; k < 200; k++) {
+	    x = x * 1103515245 + 12345;
+	    int ndx = (x >> 16) % (supported.size() + 2);
+	    int rate = ndx < supported.size() ? supported[ndx] : (int) ((x >> 8) & 0xFF) - 64;
+	    x = x * 1103515245 + 12345;
+	    int tries = 1 + (x >> 16) % 4;
+	    x = x * 1103515245 + 12345;
+	    int success = (int) ((x >> 16) % (supported.size() + 1)) > ndx;
+	    nfo.add_result(rate, tries, success);
+	    legacy.add_result(rate, tries, success);
+	}
+	if (!same_stats(nfo, legacy))
+	    return false;
+	nfo.update(75);
+	legacy.update(75);
+	if (!same_stats(nfo, legacy))
+	    return false;
+    }
+    return true;
+}
+
+EtherAddress
+station(int i)
+{
+    unsigned char a[6] = { 0x02, 0x00, 0x00, 0x00, (unsigned char) (i >> 8), (unsigned char) i };
+    return EtherAddress(a);
+}
+
+Packet *
+make_frame(const EtherAddress &dst)
+{
+    WritablePacket *p = Packet::make(64);
+    if (!p)
+	return 0;
+    memset(p->data(), 0, p->length());
+    click_wifi *w = (click_wifi *) p->data();
+    w->i_fc[0] = WIFI_FC0_TYPE_DATA | WIFI_FC0_SUBTYPE_DATA;
+    w->i_fc[1] = WIFI_FC1_DIR_FROMDS;
+    memcpy(w->i_addr1, dst.data(), WIFI_ADDR_LEN);
+    memcpy(w->i_addr2, station(0xFFFF).data(), WIFI_ADDR_LEN);
+    memcpy(w->i_addr3, station(0xFFFF).data(), WIFI_ADDR_LEN);
+    return p;
+}
+
+__attribute__((noinline)) void
+assign_rate(Minstrel *rc, Packet *p)
+{
+    rc->assign_rate(p);
+}
+
+__attribute__((noinline)) void
+process_feedback(Minstrel *rc, Packet *p)
+{
+    rc->process_feedback(p);
+}
+
+}
+
+int
+MinstrelTest::initialize(ErrorHandler *errh)
+{
+    // every rate of the set is found at its position, others are not
+    Vector<int> legacy_rates;
+    static const int legacy_mcs[] = { 2, 4, 11, 22, 12, 18, 24, 36, 48, 72, 96, 108 };
+    for (unsigned i = 0; i < sizeof(legacy_mcs) / sizeof(legacy_mcs[0]); i++)
+	legacy_rates.push_back(legacy_mcs[i]);
+    Vector<int> ht_rates;
+    for (int i = 0; i < 16; i++)
+	ht_rates.push_back(i);
+
+    MinstrelDstInfo a(station(1), legacy_rates, false);
+    for (int i = 0; i < legacy_rates.size(); i++)
+	CHECK(a.rate_index(legacy_rates[i]) == i);
+    CHECK(a.rate_index(0) == -1 && a.rate_index(5) == -1 && a.rate_index(-2) == -1);
+    CHECK(a.rate_index(127) == -1 && a.rate_index(128) == -1 && a.rate_index(1000) == -1);
+    CHECK(a.rates[3].sample_limit == -1 && a.rates[3].usecs == calc_usecs_wifi_packet(1500, 22, 0));
+
+    // a rate listed twice is found at its first position
+    Vector<int> twice(legacy_rates);
+    twice.push_back(11);
+    MinstrelDstInfo b(station(2), twice, false);
+    CHECK(b.rate_index(11) == 2 && b.rates.size() == 13);
+
+    // the same statistics and rate choices as before
+    CHECK(same_results(legacy_rates, false, 50));
+    CHECK(same_results(ht_rates, true, 50));
+    CHECK(same_results(twice, false, 50));
+
+    // the neighbor table keeps finding its neighbors as they come and go
+    TxPolicyInfo *txp = _rc->tx_policies()->default_tx_policy();
+    for (int i = 0; i < 8; i++)
+	CHECK(_rc->insert_neighbor(station(0xF000 + i), txp));
+    CHECK(_rc->forget_station(station(0xF002)) && _rc->forget_station(station(0xF000)));
+    CHECK(!_rc->forget_station(station(0xF000)));
+    MinstrelDstInfo info;
+    for (int i = 1; i < 8; i++)
+	CHECK(_rc->neighbor(station(0xF000 + i), info) == (i != 2) && (i == 2 || info.eth == station(0xF000 + i)));
+
+    // feedback is recorded against the rate of the frame
+    Packet *p = make_frame(station(0xF005));
+    CHECK(p);
+    _rc->assign_rate(p);
+    click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+    ceh->flags |= WIFI_EXTRA_TX_FAIL;
+    _rc->process_feedback(p);
+    ceh->flags &= ~WIFI_EXTRA_TX_FAIL;
+    _rc->process_feedback(p);
+    CHECK(_rc->neighbor(station(0xF005), info));
+    int ndx = info.rate_index(ceh->rate);
+    CHECK(ndx >= 0 && info.rates[ndx].attempts == 2 * ceh->max_tries && info.rates[ndx].successes == 1);
+    _rc->update_rates();
+    CHECK(_rc->neighbor(station(0xF005), info));
+    CHECK(info.rates[ndx].attempts == 0 && info.rates[ndx].last_attempts == 2 * ceh->max_tries);
+    CHECK(info.rates[ndx].cur_prob == 18000 / (2 * ceh->max_tries));
+    p->kill();
+    for (int i = 0; i < 8; i++)
+	_rc->forget_station(station(0xF000 + i));
+
+    errh->message("All tests pass!");
+    return 0;
+}
+
+String
+MinstrelTest::bench()
+{
+    StringAccum sa;
+    TxPolicyInfo *txp = _rc->tx_policies()->default_tx_policy();
+    for (int k = 0; k < _neighbors.size(); k++) {
+	int n = _neighbors[k];
+	for (int i = 0; i < n; i++)
+	    _rc->insert_neighbor(station(i), txp);
+	Packet *p = make_frame(station(0));
+	if (!p)
+	    return String();
+	uint8_t *ra = p->uniqueify()->data() + 4;
+
+	// the frame stays in cache, only its receiver changes
+	Vector<EtherAddress> dsts;
+	uint32_t x = 1;
+	for (uint32_t i = 0; i < _packets; i++) {
+	    x = x * 1103515245 + 12345;
+	    dsts.push_back(station((x >> 8) % n));
+	}
+
+	// one frame in four fails
+	click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	_rc->assign_rate(p);
+	click_cycles_t c0 = click_get_cycles();
+	for (uint32_t i = 0; i < _packets; i++) {
+	    memcpy(ra, dsts[i].data(), 6);
+	    ceh->flags = (i & 3) ? (ceh->flags & ~WIFI_EXTRA_TX_FAIL) : (ceh->flags | WIFI_EXTRA_TX_FAIL);
+	    process_feedback(_rc, p);
+	}
+	click_cycles_t c1 = click_get_cycles();
+	_rc->update_rates();
+	click_cycles_t c2 = click_get_cycles();
+	for (uint32_t i = 0; i < _packets; i++) {
+	    memcpy(ra, dsts[i].data(), 6);
+	    assign_rate(_rc, p);
+	}
+	click_cycles_t c3 = click_get_cycles();
+	for (int i = 0; i < 10; i++)
+	    _rc->update_rates();
+	click_cycles_t c4 = click_get_cycles();
+
+	for (int i = 0; i < n; i++)
+	    _rc->forget_station(station(i));
+	p->kill();
+
+	sa << "neighbors " << n
+	   << ": assign_rate " << (uint64_t) ((c3 - c2) / _packets) << " cycles/frame"
+	   << ", process_feedback " << (uint64_t) ((c1 - c0) / _packets) << " cycles/frame"
+	   << ", update " << (uint64_t) ((c4 - c3) / (10 * n)) << " cycles/neighbor\n";
+    }
+    return sa.take_string();
+}
+
+String
+MinstrelTest::read_handler(Element *e, void *)
+{
+    return static_cast<MinstrelTest *>(e)->bench();
+}
+
+void
+MinstrelTest::add_handlers()
+{
+    add_read_handler("bench", read_handler, 0);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(MinstrelTest)
+ELEMENT_REQUIRES(Minstrel)
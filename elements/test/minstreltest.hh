@@ -0,0 +1,76 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_MINSTRELTEST_HH
+#define CLICK_MINSTRELTEST_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+MinstrelTest(RC, [I<KEYWORDS>])
+
+=s test
+
+runs regression tests and benchmarks for Minstrel
+
+=d
+
+MinstrelTest checks at initialization time the rate statistics of
+Minstrel: the rate to position table, the same statistics and rate choices
+as the per field vectors and rate scan they replaced for a random feedback
+stream, and the neighbor table of the RC element across additions and
+removals. RC must use an OFFSET of 4, so that it reads the receiver of
+802.11 frames.
+
+Reading the bench handler measures, for each neighbor count, the cycles
+per frame of assign_rate() and process_feedback() on a unicast data frame to
+neighbors picked at random, and the cycles per neighbor of the periodic
+statistics update.
+
+Keyword arguments are:
+
+=over 8
+
+=item RC
+
+The Minstrel element under test.
+
+=item NEIGHBORS
+
+Neighbor counts to benchmark. Default is "16 256 4096".
+
+=item PACKETS
+
+Number of frames in each benchmark run. Default is 200000.
+
+=back
+
+=h bench read-only
+Runs the benchmark.
+
+=a Minstrel
+*/
+
+class MinstrelTest : public Element { public:
+
+    MinstrelTest() CLICK_COLD;
+
+    const char *class_name() const		{ return "MinstrelTest"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+  private:
+
+    class Minstrel *_rc;
+    Vector<int> _neighbors;
+    uint32_t _packets;
+
+    String bench();
+    static String read_handler(Element *, void *);
+
+};
+
+CLICK_ENDDECLS
+#endif
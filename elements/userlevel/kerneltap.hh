@@ -49,7 +49,9 @@ be set.
 =item HEADROOM
 
 Integer.  The number of bytes left empty before the packet data (to leave room
-for additional encapsulation headers).  Default is 0.
+for additional encapsulation headers).  Default is Packet::default_headroom.
+Elements that encapsulate in place, such as EmpowerQOSManager, check at
+initialization that it is large enough.
 
 =item IGNORE_QUEUE_OVERFLOWS
 
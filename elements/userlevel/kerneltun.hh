@@ -47,7 +47,8 @@ Integer. The maximum number of packets to emit per scheduling. Default is 1.
 =item HEADROOM
 
 Integer. The number of bytes left empty before output packet data to leave
-room for additional encapsulation headers. Default is 28.
+room for additional encapsulation headers. Default is
+Packet::default_headroom.
 
 =item MTU
 
@@ -122,6 +123,8 @@ class KernelTun : public Element { public:
     void cleanup(CleanupStage) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
+    unsigned headroom() const		{ return _headroom; }
+
     void selected(int fd, int mask);
 
     void push(int port, Packet *);
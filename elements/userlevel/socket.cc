@@ -59,7 +59,8 @@ void Socket::run_timer(Timer *) {
 
   ErrorHandler *errh = new ErrorHandler();
 
-  if (_active == -1) {
+  // only clients reconnect, a server keeps listening until a peer shows up
+  if (_client && _active == -1) {
     initialize(errh);
   }
 
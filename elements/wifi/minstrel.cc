@@ -29,90 +29,138 @@
 CLICK_DECLS
 
 Minstrel::Minstrel() 
-  : _tx_policies(0), _timer(this), _lookaround_rate(20), _offset(0),
-	_active(true), _period(500), _ewma_level(75), _debug(false) {
+  : _tx_policies(0), _timer(this), _airtime_generation(0), _airtime_rebuilds(0), _lookaround_rate(20),
+	_offset(0), _active(true), _period(500), _ewma_level(75), _debug(false) {
+	_default_airtime.build(1, false);
 }
 
 Minstrel::~Minstrel() {
+	for (int i = 0; i < _neighbors.size(); i++) {
+		delete _neighbors[i].airtime;
+	}
 }
 
-void Minstrel::run_timer(Timer *)
+const AirtimeTable * Minstrel::airtime(EtherAddress dst) {
+	const AirtimeTable *airtime = &_default_airtime;
+	_lock.acquire();
+	MinstrelDstInfo *nfo = find_neighbor(dst);
+	if (nfo && nfo->airtime) {
+		airtime = nfo->airtime;
+	}
+	_lock.release();
+	return airtime;
+}
+
+// publish a new airtime table for the neighbor, called with the lock held
+void Minstrel::set_airtime(MinstrelDstInfo *nfo, int rate) {
+	AirtimeTable *airtime = new AirtimeTable();
+	airtime->build(rate, nfo->ht);
+	click_fence();
+	if (nfo->airtime) {
+		retire_airtime(nfo->airtime);
+	}
+	nfo->airtime = airtime;
+	nfo->airtime_rate = rate;
+	// a new neighbor was costed with the default table until now
+	_airtime_generation++;
+}
+
+// called with the lock held, holders of a cached table pointer see the
+// generation change and fetch the current table again before the retired
+// one is freed
+void Minstrel::retire_airtime(const AirtimeTable *airtime) {
+	_reclaimer.retire(airtime);
+	_airtime_generation++;
+}
+
+// called with the lock held
+MinstrelDstInfo * Minstrel::add_neighbor(EtherAddress dst, TxPolicyInfo *txp) {
+	MinstrelDstInfo *nfo = find_neighbor(dst);
+	if (nfo && nfo->airtime) {
+		retire_airtime(nfo->airtime);
+	}
+	if (!nfo) {
+		_index.set(dst, _neighbors.size());
+		_neighbors.push_back(MinstrelDstInfo());
+		nfo = &_neighbors.back();
+	}
+	if (txp->_ht_mcs.size()) {
+		*nfo = MinstrelDstInfo(dst, txp->_ht_mcs, true);
+	} else {
+		*nfo = MinstrelDstInfo(dst, txp->_mcs, false);
+	}
+	if (nfo->rates.size()) {
+		set_airtime(nfo, nfo->rates[0].rate);
+	}
+	return nfo;
+}
+
+MinstrelDstInfo * Minstrel::insert_neighbor(EtherAddress dst, TxPolicyInfo *txp) {
+	_lock.acquire();
+	MinstrelDstInfo *nfo = add_neighbor(dst, txp);
+	_lock.release();
+	return nfo;
+}
+
+bool Minstrel::neighbor(EtherAddress dst, MinstrelDstInfo &info) {
+	_lock.acquire();
+	MinstrelDstInfo *nfo = find_neighbor(dst);
+	if (nfo) {
+		info = *nfo;
+	}
+	_lock.release();
+	return nfo != 0;
+}
+
+bool Minstrel::forget_station(EtherAddress dst) {
+	_lock.acquire();
+	int *i = _index.get_pointer(dst);
+	if (!i) {
+		_lock.release();
+		return false;
+	}
+	int ndx = *i;
+	if (_neighbors[ndx].airtime) {
+		retire_airtime(_neighbors[ndx].airtime);
+	}
+	// the last neighbor takes the place of the removed one
+	if (ndx != _neighbors.size() - 1) {
+		_neighbors[ndx] = _neighbors.back();
+		_index.set(_neighbors[ndx].eth, ndx);
+	}
+	_neighbors.pop_back();
+	_index.erase(dst);
+	_lock.release();
+	return true;
+}
+
+void Minstrel::update_rates()
 {
-	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
-		MinstrelDstInfo *nfo = &iter.value();
-		int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
-		int max_prob = 0, index_max_prob = 0;
-		uint32_t usecs;
-		int i;
-		uint32_t p;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
-				if (nfo->ht)
-					usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
-				else
-					usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
-
-				_transm_time.set(nfo->rates[i], usecs);
-			}
-			else
-			{
-				usecs = _transm_time.get(nfo->rates[i]);
-			}
-			if (!usecs) {
-				usecs = 1000000;
-			}
-			/* To avoid rounding issues, probabilities scale from 0 (0%)
-			 * to 18000 (100%) */
-			if (nfo->attempts[i]) {
-				p = (nfo->successes[i] * 18000) / nfo->attempts[i];
-				nfo->hist_successes[i] += nfo->successes[i];
-				nfo->hist_attempts[i] += nfo->attempts[i];
-				nfo->cur_prob[i] = p;
-				p = ((p * (100 - _ewma_level)) + (nfo->probability[i] * _ewma_level)) / 100;
-				nfo->probability[i] = p;
-				nfo->cur_tp[i] = p * (1000000 / usecs);
-			}
-			nfo->last_successes[i] = nfo->successes[i];
-			nfo->last_attempts[i] = nfo->attempts[i];
-			nfo->successes[i] = 0;
-			nfo->attempts[i] = 0;
-			/* Sample less often below the 10% chance of success.
-			 * Sample less often above the 95% chance of success. */
-			if ((nfo->probability[i] > 17100) || (nfo->probability[i] < 1800)) {
-				nfo->sample_limit[i] = 4;
-			} else {
-				nfo->sample_limit[i] = -1;
-			}
-		}
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp = i;
-				max_tp = nfo->cur_tp[i];
-			}
-			if (max_prob < nfo->probability[i]) {
-				index_max_prob = i;
-				max_prob = nfo->probability[i];
-			}
+	_lock.acquire();
+	for (int i = 0; i < _neighbors.size(); i++) {
+		MinstrelDstInfo *nfo = &_neighbors[i];
+		nfo->update(_ewma_level);
+		if (!nfo->rates.size()) {
+			continue;
 		}
-		max_tp = 0;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (i == index_max_tp) {
-				continue;
-			}
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp2 = i;
-				max_tp = nfo->cur_tp[i];
-			}
+		int rate = nfo->rates[nfo->max_tp_rate].rate;
+		if (!nfo->airtime || nfo->airtime_rate != rate) {
+			set_airtime(nfo, rate);
+			_airtime_rebuilds++;
 		}
-		nfo->max_tp_rate = index_max_tp;
-		nfo->max_tp_rate2 = index_max_tp2;
-		nfo->max_prob_rate = index_max_prob;
 	}
+	_lock.release();
+}
+
+void Minstrel::run_timer(Timer *)
+{
+	update_rates();
 	_timer.schedule_after_msec(_period);
 }
 
 int Minstrel::initialize(ErrorHandler *)
 {
+	_reclaimer.initialize(this);
 	_timer.initialize(this);
 	_timer.schedule_now();
 	return 0;
@@ -147,9 +195,11 @@ void Minstrel::process_feedback(Packet *p_in) {
 	}
 	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p_in);
 	int success = !(ceh->flags & WIFI_EXTRA_TX_FAIL);
-	MinstrelDstInfo *nfo = _neighbors.findp(dst);
+	_lock.acquire();
+	MinstrelDstInfo *nfo = find_neighbor(dst);
 	/* rate wasn't set */
 	if (!nfo) {
+		_lock.release();
 		if (_debug) {
 			click_chatter("%{element} :: %s :: no info for %s",
 					this, 
@@ -160,6 +210,7 @@ void Minstrel::process_feedback(Packet *p_in) {
 	}
 	/* rate is HT but feedback is legacy */
 	if (nfo->ht && !(ceh->flags & WIFI_EXTRA_MCS)) {
+		_lock.release();
 		if (_debug) {
 			click_chatter("%{element} :: %s :: rate is HT but feedback is legacy %u",
 					this,
@@ -169,7 +220,7 @@ void Minstrel::process_feedback(Packet *p_in) {
 		return;
 	}
 	nfo->add_result(ceh->rate, ceh->max_tries, success);
-	return;
+	_lock.release();
 }
 
 void Minstrel::assign_rate(Packet *p_in)
@@ -185,8 +236,8 @@ void Minstrel::assign_rate(Packet *p_in)
 
 	memset((void*)ceh, 0, sizeof(struct click_wifi_extra));
 
-	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
 	if (dst.is_group()) {
+		TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
 		ceh->flags |= WIFI_EXTRA_TX_NOACK;
 		if(!tx_policy || tx_policy->_ht_mcs.size() == 0) {
 			Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
@@ -229,9 +280,12 @@ void Minstrel::assign_rate(Packet *p_in)
 		return;
 	}
 
-	MinstrelDstInfo *nfo = _neighbors.findp(dst);
+	_lock.acquire();
+
+	MinstrelDstInfo *nfo = find_neighbor(dst);
 
 	if (!nfo || !nfo->rates.size()) {
+		TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
 		if (_debug) {
 			click_chatter("%{element} :: %s :: adding %s",
 					this, 
@@ -239,6 +293,7 @@ void Minstrel::assign_rate(Packet *p_in)
 					dst.unparse().c_str());
 		}
 		if (!tx_policy) {
+			_lock.release();
 			if (_debug) {
 				click_chatter("%{element} :: %s :: rate info not found for %s",
 						this, 
@@ -256,12 +311,15 @@ void Minstrel::assign_rate(Packet *p_in)
 			ceh->max_tries3 = 0;
 			return;
 		}
-		if (tx_policy->_ht_mcs.size()) {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_ht_mcs, true));
-			nfo = _neighbors.findp(dst);
-		} else {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_mcs, false));
-			nfo = _neighbors.findp(dst);
+		nfo = add_neighbor(dst, tx_policy);
+		if (!nfo->rates.size()) {
+			_lock.release();
+			ceh->rate = 2;
+			ceh->rate1 = -1;
+			ceh->rate2 = -1;
+			ceh->rate3 = -1;
+			ceh->max_tries = WIFI_MAX_RETRIES + 1;
+			return;
 		}
 	}
 
@@ -281,12 +339,13 @@ void Minstrel::assign_rate(Packet *p_in)
 		}
 		if (nfo->rates.size() > 0) {
 			int sample_ndx = click_random(0, nfo->rates.size() - 1);
-			if (nfo->sample_limit[sample_ndx] != 0) {
+			MinstrelRateStats *r = &nfo->rates[sample_ndx];
+			if (r->sample_limit != 0) {
 				sample = true;
 				ndx = sample_ndx;
 				nfo->sample_count++;
-				if (nfo->sample_limit[sample_ndx] > 0) {
-					nfo->sample_limit[sample_ndx]--;
+				if (r->sample_limit > 0) {
+					r->sample_limit--;
 				}
 			}
 		}
@@ -294,7 +353,7 @@ void Minstrel::assign_rate(Packet *p_in)
 	/* If the sampling rate already has a probability
 	 * of >95%, we shouldn't be attempting to use it,
 	 * as this only wastes precious airtime */
-	if (sample && (nfo->probability[ndx] > 17100)) {
+	if (sample && (nfo->rates[ndx].probability > 17100)) {
 		ndx = nfo->max_tp_rate;
 		sample = false;
 	}
@@ -306,27 +365,27 @@ void Minstrel::assign_rate(Packet *p_in)
 	}
 
 	if (sample) {
-		if (nfo->rates[ndx] < nfo->rates[nfo->max_tp_rate]) {
-			ceh->rate = nfo->rates[nfo->max_tp_rate];
-			ceh->rate1 = nfo->rates[ndx];
+		if (nfo->rates[ndx].rate < nfo->chain[0]) {
+			ceh->rate = nfo->chain[0];
+			ceh->rate1 = nfo->rates[ndx].rate;
 		} else {
-			ceh->rate = nfo->rates[ndx];
-			ceh->rate1 = nfo->rates[nfo->max_tp_rate];
+			ceh->rate = nfo->rates[ndx].rate;
+			ceh->rate1 = nfo->chain[0];
 		}
 	} else {
-		ceh->rate = nfo->rates[nfo->max_tp_rate];
-		ceh->rate1 = nfo->rates[nfo->max_tp_rate2];
+		ceh->rate = nfo->chain[0];
+		ceh->rate1 = nfo->chain[1];
 	}
 
-	ceh->rate2 = nfo->rates[nfo->max_prob_rate];
-	ceh->rate3 = nfo->rates[0];
+	ceh->rate2 = nfo->chain[2];
+	ceh->rate3 = nfo->chain[3];
 
 	ceh->max_tries = 4;
 	ceh->max_tries1 = 4;
 	ceh->max_tries2 = 4;
 	ceh->max_tries3 = 4;
 
-	return;
+	_lock.release();
 
 }
 
@@ -354,15 +413,16 @@ void Minstrel::push(int port, Packet *p_in)
 String Minstrel::print_rates()
 {
 	StringAccum sa;
-	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
-		MinstrelDstInfo *nfo = &iter.value();
-		sa << nfo->unparse();
+	_lock.acquire();
+	for (int i = 0; i < _neighbors.size(); i++) {
+		sa << _neighbors[i].unparse();
 	}
+	_lock.release();
 	return sa.take_string();
 }
 
 enum {
-	H_RATES, H_DEBUG
+	H_RATES, H_DEBUG, H_AIRTIME
 };
 
 String Minstrel::read_handler(Element *e, void *thunk) {
@@ -372,6 +432,8 @@ String Minstrel::read_handler(Element *e, void *thunk) {
 		return String(c->_debug) + "\n";
 	case H_RATES:
 		return c->print_rates();
+	case H_AIRTIME:
+		return String(c->_airtime_rebuilds) + "\n";
 	default:
 		return "<error>\n";
 	}
@@ -395,6 +457,7 @@ int Minstrel::write_handler(const String &in_s, Element *e, void *vparam, ErrorH
 void Minstrel::add_handlers() {
 	add_read_handler("rates", read_handler, H_RATES);
 	add_read_handler("debug", read_handler, H_DEBUG);
+	add_read_handler("airtime", read_handler, H_AIRTIME);
 	add_write_handler("debug", write_handler, H_DEBUG);
 }
 
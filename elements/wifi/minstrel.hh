@@ -2,11 +2,12 @@
 #define CLICK_MINSTREL_HH
 #include <click/element.hh>
 #include <click/etheraddress.hh>
-#include <click/bighashmap.hh>
 #include <click/glue.hh>
 #include <click/timer.hh>
 #include <click/hashtable.hh>
+#include <click/sync.hh>
 #include <elements/wifi/bitrate.hh>
+#include <elements/wifi/reclaimer.hh>
 #include "transmissionpolicies.hh"
 CLICK_DECLS
 
@@ -15,89 +16,234 @@ CLICK_DECLS
  * Minstrel([, I<KEYWORDS>])
  * =s Wifi
  * Minstrel wireless bit-rate selection algorithm
+ * =d
+ * Every neighbor also keeps a table with the airtime of a frame at its
+ * current max throughput rate, indexed by length in 64 byte buckets. The
+ * table is rebuilt only when the periodic update changes that rate, so
+ * schedulers can cost a frame with a single array lookup. Frames for
+ * unknown destinations are costed at the lowest rate.
+ *
+ * The neighbor table is protected by a spinlock, so that rates can be
+ * assigned and feedback processed on different threads. Airtime tables
+ * are never modified once published: a rate change builds a new table
+ * and the old one is retired to a Reclaimer, so schedulers can keep the
+ * pointer returned by airtime() for the duration of a batch without
+ * holding the lock. Every retirement bumps airtime_generation(), so
+ * a pointer kept across batches stays valid for as long as the generation
+ * it was fetched at is current.
+ *
+ * The statistics of the rates of a neighbor are kept in one contiguous
+ * block, and a table indexed by rate or MCS gives the position of a rate
+ * in it, so feedback is recorded without searching the rate set. The
+ * neighbors are stored in one array, which the periodic update sweeps in
+ * order, and are found through a hash table of their positions. The
+ * pointer returned by insert_neighbor() is only valid until the next
+ * neighbor is added or removed.
+ * =h airtime read-only
+ * Number of airtime table rebuilds.
  * =a SetTXRate, FilterTX
  */
 
+class AirtimeTable {
+public:
+
+	enum { BUCKET_SHIFT = 6, MAX_LENGTH = 8192, NBUCKETS = MAX_LENGTH >> BUCKET_SHIFT };
+
+	AirtimeTable() : _rate(-1), _ht(false) {
+		memset(_usecs, 0, sizeof(_usecs));
+	}
+
+	// each bucket is costed at its longest frame, longer frames use the last one
+	void build(int rate, bool ht) {
+		for (int i = 0; i < NBUCKETS; i++) {
+			int length = ((i + 1) << BUCKET_SHIFT) - 1;
+			if (ht) {
+				_usecs[i] = calc_usecs_wifi_packet_ht(length, rate, 0);
+			} else {
+				_usecs[i] = calc_usecs_wifi_packet(length, rate, 0);
+			}
+		}
+		_rate = rate;
+		_ht = ht;
+	}
+
+	uint32_t usecs(uint32_t length) const {
+		uint32_t bucket = length >> BUCKET_SHIFT;
+		return _usecs[bucket < NBUCKETS ? bucket : NBUCKETS - 1];
+	}
+
+	int rate() const { return _rate; }
+	bool valid() const { return _rate >= 0; }
+
+private:
+
+	int _rate;
+	bool _ht;
+	uint32_t _usecs[NBUCKETS];
+
+};
+
+
+// Statistics of one rate, probabilities scale from 0 (0%) to 18000 (100%)
+struct MinstrelRateStats {
+public:
+	int rate;
+	int successes;
+	int attempts;
+	int probability;
+	int sample_limit;
+	int cur_prob;
+	int cur_tp;
+	int last_successes;
+	int last_attempts;
+	int hist_successes;
+	int hist_attempts;
+	uint32_t usecs;
+	MinstrelRateStats() {
+		memset(this, 0, sizeof(*this));
+		sample_limit = -1;
+	}
+	MinstrelRateStats(int r, bool ht) {
+		memset(this, 0, sizeof(*this));
+		rate = r;
+		sample_limit = -1;
+		if (ht) {
+			usecs = calc_usecs_wifi_packet_ht(1500, rate, 0);
+		} else {
+			usecs = calc_usecs_wifi_packet(1500, rate, 0);
+		}
+		if (!usecs) {
+			usecs = 1000000;
+		}
+	}
+};
 
 struct MinstrelDstInfo {
 public:
+	// rates and MCS indexes fit the signed rate fields of click_wifi_extra
+	enum { MAX_RATE = 128 };
 	EtherAddress eth;
-	Vector<int> rates;
-	Vector<int> successes;
-	Vector<int> attempts;
-	Vector<int> last_successes;
-	Vector<int> last_attempts;
-	Vector<int> hist_successes;
-	Vector<int> hist_attempts;
-	Vector<int> cur_prob;
-	Vector<int> cur_tp;
-	Vector<int> probability;
-	Vector<int> sample_limit;
+	bool ht;
+	// rates at max_tp_rate, max_tp_rate2, max_prob_rate and 0, frames
+	// not used for sampling are sent without reading the statistics
+	int8_t chain[4];
+	Vector<MinstrelRateStats> rates;
 	int packet_count;
 	int sample_count;
 	int max_tp_rate;
 	int max_tp_rate2;
 	int max_prob_rate;
-	bool ht;
+	int8_t index[MAX_RATE];
+	const AirtimeTable *airtime;
+	int airtime_rate;
 	MinstrelDstInfo() {
 		eth = EtherAddress();
-		rates = Vector<int>();
-		successes = Vector<int>();
-		attempts = Vector<int>();
-		last_successes = Vector<int>();
-		last_attempts = Vector<int>();
-		hist_successes = Vector<int>();
-		hist_attempts = Vector<int>();
-		cur_prob = Vector<int>();
-		cur_tp = Vector<int>();
-		probability = Vector<int>();
-		sample_limit = Vector<int>();
+		ht = false;
+		memset(chain, 0, sizeof(chain));
 		packet_count = 0;
 		sample_count = 0;
 		max_tp_rate = 0;
 		max_tp_rate2 = 0;
 		max_prob_rate = 0;
-		ht = false;
+		memset(index, -1, sizeof(index));
+		airtime = 0;
+		airtime_rate = -1;
 	}
-	MinstrelDstInfo(EtherAddress neighbor, Vector<int> supported, bool ht_rates) {
+	MinstrelDstInfo(EtherAddress neighbor, const Vector<int> &supported, bool ht_rates) {
 		eth = neighbor;
+		rates.reserve(supported.size());
 		for (int i = 0; i < supported.size(); i++) {
-			rates.push_back(supported[i]);
+			rates.push_back(MinstrelRateStats(supported[i], ht_rates));
 		}
-		successes = Vector<int>(supported.size(), 0);
-		attempts = Vector<int>(supported.size(), 0);
-		last_successes = Vector<int>(supported.size(), 0);
-		last_attempts = Vector<int>(supported.size(), 0);
-		hist_successes = Vector<int>(supported.size(), 0);
-		hist_attempts = Vector<int>(supported.size(), 0);
-		cur_prob = Vector<int>(supported.size(), 0);
-		cur_tp = Vector<int>(supported.size(), 0);
-		probability = Vector<int>(supported.size(), 0);
-		sample_limit = Vector<int>(supported.size(), -1);
 		packet_count = 0;
 		sample_count = 0;
 		max_tp_rate = 0;
 		max_tp_rate2 = 0;
 		max_prob_rate = 0;
 		ht = ht_rates;
-	}
-	int rate_index(int rate) {
-		int ndx = -1;
-		for (int x = 0; x < rates.size(); x++) {
-			if (rate == rates[x]) {
-				ndx = x;
-				break;
+		set_chain();
+		airtime = 0;
+		airtime_rate = -1;
+		// a rate listed twice maps to its first position
+		memset(index, -1, sizeof(index));
+		for (int i = rates.size() - 1; i >= 0; i--) {
+			if (supported[i] >= 0 && supported[i] < MAX_RATE && i < MAX_RATE) {
+				index[supported[i]] = i;
 			}
 		}
-		return (ndx == rates.size()) ? -1 : ndx;
+	}
+	void set_chain() {
+		if (rates.size()) {
+			chain[0] = rates[max_tp_rate].rate;
+			chain[1] = rates[max_tp_rate2].rate;
+			chain[2] = rates[max_prob_rate].rate;
+			chain[3] = rates[0].rate;
+		} else {
+			memset(chain, 0, sizeof(chain));
+		}
+	}
+	int rate_index(int rate) const {
+		return (rate >= 0 && rate < MAX_RATE) ? index[rate] : -1;
 	}
 	void add_result(int rate, int tries, int success) {
 		int ndx = rate_index(rate);
 		if (ndx >= 0) {
-			successes[ndx] += success;
-			attempts[ndx] += tries;
+			rates[ndx].successes += success;
+			rates[ndx].attempts += tries;
 		}
 	}
+	// fold the results of the last period into the statistics
+	void update(unsigned ewma_level) {
+		int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
+		int max_prob = 0, index_max_prob = 0;
+		uint32_t p;
+		int i;
+		for (i = 0; i < rates.size(); i++) {
+			MinstrelRateStats *r = &rates[i];
+			if (r->attempts) {
+				p = (r->successes * 18000) / r->attempts;
+				r->hist_successes += r->successes;
+				r->hist_attempts += r->attempts;
+				r->cur_prob = p;
+				p = ((p * (100 - ewma_level)) + (r->probability * ewma_level)) / 100;
+				r->probability = p;
+				r->cur_tp = p * (1000000 / r->usecs);
+			}
+			r->last_successes = r->successes;
+			r->last_attempts = r->attempts;
+			r->successes = 0;
+			r->attempts = 0;
+			/* Sample less often below the 10% chance of success.
+			 * Sample less often above the 95% chance of success. */
+			if ((r->probability > 17100) || (r->probability < 1800)) {
+				r->sample_limit = 4;
+			} else {
+				r->sample_limit = -1;
+			}
+			if (max_tp < r->cur_tp) {
+				index_max_tp = i;
+				max_tp = r->cur_tp;
+			}
+			if (max_prob < r->probability) {
+				index_max_prob = i;
+				max_prob = r->probability;
+			}
+		}
+		max_tp = 0;
+		for (i = 0; i < rates.size(); i++) {
+			if (i == index_max_tp) {
+				continue;
+			}
+			if (max_tp < rates[i].cur_tp) {
+				index_max_tp2 = i;
+				max_tp = rates[i].cur_tp;
+			}
+		}
+		max_tp_rate = index_max_tp;
+		max_tp_rate2 = index_max_tp2;
+		max_prob_rate = index_max_prob;
+		set_chain();
+	}
 	String unparse() {
 		StringAccum sa;
 		int tp, prob, eprob, rate;
@@ -105,24 +251,25 @@ public:
 		sa << eth << "\n";
 		sa << "rate    throughput    ewma prob    this prob    this success (attempts)    success    attempts\n";
 		for (int i = 0; i < rates.size(); i++) {
-			tp = cur_tp[i] / ((18000 << 10) / 96);
-			prob = cur_prob[i] / 18;
-			eprob = probability[i] / 18;
+			const MinstrelRateStats *r = &rates[i];
+			tp = r->cur_tp / ((18000 << 10) / 96);
+			prob = r->cur_prob / 18;
+			eprob = r->probability / 18;
 			if (ht) {
-				rate = rates[i];
+				rate = r->rate;
 			} else {
-				rate = rates[i] / 2;
+				rate = r->rate / 2;
 			}
 			sprintf(buffer, "%2d%s    %2u.%1u    %3u.%1u    %3u.%1u    %3u (%3u)    %8llu    %8llu\n",
 					rate,
-					(rates[i] % 1 && !ht) ? ".5" : "  ",
+					(r->rate % 1 && !ht) ? ".5" : "  ",
 					tp / 10, tp % 10,
 					eprob / 10, eprob % 10,
 					prob / 10, prob % 10,
-					last_successes[i],
-					last_attempts[i],
-					(unsigned long long) hist_successes[i],
-					(unsigned long long) hist_attempts[i]);
+					r->last_successes,
+					r->last_attempts,
+					(unsigned long long) r->hist_successes,
+					(unsigned long long) r->hist_attempts);
 			if (i == max_tp_rate)
 				sa << 'T';
 			else if (i == max_tp_rate2)
@@ -147,11 +294,8 @@ public:
 	}
 };
 
-typedef HashMap<EtherAddress, MinstrelDstInfo> MinstrelNeighborTable;
-typedef MinstrelNeighborTable::iterator MinstrelIter;
-
-typedef HashTable<uint8_t, uint32_t> TTime;
-typedef TTime::iterator TTimeIter;
+typedef Vector<MinstrelDstInfo> MinstrelNeighborTable;
+typedef HashTable<EtherAddress, int> MinstrelNeighborIndex;
 
 class Minstrel : public Element { public:
 
@@ -176,35 +320,28 @@ class Minstrel : public Element { public:
 
 	void assign_rate(Packet *);
 	void process_feedback(Packet *);
+	void update_rates();
 
-	inline uint32_t estimate_usecs_wifi_packet(Packet *p) {
-		//struct click_wifi *w = (struct click_wifi *) p->data();
-		//EtherAddress dst = EtherAddress(w->i_addr1);
-		return calc_usecs_wifi_packet(p->length(), 1, 0);
-	}
+	const AirtimeTable * airtime(EtherAddress dst);
+	uint32_t airtime_generation() const { return _airtime_generation; }
 
-	MinstrelNeighborTable * neighbors() { return &_neighbors; }
-	TransmissionPolicies * tx_policies() { return _tx_policies; }
-	bool forget_station(EtherAddress addr) { return _neighbors.erase(addr); }
+	bool neighbor(EtherAddress, MinstrelDstInfo &);
+	MinstrelDstInfo * insert_neighbor(EtherAddress, TxPolicyInfo *);
+	bool forget_station(EtherAddress);
 
-	MinstrelDstInfo * insert_neighbor(EtherAddress dst, TxPolicyInfo * txp) {
-		MinstrelDstInfo *nfo;
-		if (txp->_ht_mcs.size()) {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_ht_mcs, true));
-			nfo = _neighbors.findp(dst);
-		} else {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_mcs, false));
-			nfo = _neighbors.findp(dst);
-		}
-		return nfo;
-	}
+	TransmissionPolicies * tx_policies() { return _tx_policies; }
 
 private:
 
+	SimpleSpinlock _lock;
 	MinstrelNeighborTable _neighbors;
+	MinstrelNeighborIndex _index;
+	Reclaimer _reclaimer;
 	TransmissionPolicies * _tx_policies;
 	Timer _timer;
-	TTime _transm_time;
+	AirtimeTable _default_airtime;
+	volatile uint32_t _airtime_generation;
+	uint32_t _airtime_rebuilds;
 
 	unsigned _lookaround_rate;
 	unsigned _offset;
@@ -213,6 +350,14 @@ private:
 	unsigned _ewma_level;
 	bool _debug;
 
+	MinstrelDstInfo * find_neighbor(EtherAddress dst) {
+		int *i = _index.get_pointer(dst);
+		return i ? &_neighbors[*i] : 0;
+	}
+	MinstrelDstInfo * add_neighbor(EtherAddress, TxPolicyInfo *);
+	void set_airtime(MinstrelDstInfo *, int);
+	void retire_airtime(const AirtimeTable *);
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
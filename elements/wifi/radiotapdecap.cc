@@ -17,8 +17,10 @@
 
 #include <click/config.h>
 #include "radiotapdecap.hh"
+#include "wifirxdesc.hh"
 #include <click/etheraddress.hh>
 #include <click/error.hh>
+#include <click/args.hh>
 #include <click/glue.hh>
 #include <click/packet_anno.hh>
 #include <clicknet/wifi.h>
@@ -29,102 +31,267 @@ extern "C" {
 }
 CLICK_DECLS
 
-RadiotapDecap::RadiotapDecap() : _debug(false)
+RadiotapDecap::RadiotapDecap() : _debug(false), _max_plans(8)
 {
+	clear_plans();
 }
 
 RadiotapDecap::~RadiotapDecap()
 {
 }
 
-Packet *
-RadiotapDecap::simple_action(Packet *p) {
+int
+RadiotapDecap::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+	int max_plans = 8;
+	if (Args(conf, this, errh)
+			.read("PLANS", max_plans)
+			.complete() < 0)
+		return -1;
+	if (max_plans < 0 || max_plans > MAX_PLANS)
+		return errh->error("PLANS must be between 0 and %d", MAX_PLANS);
+	_max_plans = max_plans;
+	clear_plans();
+	return 0;
+}
 
-	struct ieee80211_radiotap_header *th = (struct ieee80211_radiotap_header *) p->data();
+void
+RadiotapDecap::clear_plans()
+{
+	_nplans = 0;
+	_last_plan = 0;
+	_next_plan = 0;
+	_plan_hits = 0;
+	_plan_misses = 0;
+}
+
+int
+RadiotapDecap::build_plan(struct ieee80211_radiotap_header *th, int max_length, RadiotapPlan &plan)
+{
 	struct ieee80211_radiotap_iterator iter;
-	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	const uint8_t *h = (const uint8_t *) th;
 
-	int err = ieee80211_radiotap_iterator_init(&iter, th, p->length(), 0);
+	int err = ieee80211_radiotap_iterator_init(&iter, th, max_length, 0);
+	if (err)
+		return err;
 
-	if (err) {
-		click_chatter("%{element} :: %s :: malformed radiotap header (init returns %d)", this, __func__, err);
-		goto drop;
-	}
+	memset(&plan, 0, sizeof(RadiotapPlan));
+	plan._len = le16_to_cpu(th->it_len);
+	plan._cacheable = true;
 
-	memset((void*)ceh, 0, sizeof(struct click_wifi_extra));
-	ceh->magic = WIFI_EXTRA_MAGIC;
+	// the iterator has checked that the bitmaps fit in the header
+	const uint32_t *present = (const uint32_t *) (h + offsetof(struct ieee80211_radiotap_header, it_present));
+	for (int i = 0; ; i++) {
+		if (i == RadiotapPlan::MAX_PRESENT) {
+			plan._cacheable = false;
+			break;
+		}
+		plan._present[i] = present[i];
+		plan._npresent++;
+		if (!(le32_to_cpu(present[i]) & (1 << IEEE80211_RADIOTAP_EXT)))
+			break;
+	}
 
+	// later occurrences of a field, e.g. the signal of each antenna in
+	// the extended bitmaps, override the earlier ones
 	while (!(err = ieee80211_radiotap_iterator_next(&iter))) {
-		u_int16_t flags;
+		uint16_t offset = iter.this_arg - h;
 		switch (iter.this_arg_index) {
 		case IEEE80211_RADIOTAP_TSFT:
-			ceh->tsft = *((uint64_t *)iter.this_arg);
+			plan._tsft = offset;
 			break;
 		case IEEE80211_RADIOTAP_FLAGS:
-			flags = le16_to_cpu(*(uint16_t *)iter.this_arg);
-			if (flags & IEEE80211_RADIOTAP_F_DATAPAD) {
-				ceh->pad = 1;
-			}
-			if (flags & IEEE80211_RADIOTAP_F_FCS) {
-				p->take(4);
-			}
+			plan._flags = offset;
 			break;
 		case IEEE80211_RADIOTAP_MCS:
-			ceh->rate = *((uint8_t *)iter.this_arg+2);
-			ceh->flags |= WIFI_EXTRA_MCS;
+			plan._rate = offset + 2;
+			plan._mcs = true;
 			break;
 		case IEEE80211_RADIOTAP_RATE:
-			ceh->rate = *iter.this_arg;
+			plan._rate = offset;
 			break;
 		case IEEE80211_RADIOTAP_DATA_RETRIES:
-			ceh->max_tries = *iter.this_arg + 1;
+			plan._retries = offset;
 			break;
 		case IEEE80211_RADIOTAP_CHANNEL:
-			ceh->channel = le16_to_cpu(*(uint16_t *)iter.this_arg);
+			plan._channel = offset;
 			break;
 		case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-			ceh->rssi = *iter.this_arg;
-			break;
-		case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-			ceh->silence = *iter.this_arg;
-			break;
 		case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
-			ceh->rssi = *iter.this_arg;
+			plan._signal = offset;
 			break;
+		case IEEE80211_RADIOTAP_DBM_ANTNOISE:
 		case IEEE80211_RADIOTAP_DB_ANTNOISE:
-			ceh->silence = *iter.this_arg;
+			plan._noise = offset;
 			break;
 		case IEEE80211_RADIOTAP_RX_FLAGS:
-			flags = le16_to_cpu(*(uint16_t *)iter.this_arg);
-			if (flags & IEEE80211_RADIOTAP_F_BADFCS)
-				ceh->flags |= WIFI_EXTRA_RX_ERR;
+			plan._rx_flags = offset;
 			break;
 		case IEEE80211_RADIOTAP_TX_FLAGS:
-			flags = le16_to_cpu(*(uint16_t *)iter.this_arg);
-			ceh->flags |= WIFI_EXTRA_TX;
-			if (flags & IEEE80211_RADIOTAP_F_TX_FAIL)
-				ceh->flags |= WIFI_EXTRA_TX_FAIL;
+			plan._tx_flags = offset;
+			break;
+		case IEEE80211_RADIOTAP_VENDOR_NAMESPACE:
+			// the data of the namespace is skipped, the offsets that
+			// follow depend on its length
+			if (plan._nvns == RadiotapPlan::MAX_VNS) {
+				plan._cacheable = false;
+				break;
+			}
+			plan._vns_offset[plan._nvns] = offset;
+			plan._vns_len[plan._nvns] = le16_to_cpu(*(uint16_t *) (iter.this_arg + 4));
+			plan._nvns++;
 			break;
 		}
 	}
 
-	if (err != -ENOENT) {
-		click_chatter("%{element} :: %s :: malformed radiotap data", this, __func__);
-		goto drop;
+	return err == -ENOENT ? 0 : err;
+}
+
+void
+RadiotapDecap::apply_plan(const RadiotapPlan &plan, Packet *p)
+{
+	const uint8_t *h = p->data();
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+
+	memset((void*)ceh, 0, sizeof(struct click_wifi_extra));
+	ceh->magic = WIFI_EXTRA_MAGIC;
+
+	if (plan._tsft)
+		ceh->tsft = *((uint64_t *) (h + plan._tsft));
+	if (plan._rate)
+		ceh->rate = h[plan._rate];
+	if (plan._mcs)
+		ceh->flags |= WIFI_EXTRA_MCS;
+	if (plan._retries)
+		ceh->max_tries = h[plan._retries] + 1;
+	if (plan._channel)
+		ceh->channel = le16_to_cpu(*(uint16_t *) (h + plan._channel));
+	if (plan._signal)
+		ceh->rssi = h[plan._signal];
+	if (plan._noise)
+		ceh->silence = h[plan._noise];
+	if (plan._rx_flags) {
+		uint16_t flags = le16_to_cpu(*(uint16_t *) (h + plan._rx_flags));
+		if (flags & IEEE80211_RADIOTAP_F_BADFCS)
+			ceh->flags |= WIFI_EXTRA_RX_ERR;
+	}
+	if (plan._tx_flags) {
+		uint16_t flags = le16_to_cpu(*(uint16_t *) (h + plan._tx_flags));
+		ceh->flags |= WIFI_EXTRA_TX;
+		if (flags & IEEE80211_RADIOTAP_F_TX_FAIL)
+			ceh->flags |= WIFI_EXTRA_TX_FAIL;
+	}
+	if (plan._flags) {
+		uint8_t flags = h[plan._flags];
+		if (flags & IEEE80211_RADIOTAP_F_DATAPAD)
+			ceh->pad = 1;
+		if (flags & IEEE80211_RADIOTAP_F_FCS)
+			p->take(4);
+	}
+}
+
+const RadiotapPlan *
+RadiotapDecap::lookup_plan(const uint8_t *h, uint32_t length)
+{
+	if (length < sizeof(struct ieee80211_radiotap_header)
+			|| length < le16_to_cpu(((const struct ieee80211_radiotap_header *) h)->it_len))
+		return 0;
+	if (_nplans && _plans[_last_plan].matches(h))
+		return &_plans[_last_plan];
+	for (int i = 0; i < _nplans; i++) {
+		if (_plans[i].matches(h)) {
+			_last_plan = i;
+			return &_plans[i];
+		}
+	}
+	return 0;
+}
+
+Packet *
+RadiotapDecap::simple_action(Packet *p) {
+
+	struct ieee80211_radiotap_header *th = (struct ieee80211_radiotap_header *) p->data();
+	const RadiotapPlan *plan = lookup_plan(p->data(), p->length());
+	RadiotapPlan new_plan;
+
+	if (plan) {
+		_plan_hits++;
+	} else {
+		int err = build_plan(th, p->length(), new_plan);
+		if (err) {
+			click_chatter("%{element} :: %s :: malformed radiotap header (error %d)", this, __func__, err);
+			p->kill();
+			return 0;
+		}
+		_plan_misses++;
+		plan = &new_plan;
+		if (_max_plans && new_plan._cacheable) {
+			if (_nplans < _max_plans) {
+				_last_plan = _nplans++;
+			} else {
+				_last_plan = _next_plan;
+				_next_plan = (_next_plan + 1) % _max_plans;
+			}
+			_plans[_last_plan] = new_plan;
+		}
 	}
 
-	p->pull(le16_to_cpu(th->it_len));
+	apply_plan(*plan, p);
+
+	p->pull(plan->_len);
 	p->set_mac_header(p->data()); // reset mac-header pointer
 
+	// parse the 802.11 header once for the rest of the RX path
+	WifiRXDesc::parse(p);
+
 	return p;
 
-  drop:
+}
+
+enum {
+	H_PLAN_HITS,
+	H_PLAN_MISSES,
+	H_PLANS,
+	H_RESET,
+};
 
-	p->kill();
+String
+RadiotapDecap::read_handler(Element *e, void *thunk)
+{
+	RadiotapDecap *td = (RadiotapDecap *) e;
+	switch ((uintptr_t) thunk) {
+	case H_PLAN_HITS:
+		return String(td->_plan_hits) + "\n";
+	case H_PLAN_MISSES:
+		return String(td->_plan_misses) + "\n";
+	case H_PLANS:
+		return String(td->_nplans) + "\n";
+	default:
+		return String();
+	}
+}
+
+int
+RadiotapDecap::write_handler(const String &, Element *e, void *thunk, ErrorHandler *)
+{
+	RadiotapDecap *td = (RadiotapDecap *) e;
+	switch ((uintptr_t) thunk) {
+	case H_RESET:
+		td->clear_plans();
+		break;
+	}
 	return 0;
+}
 
+void
+RadiotapDecap::add_handlers()
+{
+	add_read_handler("plan_hits", read_handler, H_PLAN_HITS);
+	add_read_handler("plan_misses", read_handler, H_PLAN_MISSES);
+	add_read_handler("plans", read_handler, H_PLANS);
+	add_write_handler("reset", write_handler, H_RESET);
 }
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(RadiotapDecap)
-ELEMENT_REQUIRES(radiotap)
+ELEMENT_REQUIRES(radiotap WifiRXDesc)
@@ -2,11 +2,12 @@
 #define CLICK_RADIOTAPDECAP_HH
 #include <click/element.hh>
 #include <clicknet/ether.h>
+#include <clicknet/radiotap.h>
 CLICK_DECLS
 
 /*
 =c
-RadiotapDecap()
+RadiotapDecap([I<KEYWORDS>])
 
 =s Wifi
 
@@ -16,9 +17,88 @@ Pulls the click_wifi_radiotap header from a packet and stores it in Packet::anno
 Removes the radiotap header and copies to to Packet->anno(). This contains
 informatino such as rssi, noise, bitrate, etc.
 
+The 802.11 header is then parsed once into the WIFI_RX_DESC_ANNO annotation
+(header length, frame control, sequence control, RSSI, rate and the kind of
+transmitter), which WifiDupeFilter, EmpowerRXStats and EmpowerWifiDecap read
+instead of decoding the header again.
+
+The offsets of the fields read from the radiotap header depend only on the
+presence bitmaps, including the extended ones, and on the length of the
+vendor namespaces they announce. The first frame with a new layout is walked
+with the radiotap iterator and the offsets it finds are kept as a plan for
+that layout, the following frames with the same layout are decoded with
+direct loads. Plans are per element, so a RadiotapDecap should be used by one
+thread only.
+
+Keyword arguments are:
+
+=over 8
+
+=item PLANS
+
+Number of layouts whose plans are kept, at most 16. When all are in use the
+oldest plan is replaced. 0 walks every header with the iterator. Default is 8.
+
+=back 8
+
+=h plan_hits read-only
+Number of headers decoded with a cached plan.
+
+=h plan_misses read-only
+Number of headers walked with the radiotap iterator.
+
+=h plans read-only
+Number of cached plans.
+
+=h reset write-only
+Clears the plans and the counters.
+
 =a RadiotapEncap
 */
 
+// Offsets of the fields RadiotapDecap reads for one radiotap header layout,
+// 0 when a field is absent
+class RadiotapPlan { public:
+
+  enum { MAX_PRESENT = 8, MAX_VNS = 4 };
+
+  uint16_t _len;
+  uint8_t _npresent;
+  uint8_t _nvns;
+  uint32_t _present[MAX_PRESENT];
+  uint16_t _vns_offset[MAX_VNS];
+  uint16_t _vns_len[MAX_VNS];
+
+  uint16_t _tsft;
+  uint16_t _flags;
+  uint16_t _rate;
+  uint16_t _channel;
+  uint16_t _signal;
+  uint16_t _noise;
+  uint16_t _retries;
+  uint16_t _rx_flags;
+  uint16_t _tx_flags;
+  bool _mcs;
+  bool _cacheable;
+
+  // Whether the header at h, which is at least _len bytes long, has the
+  // layout of this plan
+  inline bool matches(const uint8_t *h) const {
+    const struct ieee80211_radiotap_header *th = (const struct ieee80211_radiotap_header *) h;
+    if (th->it_version || le16_to_cpu(th->it_len) != _len)
+      return false;
+    const uint32_t *present = (const uint32_t *) (h + offsetof(struct ieee80211_radiotap_header, it_present));
+    for (int i = 0; i < _npresent; i++)
+      if (present[i] != _present[i])
+        return false;
+    for (int i = 0; i < _nvns; i++)
+      if (le16_to_cpu(*(const uint16_t *) (h + _vns_offset[i] + 4)) != _vns_len[i])
+        return false;
+    return true;
+  }
+
+};
+
 class RadiotapDecap : public Element { public:
 
   RadiotapDecap() CLICK_COLD;
@@ -28,11 +108,35 @@ class RadiotapDecap : public Element { public:
   const char *port_count() const	{ return PORTS_1_1; }
   const char *processing() const	{ return AGNOSTIC; }
 
+  int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
   bool can_live_reconfigure() const	{ return true; }
+  void add_handlers() CLICK_COLD;
 
   Packet *simple_action(Packet *);
   bool _debug;
 
+  enum { MAX_PLANS = 16 };
+
+ private:
+
+  RadiotapPlan _plans[MAX_PLANS];
+  int _max_plans;
+  int _nplans;
+  int _last_plan;
+  int _next_plan;
+  uint64_t _plan_hits;
+  uint64_t _plan_misses;
+
+  // Walks the radiotap header with the iterator and fills the plan for its
+  // layout, returns 0 or the iterator error
+  static int build_plan(struct ieee80211_radiotap_header *, int, RadiotapPlan &);
+  static void apply_plan(const RadiotapPlan &, Packet *);
+  const RadiotapPlan *lookup_plan(const uint8_t *, uint32_t);
+  void clear_plans();
+
+  static String read_handler(Element *, void *);
+  static int write_handler(const String &, Element *, void *, ErrorHandler *);
+
 };
 
 CLICK_ENDDECLS
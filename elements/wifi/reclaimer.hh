@@ -0,0 +1,131 @@
+#ifndef CLICK_RECLAIMER_HH
+#define CLICK_RECLAIMER_HH
+#include <click/element.hh>
+#include <click/master.hh>
+#include <click/task.hh>
+#include <click/sync.hh>
+#include <click/atomic.hh>
+CLICK_DECLS
+
+/*
+ * Frees objects that readers on other threads may still be using. Readers
+ * take no lock and no reference: they only have to drop the pointers they
+ * load before the push, pull, task or timer run that loaded them returns.
+ * Every router thread then goes through a quiescent state between two such
+ * runs. A retired object is unlinked by its writer first, so once every
+ * thread has run something after the retirement no reader can still hold
+ * it.
+ *
+ * The reclaimer owns one task per thread. Retiring an object starts a grace
+ * period, unless one is running, by scheduling all of them; the objects
+ * retired before it started are freed by the last task to run, which then
+ * starts the next grace period for the objects retired meanwhile. Nothing
+ * runs while nothing is retired, and an idle thread is woken up for the
+ * grace period instead of holding it back. Objects retired before
+ * initialize() are kept until the reclaimer is destroyed.
+ */
+class Reclaimer {
+public:
+
+	Reclaimer() : _covered(0) {
+		_waiting = 0;
+	}
+
+	~Reclaimer() {
+		for (int i = 0; i < _tasks.size(); i++) {
+			delete _tasks[i];
+		}
+		reclaim(_retired.size());
+	}
+
+	// Creates the task of every thread of the router of owner
+	void initialize(Element *owner) {
+		for (int i = 0; i < owner->master()->nthreads(); i++) {
+			Task *task = new Task(quiescent, this);
+			task->initialize(owner, false);
+			task->move_thread(i);
+			_tasks.push_back(task);
+		}
+		_lock.acquire();
+		if (_retired.size()) {
+			start();
+		}
+		_lock.release();
+	}
+
+	// Frees p with delete once no reader can hold it, may be called on
+	// any thread
+	template <typename T> void retire(const T *p) {
+		if (p) {
+			retire((void *) p, &destroy<T>);
+		}
+	}
+
+	// Objects waiting to be freed
+	int pending() const {
+		return _retired.size();
+	}
+
+private:
+
+	struct Retired {
+		void *_p;
+		void (*_destroy)(void *);
+	};
+
+	Spinlock _lock;
+	Vector<Retired> _retired;
+	int _covered; // objects the running grace period frees, 0 if none runs
+	atomic_uint32_t _waiting; // threads the grace period waits for
+	Vector<Task *> _tasks;
+
+	template <typename T> static void destroy(void *p) {
+		delete (T *) p;
+	}
+
+	void retire(void *p, void (*destroy)(void *)) {
+		Retired r;
+		r._p = p;
+		r._destroy = destroy;
+		_lock.acquire();
+		_retired.push_back(r);
+		if (!_covered && _tasks.size()) {
+			start();
+		}
+		_lock.release();
+	}
+
+	// called with the lock held
+	void start() {
+		_covered = _retired.size();
+		_waiting = _tasks.size();
+		for (int i = 0; i < _tasks.size(); i++) {
+			_tasks[i]->reschedule();
+		}
+	}
+
+	void reclaim(int n) {
+		for (int i = 0; i < n; i++) {
+			_retired[i]._destroy(_retired[i]._p);
+		}
+		_retired.erase(_retired.begin(), _retired.begin() + n);
+	}
+
+	static bool quiescent(Task *, void *thunk) {
+		Reclaimer *r = (Reclaimer *) thunk;
+		if (r->_waiting.dec_and_test()) {
+			r->_lock.acquire();
+			r->reclaim(r->_covered);
+			r->_covered = 0;
+			if (r->_retired.size()) {
+				r->start();
+			}
+			r->_lock.release();
+		}
+		return true;
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -28,6 +28,9 @@ TransmissionPolicies::TransmissionPolicies() : _default_tx_policy(0) {
 }
 
 TransmissionPolicies::~TransmissionPolicies() {
+	for (TxTableIter it = _tx_table.begin(); it.live(); it++) {
+		delete it.value();
+	}
 }
 
 int TransmissionPolicies::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -39,6 +42,15 @@ int TransmissionPolicies::configure(Vector<String> &conf, ErrorHandler *errh) {
 		Vector<String> args;
 		cp_spacevec(conf[x], args);
 
+		if (args.size() && args[0] == "BUCKETS") {
+			String edges = conf[x];
+			cp_shift_spacevec(edges);
+			if (_buckets.parse(edges, errh) < 0) {
+				return -1;
+			}
+			continue;
+		}
+
 		if (args.size() != 2) {
 			return errh->error("error param %s must have 2 args", conf[x].c_str());
 		}
@@ -67,7 +79,8 @@ int TransmissionPolicies::configure(Vector<String> &conf, ErrorHandler *errh) {
 				return errh->error("error param %s: must be a TransmissionPolicy element", conf[x].c_str());
 			}
 
-			_tx_table.insert(eth, tx_policy->tx_policy());
+			// the table owns its policies, updates replace them
+			_tx_table.insert(eth, new TxPolicyInfo(*tx_policy->tx_policy()));
 
 		}
 
@@ -82,6 +95,16 @@ int TransmissionPolicies::configure(Vector<String> &conf, ErrorHandler *errh) {
 
 }
 
+int TransmissionPolicies::initialize(ErrorHandler *) {
+	_reclaimer.initialize(this);
+	// the histograms of all the policies use this element's buckets
+	_default_tx_policy->_buckets = &_buckets;
+	for (TxTableIter it = _tx_table.begin(); it.live(); it++) {
+		it.value()->_buckets = &_buckets;
+	}
+	return 0;
+}
+
 TxPolicyInfo *
 TransmissionPolicies::lookup(EtherAddress eth) {
 
@@ -90,7 +113,9 @@ TransmissionPolicies::lookup(EtherAddress eth) {
 		return new TxPolicyInfo();
 	}
 
+	_lock.acquire_read();
 	TxPolicyInfo * dst = _tx_table.find(eth);
+	_lock.release_read();
 
 	if (dst) {
 		return dst;
@@ -108,13 +133,11 @@ TransmissionPolicies::supported(EtherAddress eth) {
 		return new TxPolicyInfo();
 	}
 
+	_lock.acquire_read();
 	TxPolicyInfo *dst = _tx_table.find(eth);
+	_lock.release_read();
 
-	if (dst) {
-		return dst;
-	}
-
-	return 0;
+	return dst;
 
 }
 
@@ -131,13 +154,16 @@ int TransmissionPolicies::insert(EtherAddress eth, Vector<int> mcs, Vector<int>
 		return -1;
 	}
 
-	TxPolicyInfo *dst = _tx_table.find(eth);
-
-	if (!dst) {
-		_tx_table.insert(eth, new TxPolicyInfo());
-		dst = _tx_table.find(eth);
+	// modify a copy, the TX path may be using the current policy
+	_lock.acquire_read();
+	TxPolicyInfo *old = _tx_table.find(eth);
+	TxPolicyInfo *dst = old ? new TxPolicyInfo(*old) : new TxPolicyInfo();
+	if (old) {
+		dst->share_counters(old);
 	}
+	_lock.release_read();
 
+	dst->_buckets = &_buckets;
 	dst->_mcs.clear();
 	dst->_ht_mcs.clear();
 	dst->_no_ack = no_ack;
@@ -171,6 +197,12 @@ int TransmissionPolicies::insert(EtherAddress eth, Vector<int> mcs, Vector<int>
 		dst->_ht_mcs = ht_mcs;
 	}
 
+	_lock.acquire_write();
+	_tx_table.insert(eth, dst);
+	_lock.release_write();
+
+	_reclaimer.retire(old);
+
 	return 0;
 
 }
@@ -184,26 +216,45 @@ int TransmissionPolicies::remove(EtherAddress eth) {
 		return -1;
 	}
 
+	_lock.acquire_write();
 	TxPolicyInfo *dst = _tx_table.find(eth);
+	if (dst) {
+		_tx_table.remove(eth);
+	}
+	_lock.release_write();
 
 	if (!dst) {
 		return -1;
 	}
 
-	_tx_table.remove(eth);
+	_reclaimer.retire(dst);
 
 	return 0;
 
 }
 
 void TransmissionPolicies::clear() {
+	Vector<EtherAddress> addrs = stations();
+	for (int i = 0; i < addrs.size(); i++) {
+		remove(addrs[i]);
+	}
+}
+
+Vector<EtherAddress> TransmissionPolicies::stations() {
+	Vector<EtherAddress> addrs;
+	_lock.acquire_read();
 	for (TxTableIter it = _tx_table.begin(); it.live(); it++) {
-		remove(it.key());
+		addrs.push_back(it.key());
 	}
+	_lock.release_read();
+	return addrs;
 }
 
 enum {
-	H_POLICIES
+	H_POLICIES,
+	H_BUCKETS,
+	H_INSERT,
+	H_REMOVE
 };
 
 String TransmissionPolicies::read_handler(Element *e, void *thunk) {
@@ -212,18 +263,60 @@ String TransmissionPolicies::read_handler(Element *e, void *thunk) {
 	case H_POLICIES: {
 	    StringAccum sa;
 	    sa << "DEFAULT " << td->_default_tx_policy->unparse() << "\n";
+		td->_lock.acquire_read();
 		for (TxTableIter it = td->_tx_table.begin(); it.live(); it++) {
 		    sa << it.key().unparse() << " " << it.value()->unparse() << "\n";
 		}
+		td->_lock.release_read();
 		return sa.take_string();
 	}
+	case H_BUCKETS:
+		return td->_buckets.unparse() + "\n";
 	default:
 		return String();
 	}
 }
 
+int TransmissionPolicies::write_handler(const String &in_s, Element *e, void *thunk, ErrorHandler *errh) {
+	TransmissionPolicies *td = (TransmissionPolicies *) e;
+	String s = cp_uncomment(in_s);
+	Vector<String> args;
+	cp_spacevec(s, args);
+	EtherAddress eth;
+	switch ((uintptr_t) thunk) {
+	case H_INSERT: {
+		if (args.size() != 2 || !EtherAddressArg().parse(args[0], eth)) {
+			return errh->error("expected ADDRESS POLICY");
+		}
+		TransmissionPolicy * tx_policy;
+		if (!ElementCastArg("TransmissionPolicy").parse(args[1], tx_policy, Args(e, errh))) {
+			return errh->error("%s: must be a TransmissionPolicy element", args[1].c_str());
+		}
+		TxPolicyInfo *p = tx_policy->tx_policy();
+		if (td->insert(eth, p->_mcs, p->_ht_mcs, p->_no_ack, p->_tx_mcast, p->_ur_mcast_count, p->_rts_cts) < 0) {
+			return errh->error("cannot insert %s", args[0].c_str());
+		}
+		return 0;
+	}
+	case H_REMOVE: {
+		if (args.size() != 1 || !EtherAddressArg().parse(args[0], eth)) {
+			return errh->error("expected ADDRESS");
+		}
+		if (td->remove(eth) < 0) {
+			return errh->error("%s not found", args[0].c_str());
+		}
+		return 0;
+	}
+	default:
+		return 0;
+	}
+}
+
 void TransmissionPolicies::add_handlers() {
 	add_read_handler("policies", read_handler, (void *) H_POLICIES);
+	add_read_handler("buckets", read_handler, (void *) H_BUCKETS);
+	add_write_handler("insert", write_handler, (void *) H_INSERT);
+	add_write_handler("remove", write_handler, (void *) H_REMOVE);
 }
 
 CLICK_ENDDECLS
@@ -5,6 +5,8 @@
 #include <click/etheraddress.hh>
 #include <click/bighashmap.hh>
 #include <click/glue.hh>
+#include <click/sync.hh>
+#include <elements/wifi/reclaimer.hh>
 #include "transmissionpolicy.hh"
 CLICK_DECLS
 
@@ -19,16 +21,32 @@ Tracks bit-rate capabilities of other stations.
 
 =d
 
-Tracks a list of bitrates other stations are capable of.
+Tracks a list of bitrates other stations are capable of. Arguments are
+"ADDRESS POLICY" pairs, "DEFAULT POLICY" and "BUCKETS EDGES", where EDGES is
+"log2" (the default) or a list of increasing packet lengths that delimit the
+buckets of the per-station TX/RX length histograms. Every bucket counts
+its packets and their bytes, so a bucket can be reported as at most two
+lengths whose counts and bytes add up to those of the bucket.
+
+Lookups may run on any thread. Policies are never modified once
+published: an update replaces the policy with a modified copy and retires
+the old one to a Reclaimer, so the TX path can keep using the pointer
+returned by lookup() while the controller updates the table. The
+copy shares the length histograms of the policy it replaces, so packets
+counted through the old policy are kept.
+
+=h buckets read-only
+Shows the histogram bucket edges.
 
 =h insert write-only
-Inserts an ethernet address and a list of bitrates to the database.
+Takes an "ADDRESS POLICY" pair, as in the arguments, and inserts or replaces
+the policy of ADDRESS. Rates missing from the default policy are dropped.
 
 =h remove write-only
-Removes an ethernet address from the database.
+Removes the policy of an ethernet address.
 
-=h rates read-only
-Shows the entries in the database.
+=h policies read-only
+Shows the default policy and the policy of every address.
 
 =a BeaconScanner
  */
@@ -45,11 +63,12 @@ class TransmissionPolicies : public Element { public:
   const char *port_count() const		{ return PORTS_0_0; }
 
   int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+  int initialize(ErrorHandler *) CLICK_COLD;
 
   void add_handlers() CLICK_COLD;
 
-  TxTable * tx_table() { return &_tx_table; }
   TxPolicyInfo * default_tx_policy() { return _default_tx_policy; }
+  const LengthBuckets * buckets() const { return &_buckets; }
   void clear();
 
   TxPolicyInfo * lookup(EtherAddress eth);
@@ -59,12 +78,18 @@ class TransmissionPolicies : public Element { public:
   int insert(EtherAddress, Vector<int>, Vector<int>);
   int remove(EtherAddress);
 
+  Vector<EtherAddress> stations();
+
 private:
 
+  ReadWriteLock _lock;
   TxTable _tx_table;
+  Reclaimer _reclaimer;
   TxPolicyInfo * _default_tx_policy;
+  LengthBuckets _buckets;
 
   static String read_handler(Element *, void *);
+  static int write_handler(const String &, Element *, void *, ErrorHandler *);
 
 };
 
@@ -24,6 +24,90 @@
 #include "transmissionpolicy.hh"
 CLICK_DECLS
 
+int LengthBuckets::parse(const String &str, ErrorHandler *errh) {
+
+	Vector<String> args;
+	cp_spacevec(str, args);
+
+	if (args.size() == 1 && args[0].lower() == "log2") {
+		_log2 = true;
+		_edges.clear();
+		_lookup.clear();
+		return 0;
+	}
+
+	Vector<uint16_t> edges;
+	edges.push_back(0);
+
+	for (int x = 0; x < args.size(); x++) {
+		uint16_t edge;
+		if (!IntArg().parse(args[x], edge)) {
+			return errh->error("bucket edge %s must be a packet length", args[x].c_str());
+		}
+		if (edge == 0 && x == 0) {
+			continue;
+		}
+		if (edge <= edges.back()) {
+			return errh->error("bucket edges must be increasing");
+		}
+		edges.push_back(edge);
+	}
+
+	if (edges.size() > MAX_BUCKETS) {
+		return errh->error("at most %d buckets are supported", (int) MAX_BUCKETS);
+	}
+
+	_log2 = false;
+	_edges = edges;
+	_lookup.resize(_edges.back());
+
+	for (int i = 0, b = 0; i < _lookup.size(); i++) {
+		while (b + 1 < _edges.size() && i >= _edges[b + 1]) {
+			b++;
+		}
+		_lookup[i] = b;
+	}
+
+	return 0;
+
+}
+
+String LengthBuckets::unparse() const {
+	if (_log2) {
+		return "log2";
+	}
+	StringAccum sa;
+	for (int i = 0; i < _edges.size(); i++) {
+		sa << (i ? " " : "") << _edges[i];
+	}
+	return sa.take_string();
+}
+
+int LengthHistogram::samples(const LengthBuckets *buckets, uint16_t *sizes, uint32_t *counts) const {
+
+	int n = 0;
+
+	for (int i = 0; i < LengthBuckets::size(buckets); i++) {
+		uint32_t count = this->count(i);
+		if (!count) {
+			continue;
+		}
+		// q * (count - r) + (q + 1) * r == bytes
+		uint64_t bytes = this->bytes(i);
+		uint32_t q = bytes / count;
+		uint32_t r = bytes % count;
+		sizes[n] = q;
+		counts[n++] = count - r;
+		if (r) {
+			sizes[n] = q + 1;
+			counts[n++] = r;
+		}
+	}
+
+	return n;
+
+}
+
 TransmissionPolicy::TransmissionPolicy() {
 }
 
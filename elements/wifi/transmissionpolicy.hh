@@ -8,6 +8,8 @@
 #include <click/bighashmap.hh>
 #include <click/straccum.hh>
 #include <click/glue.hh>
+#include <click/atomic.hh>
+#include <click/integers.hh>
 CLICK_DECLS
 
 /*
@@ -26,8 +28,116 @@ Tracks a list of bitrates other stations are capable of.
 =a BeaconScanner
  */
 
-typedef HashTable<uint16_t, uint32_t> CBytes;
-typedef CBytes::iterator CBytesIter;
+// Bucket edges of the packet length histograms. Bucket i counts the
+// lengths in [edge(i), edge(i + 1)), the last bucket is open ended. The
+// default is log2 buckets: 0, 1, 2-3, 4-7, ..., 32768-65535. A null
+// LengthBuckets pointer stands for the default buckets.
+class LengthBuckets {
+public:
+
+	enum { MAX_BUCKETS = 32, LOG2_BUCKETS = 17 };
+
+	LengthBuckets() : _log2(true) {
+	}
+
+	// Parse "log2" or a list of increasing edges, 0 is implied
+	int parse(const String &, ErrorHandler *);
+
+	int bucket(uint16_t len) const {
+		if (_log2) {
+			return log2_bucket(len);
+		}
+		return len < _lookup.size() ? _lookup[len] : _edges.size() - 1;
+	}
+
+	int size() const {
+		return _log2 ? LOG2_BUCKETS : _edges.size();
+	}
+
+	uint16_t edge(int i) const {
+		if (_log2) {
+			return i ? 1 << (i - 1) : 0;
+		}
+		return _edges[i];
+	}
+
+	String unparse() const;
+
+	static int log2_bucket(uint16_t len) {
+		return len ? 33 - ffs_msb((unsigned) len) : 0;
+	}
+
+	static int bucket(const LengthBuckets *buckets, uint16_t len) {
+		return buckets ? buckets->bucket(len) : log2_bucket(len);
+	}
+
+	static int size(const LengthBuckets *buckets) {
+		return buckets ? buckets->size() : (int) LOG2_BUCKETS;
+	}
+
+private:
+
+	bool _log2;
+	Vector<uint16_t> _edges;
+	Vector<uint8_t> _lookup;
+
+};
+
+// Packet length histogram, the counters can be updated concurrently. Each
+// bucket counts its packets and their bytes, the byte count is split in two
+// words and the update that wraps the low word carries into the high one.
+class LengthHistogram {
+public:
+
+	enum { MAX_SAMPLES = 2 * LengthBuckets::MAX_BUCKETS };
+
+	LengthHistogram() {
+		clear();
+	}
+
+	void update(const LengthBuckets *buckets, uint16_t len) {
+		int i = LengthBuckets::bucket(buckets, len);
+		_counts[i]++;
+		if (_bytes_lo[i].fetch_and_add(len) > 0xFFFFFFFFU - len) {
+			_bytes_hi[i]++;
+		}
+	}
+
+	uint32_t count(int i) const {
+		return _counts[i].value();
+	}
+
+	uint64_t bytes(int i) const {
+		uint32_t hi, lo;
+		do {
+			hi = _bytes_hi[i].value();
+			lo = _bytes_lo[i].value();
+		} while (hi != _bytes_hi[i].value());
+		return ((uint64_t) hi << 32) | lo;
+	}
+
+	// Expands the histogram into (length, count) samples whose counts and
+	// length * count products add up to the packets and bytes of every
+	// bucket: a bucket holding a single length is reported as is, the
+	// others as the two lengths around their mean. Returns the number of
+	// samples, at most MAX_SAMPLES.
+	int samples(const LengthBuckets *, uint16_t *, uint32_t *) const;
+
+	void clear() {
+		for (int i = 0; i < LengthBuckets::MAX_BUCKETS; i++) {
+			_counts[i] = 0;
+			_bytes_lo[i] = 0;
+			_bytes_hi[i] = 0;
+		}
+	}
+
+private:
+
+	atomic_uint32_t _counts[LengthBuckets::MAX_BUCKETS];
+	atomic_uint32_t _bytes_lo[LengthBuckets::MAX_BUCKETS];
+	atomic_uint32_t _bytes_hi[LengthBuckets::MAX_BUCKETS];
+
+};
 
 
 enum empower_tx_mcast_type {
@@ -36,6 +146,37 @@ enum empower_tx_mcast_type {
 	TX_MCAST_UR = 0x2,
 };
 
+// TX/RX length histograms of a station. A policy is replaced by a
+// modified copy on every update, the copy shares the counters of the
+// version it replaces so that the packets counted through the old version
+// during its grace period are not lost. Freed with the last version.
+class TxPolicyCounters {
+public:
+
+	LengthHistogram _tx;
+	LengthHistogram _rx;
+
+	TxPolicyCounters() {
+		_refcount = 1;
+	}
+
+	TxPolicyCounters *use() {
+		_refcount++;
+		return this;
+	}
+
+	void unuse() {
+		if (_refcount.dec_and_test()) {
+			delete this;
+		}
+	}
+
+private:
+
+	atomic_uint32_t _refcount;
+
+};
+
 class TxPolicyInfo {
 public:
 
@@ -45,10 +186,11 @@ public:
 	empower_tx_mcast_type _tx_mcast;
 	int _ur_mcast_count;
 	int _rts_cts;
-	CBytes _tx;
-	CBytes _rx;
+	const LengthBuckets *_buckets;
+	TxPolicyCounters *_counters;
 
-	TxPolicyInfo() {
+	TxPolicyInfo() : _counters(new TxPolicyCounters) {
+		_buckets = 0;
 		_mcs = Vector<int>();
 		_ht_mcs = Vector<int>();
 		_no_ack = false;
@@ -58,8 +200,9 @@ public:
 	}
 
 	TxPolicyInfo(Vector<int> mcs, Vector<int> ht_mcs, bool no_ack, empower_tx_mcast_type tx_mcast,
-			int ur_mcast_count, int rts_cts) {
+			int ur_mcast_count, int rts_cts) : _counters(new TxPolicyCounters) {
 
+		_buckets = 0;
 		_mcs = mcs;
 		_ht_mcs = ht_mcs;
 		_no_ack = no_ack;
@@ -68,18 +211,34 @@ public:
 		_ur_mcast_count = ur_mcast_count;
 	}
 
+	// Copies the policy, the copy starts with its own counters
+	TxPolicyInfo(const TxPolicyInfo &o) : _counters(new TxPolicyCounters) {
+		copy_policy(o);
+	}
+
+	~TxPolicyInfo() {
+		_counters->unuse();
+	}
+
+	// Assigns the policy, the counters are left alone
+	TxPolicyInfo &operator=(const TxPolicyInfo &o) {
+		copy_policy(o);
+		return *this;
+	}
+
+	// Counts the packets in the counters of the given policy from now on
+	void share_counters(const TxPolicyInfo *o) {
+		TxPolicyCounters *counters = o->_counters->use();
+		_counters->unuse();
+		_counters = counters;
+	}
+
 	void update_tx(uint16_t len) {
-		if (_tx.find(len) == _tx.end()) {
-			_tx.set(len, 0);
-		}
-		(*_tx.get_pointer(len))++;
+		_counters->_tx.update(_buckets, len);
 	}
 
 	void update_rx(uint16_t len) {
-		if (_rx.find(len) == _rx.end()) {
-			_rx.set(len, 0);
-		}
-		(*_rx.get_pointer(len))++;
+		_counters->_rx.update(_buckets, len);
 	}
 
 	String unparse() {
@@ -109,6 +268,18 @@ public:
 		return sa.take_string();
 	}
 
+private:
+
+	void copy_policy(const TxPolicyInfo &o) {
+		_mcs = o._mcs;
+		_ht_mcs = o._ht_mcs;
+		_no_ack = o._no_ack;
+		_tx_mcast = o._tx_mcast;
+		_ur_mcast_count = o._ur_mcast_count;
+		_rts_cts = o._rts_cts;
+		_buckets = o._buckets;
+	}
+
 };
 
 class TransmissionPolicy : public Element { public:
@@ -26,12 +26,20 @@
 #include <click/etheraddress.hh>
 #include <clicknet/wifi.h>
 #include "wifidupefilter.hh"
+#include "wifirxdesc.hh"
 
 CLICK_DECLS
 
 WifiDupeFilter::WifiDupeFilter()
-  : _debug(false),
-    _dupes(0)
+  : _mask(0),
+    _timeout(300),
+    _clock(0),
+    _timer(this),
+    _debug(false),
+    _dupes(0),
+    _used(0),
+    _evictions(0),
+    _expirations(0)
 {
 }
 
@@ -42,38 +50,124 @@ WifiDupeFilter::~WifiDupeFilter()
 int
 WifiDupeFilter::configure(Vector<String> &conf, ErrorHandler* errh)
 {
-    return Args(conf, this, errh).read("DEBUG", _debug).complete();
+  uint32_t capacity = 4096;
+  uint32_t memory = 0;
+  if (Args(conf, this, errh)
+      .read("CAPACITY", capacity)
+      .read("MEMORY", memory)
+      .read("TIMEOUT", _timeout)
+      .read("DEBUG", _debug)
+      .complete() < 0)
+    return -1;
+
+  if (memory) {
+    if (memory < MAX_PROBE * sizeof(DstInfo))
+      return errh->error("MEMORY must be at least %u", (unsigned) (MAX_PROBE * sizeof(DstInfo)));
+    capacity = MAX_PROBE;
+    while (capacity * 2 * sizeof(DstInfo) <= memory)
+      capacity *= 2;
+  } else {
+    if (capacity < MAX_PROBE || capacity > (1U << 24))
+      return errh->error("CAPACITY must be between %d and %u", MAX_PROBE, 1U << 24);
+    uint32_t c = MAX_PROBE;
+    while (c < capacity)
+      c *= 2;
+    capacity = c;
+  }
+
+  _table.resize(capacity, DstInfo());
+  _mask = capacity - 1;
+  clear();
+  return 0;
+}
+
+int
+WifiDupeFilter::initialize(ErrorHandler *)
+{
+  _timer.initialize(this);
+  _timer.schedule_after_sec(1);
+  return 0;
+}
+
+void
+WifiDupeFilter::run_timer(Timer *)
+{
+  _clock++;
+  _timer.reschedule_after_sec(1);
+}
+
+void
+WifiDupeFilter::clear()
+{
+  for (int i = 0; i < _table.size(); i++)
+    _table[i]._used = false;
+  _dupes = 0;
+  _used = 0;
+  _evictions = 0;
+  _expirations = 0;
+}
+
+WifiDupeFilter::DstInfo *
+WifiDupeFilter::lookup(const EtherAddress &src, uint32_t now)
+{
+  uint32_t h = hash(src);
+  DstInfo *victim = 0;
+
+  for (int i = 0; i < MAX_PROBE; i++) {
+    DstInfo *nfo = &_table[(h + i) & _mask];
+    if (!nfo->_used) {
+      // slots are never emptied, src is not further on
+      victim = nfo;
+      break;
+    }
+    if (nfo->_eth == src) {
+      nfo->_last = now;
+      return nfo;
+    }
+    if (!victim || (int32_t) (nfo->_last - victim->_last) < 0)
+      victim = nfo;
+  }
+
+  if (!victim->_used) {
+    _used++;
+  } else if (now - victim->_last >= _timeout) {
+    _expirations++;
+  } else {
+    _evictions++;
+  }
+
+  victim->_eth = src;
+  victim->_used = true;
+  victim->_last = now;
+  victim->clear();
+  return victim;
 }
 
 Packet *
 WifiDupeFilter::simple_action(Packet *p_in)
 {
-  click_wifi *w = (click_wifi *) p_in->data();
-
   if (p_in->length() < sizeof(click_wifi)) {
     return p_in;
   }
 
-  EtherAddress src = EtherAddress(w->i_addr2);
-  EtherAddress dst = EtherAddress(w->i_addr1);
-  uint16_t seq = le16_to_cpu(w->i_seq) >> WIFI_SEQ_SEQ_SHIFT;
-  uint8_t frag = le16_to_cpu(w->i_seq) & WIFI_SEQ_FRAG_MASK;
-  u_int8_t more_frag = w->i_fc[1] & WIFI_FC1_MORE_FRAG;
-
-  bool is_frag = frag || more_frag;
+  const click_wifi_rx_desc *d = WifiRXDesc::get(p_in);
 
-  DstInfo *nfo = _table.findp(src);
-
-  if (w->i_fc[0] & WIFI_FC0_TYPE_CTL || dst.is_group()) {
+  // group addressed and control frames are never looked up
+  if (WifiRXDesc::type(d) == WIFI_FC0_TYPE_CTL || (WifiRXDesc::ra(p_in)[0] & 1)) {
     return p_in;
   }
-  if (!nfo) {
-    _table.insert(src, DstInfo(src));
-    nfo = _table.findp(src);
-    nfo->clear();
-  }
 
-  if (w->i_fc[1] & WIFI_FC1_RETRY && seq == nfo->seq &&
+  EtherAddress src = EtherAddress(WifiRXDesc::ta(p_in));
+  uint16_t seq = d->seq >> WIFI_SEQ_SEQ_SHIFT;
+  uint8_t frag = d->seq & WIFI_SEQ_FRAG_MASK;
+  u_int8_t more_frag = d->fc[1] & WIFI_FC1_MORE_FRAG;
+
+  bool is_frag = frag || more_frag;
+
+  DstInfo *nfo = lookup(src, _clock);
+  nfo->_packets++;
+
+  if (d->fc[1] & WIFI_FC1_RETRY && seq == nfo->seq &&
       (!is_frag || frag <= nfo->frag)) {
 	  /* duplicate detected */
 	  if (_debug) {
@@ -101,20 +195,22 @@ WifiDupeFilter::static_read_stats(Element *xf, void *)
   WifiDupeFilter *e = (WifiDupeFilter *) xf;
   StringAccum sa;
 
-  for(DstTable::const_iterator i = e->_table.begin(); i.live(); i++) {
-    DstInfo nfo = i.value();
+  for (int i = 0; i < e->_table.size(); i++) {
+    const DstInfo &nfo = e->_table[i];
+    if (!nfo._used || e->_clock - nfo._last >= e->_timeout)
+      continue;
     sa << nfo._eth;
     sa << " packets " << nfo._packets;
     sa << " dupes " << nfo._dupes;
     sa << " seq " << nfo.seq;
-    sa << " frag " << nfo.frag;
+    sa << " frag " << (int) nfo.frag;
     sa << "\n";
 
   }
   return sa.take_string();
 }
 
-enum {H_DEBUG, H_DUPES, H_RESET};
+enum {H_DEBUG, H_DUPES, H_RESET, H_CAPACITY, H_MEMORY, H_OCCUPANCY, H_EVICTIONS, H_EXPIRATIONS};
 
 static String
 WifiDupeFilter_read_param(Element *e, void *thunk)
@@ -125,6 +221,21 @@ WifiDupeFilter_read_param(Element *e, void *thunk)
 	return String(td->_debug) + "\n";
       case H_DUPES:
 	return String(td->_dupes) + "\n";
+      case H_CAPACITY:
+	return String(td->_table.size()) + "\n";
+      case H_MEMORY:
+	return String(td->_table.size() * sizeof(WifiDupeFilter::DstInfo)) + "\n";
+      case H_OCCUPANCY: {
+	uint32_t live = 0;
+	for (int i = 0; i < td->_table.size(); i++)
+	  if (td->_table[i]._used && td->_clock - td->_table[i]._last < td->_timeout)
+	    live++;
+	return String(live) + "\n";
+      }
+      case H_EVICTIONS:
+	return String(td->_evictions) + "\n";
+      case H_EXPIRATIONS:
+	return String(td->_expirations) + "\n";
     default:
       return String();
     }
@@ -144,8 +255,7 @@ WifiDupeFilter_write_param(const String &in_s, Element *e, void *vparam,
     break;
   }
   case H_RESET: {
-    f->_table.clear();
-    f->_dupes = 0;
+    f->clear();
   }
   }
   return 0;
@@ -156,6 +266,11 @@ WifiDupeFilter::add_handlers()
   add_read_handler("debug", WifiDupeFilter_read_param, H_DEBUG);
   add_read_handler("dupes", WifiDupeFilter_read_param, H_DUPES);
   add_read_handler("drops", WifiDupeFilter_read_param, H_DUPES);
+  add_read_handler("capacity", WifiDupeFilter_read_param, H_CAPACITY);
+  add_read_handler("memory", WifiDupeFilter_read_param, H_MEMORY);
+  add_read_handler("occupancy", WifiDupeFilter_read_param, H_OCCUPANCY);
+  add_read_handler("evictions", WifiDupeFilter_read_param, H_EVICTIONS);
+  add_read_handler("expirations", WifiDupeFilter_read_param, H_EXPIRATIONS);
 
   add_write_handler("debug", WifiDupeFilter_write_param, H_DEBUG);
   add_write_handler("reset", WifiDupeFilter_write_param, H_RESET, Handler::BUTTON);
@@ -166,3 +281,4 @@ WifiDupeFilter::add_handlers()
 EXPORT_ELEMENT(WifiDupeFilter)
 CLICK_ENDDECLS
 
+ELEMENT_REQUIRES(WifiRXDesc)
@@ -2,7 +2,9 @@
 #define CLICK_WIFIDUPEFILTER_HH
 #include <click/element.hh>
 #include <click/string.hh>
-#include <click/hashmap.hh>
+#include <click/etheraddress.hh>
+#include <click/timer.hh>
+#include <click/vector.hh>
 CLICK_DECLS
 
 /*
@@ -16,6 +18,61 @@ Filters out duplicate 802.11 packets based on their sequence number.
 
 =d
 
+Transmitters are kept in a fixed size open addressing table with the
+sequence and fragment number of their last frame. A transmitter is looked
+for in the 8 slots following its hash; when it is not there it takes the
+first empty slot, else the slot of the transmitter not heard from for the
+longest time. Group addressed and control frames are passed through
+without touching the table, so the table does not grow with the number of
+transmitters in range and its memory is allocated once.
+
+Keyword arguments are:
+
+=over 8
+
+=item CAPACITY
+
+Number of transmitters in the table, rounded up to a power of two. Default
+is 4096.
+
+=item MEMORY
+
+Maximum size of the table in bytes, an alternative to CAPACITY. The
+capacity is the largest power of two whose table fits.
+
+=item TIMEOUT
+
+Seconds after which a silent transmitter is expired. Its slot is reused
+before the slot of any live transmitter. Default is 300.
+
+=item DEBUG
+
+Boolean. Print the duplicates. Default is false.
+
+=back 8
+
+=h stats read-only
+One line per live transmitter with its packets, duplicates and last
+sequence and fragment numbers.
+
+=h dupes, drops read-only
+Number of duplicates dropped.
+
+=h capacity, memory read-only
+Size of the table in entries and in bytes.
+
+=h occupancy read-only
+Number of transmitters heard from within TIMEOUT.
+
+=h evictions read-only
+Number of live transmitters replaced because their slots were full.
+
+=h expirations read-only
+Number of expired transmitters replaced.
+
+=h reset write-only
+Clears the table and the counters.
+
 =a WifiEncap, WifiDecap
  */
 
@@ -34,41 +91,63 @@ class WifiDupeFilter : public Element {
 
   Packet *simple_action(Packet *);
 
+  int initialize(ErrorHandler *) CLICK_COLD;
+  void run_timer(Timer *);
+
   static String static_read_stats(Element *xf, void *);
   static String static_read_debug(Element *xf, void *);
   static int static_write_debug(const String &arg, Element *e,
 				void *, ErrorHandler *errh);
   void add_handlers() CLICK_COLD;
 
+  enum { MAX_PROBE = 8 };
+
   class DstInfo {
   public:
     EtherAddress _eth;
-    int _dupes;
-    int _packets;
-
     uint16_t seq;
-    uint16_t frag;
+    uint8_t frag;
+    bool _used;
+    uint32_t _last;
+    uint32_t _dupes;
+    uint32_t _packets;
 
-    DstInfo(EtherAddress eth) {
-      _eth = eth;
-    }
-    DstInfo () { }
+    DstInfo() : _used(false) { }
     void clear() {
       _dupes = 0;
       _packets = 0;
       seq = 0;
       frag = 0;
-
     }
   };
 
-  typedef HashMap <EtherAddress, DstInfo> DstTable;
-  typedef DstTable::const_iterator DstIter;
+  typedef Vector<DstInfo> DstTable;
+
+  // Returns the entry of src, taking a slot for it if it is not in the
+  // table, now is the time in seconds
+  DstInfo *lookup(const EtherAddress &src, uint32_t now);
+  void clear();
 
   DstTable _table;
+  uint32_t _mask;
+  uint32_t _timeout;
+  uint32_t _clock;
+  Timer _timer;
   bool _debug;
 
   int _dupes;
+  uint32_t _used;
+  uint32_t _evictions;
+  uint32_t _expirations;
+
+ private:
+
+  static inline uint32_t hash(const EtherAddress &eth) {
+    const uint16_t *d = eth.sdata();
+    uint32_t x = ((d[0] ^ ((uint32_t) d[1] << 16)) * 0x9E3779B1U) ^ (d[2] * 0x85EBCA77U);
+    return x ^ (x >> 15);
+  }
+
 };
 
 CLICK_ENDDECLS
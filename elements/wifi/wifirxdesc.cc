@@ -0,0 +1,122 @@
+/*
+ * wifirxdesc.{cc,hh} -- parse-once 802.11 RX descriptor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "wifirxdesc.hh"
+CLICK_DECLS
+
+// Kind of transmitter of the management frames without DS bits, by subtype
+static const uint8_t mgt_nods_sender[16] = {
+	WIFI_RX_DESC_STA,	// association request
+	0,			// association response
+	WIFI_RX_DESC_STA,	// reassociation request
+	0,			// reassociation response
+	WIFI_RX_DESC_STA,	// probe request
+	WIFI_RX_DESC_AP,	// probe response
+	0, 0,
+	WIFI_RX_DESC_AP,	// beacon
+	0,			// ATIM
+	WIFI_RX_DESC_STA,	// disassociation
+	WIFI_RX_DESC_STA,	// authentication
+	WIFI_RX_DESC_STA,	// deauthentication
+	0, 0, 0
+};
+
+// Kind of transmitter by frame control, control frames are not classified
+static inline uint8_t
+sender_kind(uint8_t fc0, uint8_t dir)
+{
+	uint8_t type = fc0 & WIFI_FC0_TYPE_MASK;
+	if (type == WIFI_FC0_TYPE_CTL) {
+		return 0;
+	}
+	switch (dir) {
+	case WIFI_FC1_DIR_TODS:
+		// TODS bit not set when TA is an access point, but only when TA is a station
+		return WIFI_RX_DESC_STA;
+	case WIFI_FC1_DIR_FROMDS:
+		// FROMDS bit not set when TA is an station, but only when TA is an access point
+		return WIFI_RX_DESC_AP;
+	case WIFI_FC1_DIR_DSTODS:
+		// DSTODS bit never set
+		return WIFI_RX_DESC_AP;
+	default:
+		break;
+	}
+	if (type == WIFI_FC0_TYPE_DATA) {
+		// NODS never set for data frames unless in ad-hoc mode
+		return WIFI_RX_DESC_STA;
+	} else if (type == WIFI_FC0_TYPE_MGT) {
+		return mgt_nods_sender[(fc0 & WIFI_FC0_SUBTYPE_MASK) >> 4];
+	}
+	return 0;
+}
+
+void WifiRXDesc::parse(Packet *p) {
+
+	click_wifi_rx_desc *d = WIFI_RX_DESC_ANNO(p);
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	const uint8_t *data = p->data();
+	uint32_t length = p->length();
+
+	d->magic = WIFI_RX_DESC_MAGIC;
+	d->length = length;
+	memcpy(&d->rssi, &ceh->rssi, 1);
+	d->rate = ceh->rate;
+	d->reserved = 0;
+
+	if (unlikely(length < sizeof(struct click_wifi))) {
+		d->fc[0] = length >= 2 ? data[0] : 0;
+		d->fc[1] = length >= 2 ? data[1] : 0;
+		d->seq = 0;
+		d->hdr_len = sizeof(struct click_wifi);
+		d->flags = WIFI_RX_DESC_SHORT;
+		if (length >= WIFI_RX_DESC_TA_OFFSET + WIFI_ADDR_LEN) {
+			d->flags |= WIFI_RX_DESC_HAS_TA;
+		}
+		return;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) data;
+	uint8_t fc0 = w->i_fc[0];
+	uint8_t dir = w->i_fc[1] & WIFI_FC1_DIR_MASK;
+	uint8_t flags = WIFI_RX_DESC_HAS_TA | sender_kind(fc0, dir);
+
+	d->fc[0] = fc0;
+	d->fc[1] = w->i_fc[1];
+	d->seq = le16_to_cpu(w->i_seq);
+
+	unsigned hdr_len = sizeof(struct click_wifi);
+
+	if (dir == WIFI_FC1_DIR_DSTODS)
+		hdr_len += WIFI_ADDR_LEN;
+
+	if (WIFI_QOS_HAS_SEQ(w)) {
+		hdr_len += sizeof(uint16_t);
+		flags |= WIFI_RX_DESC_QOS;
+	}
+
+	if ((ceh->magic == WIFI_EXTRA_MAGIC) && ceh->pad && (hdr_len & 3))
+		hdr_len += 4 - (hdr_len & 3);
+
+	if (length < hdr_len)
+		flags |= WIFI_RX_DESC_SHORT;
+
+	d->hdr_len = hdr_len;
+	d->flags = flags;
+
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(WifiRXDesc)
@@ -0,0 +1,64 @@
+#ifndef CLICK_WIFIRXDESC_HH
+#define CLICK_WIFIRXDESC_HH
+#include <click/packet.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/wifi.h>
+CLICK_DECLS
+
+/*
+ * Parse-once 802.11 RX descriptor.
+ *
+ * RadiotapDecap fills the WIFI_RX_DESC_ANNO annotation of every frame it
+ * decapsulates with the header length (QoS control, fourth address and
+ * driver padding included), the frame control, the sequence control, the
+ * RSSI and rate and whether the transmitter is a station or an access
+ * point. The elements further down the monitor path read the descriptor
+ * instead of decoding the header again.
+ *
+ * get() checks that the descriptor still describes the frame (same length
+ * and frame control) and parses it again otherwise, so the elements work
+ * also on frames that did not go through RadiotapDecap. The padding flag
+ * of the WIFI_EXTRA_ANNO annotation is only honored while its magic is
+ * intact, i.e. before any Paint, so the descriptor should be computed by
+ * RadiotapDecap.
+ */
+class WifiRXDesc {
+public:
+
+	static void parse(Packet *);
+
+	static inline const click_wifi_rx_desc *get(Packet *p) {
+		click_wifi_rx_desc *d = WIFI_RX_DESC_ANNO(p);
+		const uint8_t *data = p->data();
+		if (likely(d->magic == WIFI_RX_DESC_MAGIC && d->length == p->length()
+				   && p->length() >= 2 && d->fc[0] == data[0] && d->fc[1] == data[1])) {
+			return d;
+		}
+		parse(p);
+		return d;
+	}
+
+	static inline uint8_t type(const click_wifi_rx_desc *d) {
+		return d->fc[0] & WIFI_FC0_TYPE_MASK;
+	}
+
+	static inline uint8_t subtype(const click_wifi_rx_desc *d) {
+		return d->fc[0] & WIFI_FC0_SUBTYPE_MASK;
+	}
+
+	static inline uint8_t dir(const click_wifi_rx_desc *d) {
+		return d->fc[1] & WIFI_FC1_DIR_MASK;
+	}
+
+	static inline const uint8_t *ra(const Packet *p) {
+		return p->data() + WIFI_RX_DESC_RA_OFFSET;
+	}
+
+	static inline const uint8_t *ta(const Packet *p) {
+		return p->data() + WIFI_RX_DESC_TA_OFFSET;
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
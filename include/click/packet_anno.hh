@@ -11,7 +11,20 @@
 #define DST_IP6_ANNO_OFFSET		0
 #define DST_IP6_ANNO_SIZE		16
 
-// bytes 16-31
+// bytes 0-11
+#define WIFI_RX_DESC_ANNO_OFFSET	0
+#define WIFI_RX_DESC_ANNO_SIZE		12
+#define WIFI_RX_DESC_ANNO(p)		((click_wifi_rx_desc *) ((p)->anno_u8() + WIFI_RX_DESC_ANNO_OFFSET))
+
+// bytes 12-15
+// Overlaps only DST_IP6_ANNO. EmpowerQOSManager sets it when a frame is
+// queued and reads it when the frame is dequeued.
+#define AIRTIME_ANNO_OFFSET		12
+#define AIRTIME_ANNO_SIZE		4
+#define AIRTIME_ANNO(p)			((p)->anno_u32(AIRTIME_ANNO_OFFSET))
+#define SET_AIRTIME_ANNO(p, v)		((p)->set_anno_u32(AIRTIME_ANNO_OFFSET, (v)))
+
+// bytes 16-43
 #define WIFI_EXTRA_ANNO_OFFSET		16
 #define WIFI_EXTRA_ANNO_SIZE		28
 #define WIFI_EXTRA_ANNO(p)		((click_wifi_extra *) ((p)->anno_u8() + WIFI_EXTRA_ANNO_OFFSET))
@@ -53,6 +53,35 @@ struct click_wifi_extra {
 
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/*
+ * 802.11 header parsed once on the RX path, see WIFI_RX_DESC_ANNO and
+ * <elements/wifi/wifirxdesc.hh>
+ */
+#define WIFI_RX_DESC_MAGIC 0xd5
+
+enum {
+  WIFI_RX_DESC_STA				= (1<<0), /* transmitter is a station */
+  WIFI_RX_DESC_AP				= (1<<1), /* transmitter is an access point */
+  WIFI_RX_DESC_HAS_TA			= (1<<2), /* frame carries a transmitter address */
+  WIFI_RX_DESC_QOS				= (1<<3), /* QoS data frame */
+  WIFI_RX_DESC_SHORT			= (1<<4)  /* frame shorter than hdr_len */
+};
+
+struct click_wifi_rx_desc {
+  uint8_t magic;	/* WIFI_RX_DESC_MAGIC */
+  uint8_t flags;	/* see above */
+  uint8_t fc[2];	/* frame control */
+  uint8_t hdr_len;	/* header length including QoS control, 4th address and padding */
+  int8_t rssi;
+  int8_t rate;		/* bitrate in Mbps*2 or MCS index */
+  uint8_t reserved;
+  uint16_t seq;		/* sequence control, host order */
+  uint16_t length;	/* frame length the descriptor was computed for */
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+#define WIFI_RX_DESC_RA_OFFSET 4
+#define WIFI_RX_DESC_TA_OFFSET 10
+
 /*
  * generic definitions for IEEE 802.11 frames
  */